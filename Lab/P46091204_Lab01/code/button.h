@@ -0,0 +1,185 @@
+/**
+ * @file
+ * Table-driven button gesture recogniser
+ *
+ * Every button is a small state machine driven by its raw level and a
+ * monotonic timestamp (see monotonic_ns() in util.h). Each scan is one table
+ * lookup per button: the row is the current state, the column is the pair
+ * (level, timer expired). The entry gives the next state, the events to emit
+ * and the timer to arm. No allocation and no syscalls happen per event, so it
+ * can run for all 8 inputs of a 74HC165 bank on every scan.
+ *
+ * Recognised gestures:
+ *   BTN_EV_PRESS / BTN_EV_RELEASE : debounced edges
+ *   BTN_EV_CLICK                  : press + release, no second press in time
+ *   BTN_EV_DOUBLE_CLICK           : second press within double_click_ns
+ *   BTN_EV_LONG_PRESS             : held for long_press_ns
+ *   BTN_EV_REPEAT                 : every repeat_ns while still held after that
+ */
+
+#ifndef BUTTON_H
+#define BUTTON_H
+
+#include <stdint.h>
+
+/** Event bits returned by button_update() */
+#define BTN_EV_PRESS 0x01
+#define BTN_EV_RELEASE 0x02
+#define BTN_EV_CLICK 0x04
+#define BTN_EV_DOUBLE_CLICK 0x08
+#define BTN_EV_LONG_PRESS 0x10
+#define BTN_EV_REPEAT 0x20
+
+/** Timing of one button, all in nanoseconds */
+struct button_timing {
+  uint64_t debounce_ns;      // level must be stable this long to count
+  uint64_t long_press_ns;    // held this long -> long press
+  uint64_t repeat_ns;        // auto-repeat period after a long press
+  uint64_t double_click_ns;  // max gap between release and second press
+};
+
+/** Sensible defaults for the switches on the UP board HAT */
+#define BUTTON_TIMING_DEFAULT                                  \
+  ((struct button_timing){.debounce_ns = 20000000,            \
+                          .long_press_ns = 600000000,         \
+                          .repeat_ns = 150000000,             \
+                          .double_click_ns = 250000000})
+
+enum button_state {
+  BTN_IDLE,         // released and stable
+  BTN_DOWN_1,       // first press, debouncing
+  BTN_HELD_1,       // first press accepted
+  BTN_UP_1,         // first release, debouncing
+  BTN_GAP,          // released, waiting for a second press
+  BTN_DOWN_2,       // second press, debouncing
+  BTN_HELD_2,       // second press accepted
+  BTN_UP_2,         // second release, debouncing
+  BTN_LONG,         // held past long_press_ns, auto-repeating
+  BTN_UP_LONG,      // release after long press, debouncing
+  BTN_STATE_COUNT,
+};
+
+enum button_timer {
+  BTN_T_KEEP,  // leave the running deadline untouched
+  BTN_T_OFF,   // no timeout in this state
+  BTN_T_DEBOUNCE,
+  BTN_T_LONG,
+  BTN_T_REPEAT,
+  BTN_T_DOUBLE,
+};
+
+struct button_transition {
+  uint8_t next;
+  uint8_t events;
+  uint8_t timer;
+};
+
+/*
+ * Column index: (level pressed ? 1 : 0) | (timer expired ? 2 : 0)
+ *   0: up, 1: down, 2: up + timeout, 3: down + timeout
+ */
+static const struct button_transition button_table[BTN_STATE_COUNT][4] = {
+    [BTN_IDLE] = {{BTN_IDLE, 0, BTN_T_KEEP},
+                  {BTN_DOWN_1, 0, BTN_T_DEBOUNCE},
+                  {BTN_IDLE, 0, BTN_T_OFF},
+                  {BTN_DOWN_1, 0, BTN_T_DEBOUNCE}},
+    [BTN_DOWN_1] = {{BTN_IDLE, 0, BTN_T_OFF},
+                    {BTN_DOWN_1, 0, BTN_T_KEEP},
+                    {BTN_IDLE, 0, BTN_T_OFF},
+                    {BTN_HELD_1, BTN_EV_PRESS, BTN_T_LONG}},
+    [BTN_HELD_1] = {{BTN_UP_1, 0, BTN_T_DEBOUNCE},
+                    {BTN_HELD_1, 0, BTN_T_KEEP},
+                    {BTN_UP_1, 0, BTN_T_DEBOUNCE},
+                    {BTN_LONG, BTN_EV_LONG_PRESS, BTN_T_REPEAT}},
+    [BTN_UP_1] = {{BTN_UP_1, 0, BTN_T_KEEP},
+                  {BTN_HELD_1, 0, BTN_T_LONG},
+                  {BTN_GAP, BTN_EV_RELEASE, BTN_T_DOUBLE},
+                  {BTN_HELD_1, 0, BTN_T_LONG}},
+    [BTN_GAP] = {{BTN_GAP, 0, BTN_T_KEEP},
+                 {BTN_DOWN_2, 0, BTN_T_DEBOUNCE},
+                 {BTN_IDLE, BTN_EV_CLICK, BTN_T_OFF},
+                 {BTN_DOWN_2, 0, BTN_T_DEBOUNCE}},
+    [BTN_DOWN_2] = {{BTN_GAP, 0, BTN_T_DOUBLE},
+                    {BTN_DOWN_2, 0, BTN_T_KEEP},
+                    {BTN_GAP, 0, BTN_T_DOUBLE},
+                    {BTN_HELD_2, BTN_EV_PRESS | BTN_EV_DOUBLE_CLICK,
+                     BTN_T_LONG}},
+    [BTN_HELD_2] = {{BTN_UP_2, 0, BTN_T_DEBOUNCE},
+                    {BTN_HELD_2, 0, BTN_T_KEEP},
+                    {BTN_UP_2, 0, BTN_T_DEBOUNCE},
+                    {BTN_LONG, BTN_EV_LONG_PRESS, BTN_T_REPEAT}},
+    [BTN_UP_2] = {{BTN_UP_2, 0, BTN_T_KEEP},
+                  {BTN_HELD_2, 0, BTN_T_LONG},
+                  {BTN_IDLE, BTN_EV_RELEASE, BTN_T_OFF},
+                  {BTN_HELD_2, 0, BTN_T_LONG}},
+    [BTN_LONG] = {{BTN_UP_LONG, 0, BTN_T_DEBOUNCE},
+                  {BTN_LONG, 0, BTN_T_KEEP},
+                  {BTN_UP_LONG, 0, BTN_T_DEBOUNCE},
+                  {BTN_LONG, BTN_EV_REPEAT, BTN_T_REPEAT}},
+    [BTN_UP_LONG] = {{BTN_UP_LONG, 0, BTN_T_KEEP},
+                     {BTN_LONG, 0, BTN_T_REPEAT},
+                     {BTN_IDLE, BTN_EV_RELEASE, BTN_T_OFF},
+                     {BTN_LONG, 0, BTN_T_REPEAT}},
+};
+
+/** State of one button */
+struct button {
+  uint8_t state;
+  uint64_t deadline;  // UINT64_MAX when no timer is running
+  uint64_t timeout[6];  // indexed by enum button_timer
+};
+
+/**
+ * Initialise a button with the given timing
+ */
+void button_init(struct button *btn, struct button_timing timing) {
+  btn->state = BTN_IDLE;
+  btn->deadline = UINT64_MAX;
+  btn->timeout[BTN_T_KEEP] = 0;
+  btn->timeout[BTN_T_OFF] = 0;
+  btn->timeout[BTN_T_DEBOUNCE] = timing.debounce_ns;
+  btn->timeout[BTN_T_LONG] = timing.long_press_ns;
+  btn->timeout[BTN_T_REPEAT] = timing.repeat_ns;
+  btn->timeout[BTN_T_DOUBLE] = timing.double_click_ns;
+}
+
+/**
+ * Feed one sample of a button
+ *
+ * pressed: 1 if the button is currently pressed (already inverted for
+ * active-low inputs), now: monotonic time in ns.
+ * Return the BTN_EV_* bits that fired on this sample.
+ */
+uint8_t button_update(struct button *btn, int pressed, uint64_t now) {
+  const struct button_transition *tr =
+      &button_table[btn->state][(pressed != 0) | ((now >= btn->deadline) << 1)];
+  btn->state = tr->next;
+  if (tr->timer == BTN_T_OFF)
+    btn->deadline = UINT64_MAX;
+  else if (tr->timer != BTN_T_KEEP)  // saturate so UINT64_MAX disables it
+    btn->deadline = btn->timeout[tr->timer] > UINT64_MAX - now
+                        ? UINT64_MAX
+                        : now + btn->timeout[tr->timer];
+  return tr->events;
+}
+
+/**
+ * Feed one scan of up to 8 buttons sharing a shift register
+ *
+ * levels: raw bits from the 74HC165, bit i belongs to btns[i].
+ * active_low: bits that read 0 when pressed (the HAT pulls switches up).
+ * events: out array, events[i] receives the BTN_EV_* bits of btns[i].
+ * Return a mask of the buttons that produced at least one event.
+ */
+uint8_t button_bank_update(struct button *btns, int count, uint8_t levels,
+                           uint8_t active_low, uint64_t now, uint8_t *events) {
+  uint8_t pressed = levels ^ active_low;
+  uint8_t fired = 0;
+  for (int i = 0; i < count; ++i) {
+    events[i] = button_update(&btns[i], (pressed >> i) & 1u, now);
+    fired |= (events[i] != 0) << i;
+  }
+  return fired;
+}
+
+#endif
@@ -4,6 +4,8 @@
  *
  * Turn on LED1 when SW1 is pressed
  * Turn off LED1 when SW1 is released
+ * The switch is debounced by the shared recogniser in button.h, so the LED
+ * follows real presses and releases only, not the contact bounce.
  */
 
 #include <signal.h>
@@ -12,6 +14,8 @@
 
 #include "mraa.h"
 #include "upboard_hat.h"
+#include "util.h"
+#include "button.h"
 
 volatile sig_atomic_t stopped = 0;
 
@@ -40,16 +44,18 @@ int main() {
 
   /* modify section below this line */
   
-  mraa_gpio_write(gpio_led, 0);
+  struct button sw1;
+  button_init(&sw1, BUTTON_TIMING_DEFAULT);
+  mraa_gpio_write(gpio_led, led_status);
   while (!stopped) {
-    if (mraa_gpio_read(gpio_btn) == 0)  //The pin value becomes 0 when button is pressed
-    {
-      if (mraa_gpio_read(gpio_led))         // if high voltage
-        mraa_gpio_write(gpio_led, 0);
-      else                              // else if low voltage
-        mraa_gpio_write(gpio_led, 1);
-      
-    }
+    // The pin value becomes 0 when button is pressed
+    uint8_t ev = button_update(&sw1, mraa_gpio_read(gpio_btn) == 0,
+                               monotonic_ns());
+    if (ev & BTN_EV_PRESS) led_status = 1;
+    if (ev & BTN_EV_RELEASE) led_status = 0;
+    if (ev & (BTN_EV_PRESS | BTN_EV_RELEASE))
+      mraa_gpio_write(gpio_led, led_status);
+    delay_ms(1);
   }
   
   /* modify section above this line */
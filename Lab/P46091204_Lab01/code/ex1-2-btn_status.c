@@ -3,7 +3,9 @@
  * Read serial input from GPIO
  *
  * Read and print status of switches SW2, SW3 and SW4, which are connected to
- * the 74HC165 chip.
+ * the 74HC165 chip. The register is scanned every SCAN_MS and each input
+ * debounced by the gesture recogniser in button.h; the debounced levels are
+ * printed every PRINT_MS.
  *
  * Datasheet:
  * https://assets.nexperia.com/documents/data-sheet/74HC_HCT165.pdf
@@ -15,6 +17,10 @@
 #include "mraa.h"
 #include "upboard_hat.h"
 #include "util.h"
+#include "button.h"
+
+#define SCAN_MS 5
+#define PRINT_MS 100
 
 volatile sig_atomic_t stopped = 0;
 
@@ -24,7 +30,7 @@ void int_handler(int sig) {
 }
 
 int main() {
-  int switch_status[8] = {0};
+  int switch_status[8] = {1, 1, 1, 1, 1, 1, 1, 1};  // released: pulled up
   // PL: asynchronous parallel load input (active LOW)
   mraa_gpio_context pin_pl = mraa_gpio_init(UP_HAT_74HC165_PL);
   // Q7: serial output from the last stage
@@ -44,8 +50,12 @@ int main() {
   mraa_gpio_dir(pin_ce, MRAA_GPIO_OUT);
   mraa_gpio_dir(pin_clk, MRAA_GPIO_OUT);
 
+  struct button bank[8];
+  uint8_t events[8];
+  for (int i = 0; i < 8; i++) button_init(&bank[i], BUTTON_TIMING_DEFAULT);
+
   signal(SIGINT, int_handler);
-  while (!stopped) {
+  for (unsigned scan = 0; !stopped; scan++) {
     mraa_gpio_write(pin_ce, 1);  // disable clk input
     delay_ns(1000);
     mraa_gpio_write(pin_pl, 0);  // enable parallel data input
@@ -55,26 +65,37 @@ int main() {
     mraa_gpio_write(pin_ce, 0);  // enable clk input
     delay_ns(1000);
 
+    uint8_t levels = 0;
     for (int i = 0; i < 8; i++) {
       mraa_gpio_write(pin_clk, 0);  // unset clk signal
       delay_ns(1000);
-      switch_status[i] =
-          mraa_gpio_read(pin_data);  // read one bit data from pin_data
+      // read one bit data from pin_data
+      levels |= (mraa_gpio_read(pin_data) & 1u) << i;
       mraa_gpio_write(pin_clk, 1);   // set clk signal
       delay_ns(1000);
     }
     mraa_gpio_write(pin_clk, 0);  // unset clk signal
     delay_ns(1000);
+
+    // the switches pull their input low when pressed
+    uint8_t fired =
+        button_bank_update(bank, 8, levels, 0xff, monotonic_ns(), events);
+    for (int i = 0; fired; i++, fired >>= 1) {
+      if (events[i] & BTN_EV_PRESS) switch_status[i] = 0;
+      if (events[i] & BTN_EV_RELEASE) switch_status[i] = 1;
+    }
     
     /* modify section below this line */
     
-    for (int i = 5; i < 8; i++) {
-      printf("SW%d = %d ", 9-i, switch_status[i]);  // print switch status
+    if (scan % (PRINT_MS / SCAN_MS) == 0) {
+      for (int i = 5; i < 8; i++) {
+        printf("SW%d = %d ", 9-i, switch_status[i]);  // print switch status
+      }
+      printf("\n");
     }
-    printf("\n");
     
     /* modify section above this line */
-    delay_ms(100);
+    delay_ms(SCAN_MS);
   }
 
   mraa_gpio_close(pin_pl);
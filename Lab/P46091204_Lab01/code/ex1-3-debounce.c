@@ -1,49 +1,56 @@
+/**
+ * @file
+ * Debounce a switch
+ *
+ * Print "down" / "up" once per real press / release of SW1, ignoring the
+ * contact bounce, with the shared gesture recogniser in button.h
+ */
+
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "button.h"
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
 
 int main() {
   mraa_gpio_context gpio, gpio2;
-  gpio = mraa_gpio_init(18);
-  gpio2 = mraa_gpio_init(22);
+  gpio = mraa_gpio_init(UP_HAT_LED1);
+  gpio2 = mraa_gpio_init(UP_HAT_SW1);
+
+  if (!(gpio && gpio2)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
 
   mraa_gpio_dir(gpio, MRAA_GPIO_OUT);
   mraa_gpio_dir(gpio2, MRAA_GPIO_IN);
-  clock_t Current_time, Previous_down_time, Previous_up_time;
-
-  Previous_down_time = 0;  // Assuming last down time is so long ago
-  Previous_up_time = 0;
-  int switch_status = 1;
-
-    while (1) {
-    if (mraa_gpio_read(gpio2) == 0) {   // if switch down
-      Current_time = clock();
-      
-      double interval = (double)(Current_time - Previous_up_time) / CLOCKS_PER_SEC;
-      // IF switch down immediately after it up,it means bounce occurs.
-      if (interval >= 0.05) {        // 0.05 is suitable to represent "not immediately"
-        if (switch_status == 0) {
-          printf("down\n");
-          switch_status = 1;        // change the token (only up signal can trigger!)
-          Previous_up_time = Current_time;
-        }
-      }
-      
-    } else {                            // if switch up
-      Current_time = clock();
-      
-      double interval = (double)(Current_time - Previous_down_time) / CLOCKS_PER_SEC;
-      // IF switch up immediately after it down,it means bounce occurs.
-      if (interval >= 0.05) {
-        if (switch_status == 1) {
-          printf("up\n");
-          switch_status = 0;        // change the token (only down signal can trigger!)
-          Previous_down_time = Current_time;
-        }
-      }
-    }
+
+  // 50 ms is suitable to represent "not immediately" after the last edge
+  struct button_timing timing = BUTTON_TIMING_DEFAULT;
+  timing.debounce_ns = 50000000;
+  struct button sw1;
+  button_init(&sw1, timing);
+
+  signal(SIGINT, int_handler);
+  while (!stopped) {
+    // The pin value becomes 0 when button is pressed
+    uint8_t ev = button_update(&sw1, mraa_gpio_read(gpio2) == 0, monotonic_ns());
+    if (ev & BTN_EV_PRESS) printf("down\n");
+    if (ev & BTN_EV_RELEASE) printf("up\n");
   }
+
+  mraa_gpio_close(gpio);
+  mraa_gpio_close(gpio2);
 }
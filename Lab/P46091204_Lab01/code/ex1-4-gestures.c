@@ -0,0 +1,131 @@
+/**
+ * @file
+ * Button gestures
+ *
+ * Recognise press, release, click, double-click, long-press and auto-repeat
+ * on SW1 and on SW2, SW3 and SW4 behind the 74HC165. Every input of the
+ * shift register goes through the same table-driven state machine each scan.
+ * A click on SW1 toggles LED1.
+ *
+ * Datasheet:
+ * https://assets.nexperia.com/documents/data-sheet/74HC_HCT165.pdf
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "button.h"
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+mraa_gpio_context pin_pl, pin_data, pin_ce, pin_clk;
+
+/**
+ * Latch the 74HC165 inputs and shift them in, bit i = parallel input D(7-i)
+ */
+uint8_t read_74hc165() {
+  uint8_t bits = 0;
+  mraa_gpio_write(pin_ce, 1);  // disable clk input
+  delay_ns(1000);
+  mraa_gpio_write(pin_pl, 0);  // enable parallel data input
+  delay_ns(1000);
+  mraa_gpio_write(pin_pl, 1);  // disable & hold parallel data input
+  delay_ns(1000);
+  mraa_gpio_write(pin_ce, 0);  // enable clk input
+  delay_ns(1000);
+  for (int i = 0; i < 8; i++) {
+    mraa_gpio_write(pin_clk, 0);  // unset clk signal
+    delay_ns(1000);
+    bits |= (mraa_gpio_read(pin_data) & 1u) << i;
+    mraa_gpio_write(pin_clk, 1);  // set clk signal
+    delay_ns(1000);
+  }
+  mraa_gpio_write(pin_clk, 0);  // unset clk signal
+  return bits;
+}
+
+/**
+ * Print the events fired by one button
+ */
+void print_events(const char *name, uint8_t ev) {
+  if (ev & BTN_EV_PRESS) printf("%s press\n", name);
+  if (ev & BTN_EV_RELEASE) printf("%s release\n", name);
+  if (ev & BTN_EV_CLICK) printf("%s click\n", name);
+  if (ev & BTN_EV_DOUBLE_CLICK) printf("%s double click\n", name);
+  if (ev & BTN_EV_LONG_PRESS) printf("%s long press\n", name);
+  if (ev & BTN_EV_REPEAT) printf("%s repeat\n", name);
+}
+
+int main() {
+  mraa_gpio_context gpio_led = mraa_gpio_init(UP_HAT_LED1);
+  mraa_gpio_context gpio_btn = mraa_gpio_init(UP_HAT_SW1);
+  // PL: asynchronous parallel load input (active LOW)
+  pin_pl = mraa_gpio_init(UP_HAT_74HC165_PL);
+  // Q7: serial output from the last stage
+  pin_data = mraa_gpio_init(UP_HAT_74HC165_Q7);
+  // CE: clock enable input (active LOW)
+  pin_ce = mraa_gpio_init(UP_HAT_74HC165_CE);
+  // CP: clock input (LOW-to-HIGH edge-triggered)
+  pin_clk = mraa_gpio_init(UP_HAT_74HC165_CP);
+
+  if (!(gpio_led && gpio_btn && pin_pl && pin_data && pin_ce && pin_clk)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
+
+  mraa_gpio_dir(gpio_led, MRAA_GPIO_OUT);
+  mraa_gpio_dir(gpio_btn, MRAA_GPIO_IN);
+  mraa_gpio_dir(pin_pl, MRAA_GPIO_OUT);
+  mraa_gpio_dir(pin_data, MRAA_GPIO_IN);
+  mraa_gpio_dir(pin_ce, MRAA_GPIO_OUT);
+  mraa_gpio_dir(pin_clk, MRAA_GPIO_OUT);
+
+  struct button sw1;
+  struct button bank[8];
+  uint8_t bank_events[8];
+  // SW4, SW3 and SW2 sit on bits 5, 6 and 7; the other inputs are spare
+  const char *bank_names[8] = {"D7", "D6", "D5", "D4", "D3", "SW4", "SW3", "SW2"};
+
+  button_init(&sw1, BUTTON_TIMING_DEFAULT);
+  for (int i = 0; i < 8; i++) button_init(&bank[i], BUTTON_TIMING_DEFAULT);
+
+  int led_status = 0;
+  mraa_gpio_write(gpio_led, led_status);
+
+  signal(SIGINT, int_handler);
+  while (!stopped) {
+    uint64_t now = monotonic_ns();
+
+    // The pin value becomes 0 when button is pressed
+    uint8_t ev = button_update(&sw1, mraa_gpio_read(gpio_btn) == 0, now);
+    if (ev) print_events("SW1", ev);
+    if (ev & BTN_EV_CLICK) {
+      led_status = !led_status;
+      mraa_gpio_write(gpio_led, led_status);
+    }
+
+    uint8_t fired =
+        button_bank_update(bank, 8, read_74hc165(), 0xff, now, bank_events);
+    for (int i = 0; fired; i++, fired >>= 1) {
+      if (fired & 1u) print_events(bank_names[i], bank_events[i]);
+    }
+
+    delay_ms(1);
+  }
+
+  mraa_gpio_write(gpio_led, 0);
+  mraa_gpio_close(gpio_led);
+  mraa_gpio_close(gpio_btn);
+  mraa_gpio_close(pin_pl);
+  mraa_gpio_close(pin_data);
+  mraa_gpio_close(pin_ce);
+  mraa_gpio_close(pin_clk);
+}
@@ -4,6 +4,7 @@
  *
  * Turn on LED1 when SW1 is pressed
  * Turn off LED1 when SW1 is released
+ * SW1 is debounced with button.h.
  */
 
 #include <signal.h>
@@ -12,6 +13,8 @@
 
 #include "mraa.h"
 #include "upboard_hat.h"
+#include "util.h"
+#include "button.h"
 
 volatile sig_atomic_t stopped = 0;
 
@@ -36,22 +39,23 @@ int main() {
 
   signal(SIGINT, int_handler);
 
+  struct button sw1;
+  button_init(&sw1, BUTTON_TIMING_DEFAULT);
+  mraa_gpio_write(gpio_led, 0);
   while (!stopped) {
   
     /* modify section below this line */
     
-    // read gpio_btn's value
+    // read gpio_btn's value, debounced
     // write proper value to gpio_led. Proper value is referenced from gpio_btn's value
-    if (mraa_gpio_read(gpio_btn) == 0)  //The pin value becomes 0 when button is pressed
-    {
-      if (mraa_gpio_read(gpio_led))         // if high voltage
-        mraa_gpio_write(gpio_led, 0);
-      else                              // else if low voltage
-        mraa_gpio_write(gpio_led, 1);
-      
-    }
+    // The pin value becomes 0 when button is pressed
+    uint8_t ev = button_update(&sw1, mraa_gpio_read(gpio_btn) == 0,
+                               monotonic_ns());
+    if (ev & BTN_EV_PRESS) mraa_gpio_write(gpio_led, 1);
+    if (ev & BTN_EV_RELEASE) mraa_gpio_write(gpio_led, 0);
     /* modify section above this line */
     
+    delay_ms(1);
   }
   mraa_gpio_close(gpio_led);
   mraa_gpio_close(gpio_btn);
@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -18,6 +19,15 @@ void delay_ns(long ns) {
 
 void delay_ms(double ms) { delay_ns(ms * 1000000); }
 
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds (served by the vDSO, no syscall)
+ */
+uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
 // Check MRAA return status
 #define MRAA_ASSERT(ret)                  \
   do {                                    \
@@ -0,0 +1,305 @@
+/**
+ * @file
+ * ADC capture files
+ *
+ * Record what the MCP3201 saw and replay it later. A capture is a header
+ * followed by self-describing blocks:
+ *
+ *   header : magic "MCP3201\0", version, resolution, VREF, nominal rate,
+ *            start time
+ *   block  : magic, sample count, encoding, payload size, timestamps of the
+ *            first and last sample, then the payload padded to 8 bytes
+ *
+ * Payload encodings:
+ *   ADC_ENC_RAW   : little-endian uint16 per sample
+ *   ADC_ENC_DELTA : first sample as uint16, then each difference to the
+ *                   previous sample as one int8, or 0x80 + uint16 when it
+ *                   does not fit. A still potentiometer costs ~1 byte/sample.
+ *
+ * The writer appends through a user-space buffer and fsync()s every
+ * sync_every blocks rather than every write. The reader mmap()s the file and
+ * walks the blocks in place, so replay is limited by decoding only. A torn
+ * last block from a crash ends the replay instead of failing it.
+ */
+
+#ifndef ADC_CAPTURE_H
+#define ADC_CAPTURE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ADC_CAPTURE_MAGIC "MCP3201"
+#define ADC_CAPTURE_VERSION 1
+#define ADC_CAPTURE_BLOCK_MAGIC 0x4b4c4231u  // "1BLK"
+#define ADC_CAPTURE_BLOCK_SAMPLES 1024
+#define ADC_CAPTURE_BUFFER (64 * 1024)
+
+enum adc_encoding { ADC_ENC_RAW = 0, ADC_ENC_DELTA = 1 };
+
+struct adc_capture_header {
+  char magic[8];
+  uint16_t version;
+  uint16_t resolution;  // bits per sample
+  uint32_t vref_uv;     // reference voltage in microvolts
+  uint32_t rate_mhz;    // nominal sample rate in millihertz, 0 if free running
+  uint32_t reserved;
+  uint64_t t_start_ns;  // CLOCK_MONOTONIC_RAW when the capture started
+};
+
+struct adc_capture_block {
+  uint32_t magic;
+  uint16_t count;
+  uint8_t encoding;
+  uint8_t reserved;
+  uint32_t size;  // payload bytes following this header, multiple of 8
+  uint32_t reserved2;
+  uint64_t t_first_ns, t_last_ns;
+};
+
+_Static_assert(sizeof(struct adc_capture_header) == 32, "header layout");
+_Static_assert(sizeof(struct adc_capture_block) == 32, "block layout");
+
+struct adc_capture_writer {
+  int fd;
+  int encoding;
+  int sync_every;  // blocks between fsync() calls
+  int unsynced;
+  uint8_t *buf;  // encoded blocks waiting for write()
+  size_t used;
+  uint16_t pending[ADC_CAPTURE_BLOCK_SAMPLES];
+  int npending;
+  uint64_t t_first, t_last;
+  uint64_t blocks, samples, bytes;
+};
+
+struct adc_capture_reader {
+  const uint8_t *map;
+  size_t size, off;
+  struct adc_capture_header hdr;
+};
+
+/* -------------------------------- writer -------------------------------- */
+
+/**
+ * Write out the user-space buffer, return 0 on success
+ */
+int adc_capture_drain(struct adc_capture_writer *w) {
+  size_t done = 0;
+  while (done < w->used) {
+    ssize_t r = write(w->fd, w->buf + done, w->used - done);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    done += r;
+  }
+  w->bytes += w->used;
+  w->used = 0;
+  return 0;
+}
+
+/**
+ * Encode the pending samples as one block into the buffer
+ */
+int adc_capture_seal_block(struct adc_capture_writer *w) {
+  if (w->npending == 0) return 0;
+  // worst case: 3 bytes per delta-coded sample, plus header and padding
+  size_t worst = sizeof(struct adc_capture_block) + 3 * w->npending + 8;
+  if (w->used + worst > ADC_CAPTURE_BUFFER && adc_capture_drain(w)) return -1;
+
+  struct adc_capture_block blk = {
+      .magic = ADC_CAPTURE_BLOCK_MAGIC,
+      .count = w->npending,
+      .encoding = w->encoding,
+      .t_first_ns = w->t_first,
+      .t_last_ns = w->t_last,
+  };
+  uint8_t *p = w->buf + w->used + sizeof(blk);
+  uint8_t *start = p;
+  if (w->encoding == ADC_ENC_DELTA) {
+    uint16_t prev = w->pending[0];
+    memcpy(p, &prev, 2);
+    p += 2;
+    for (int i = 1; i < w->npending; i++) {
+      int d = w->pending[i] - prev;
+      if (d >= -127 && d <= 127) {
+        *p++ = (uint8_t)(int8_t)d;
+      } else {
+        *p++ = 0x80;
+        memcpy(p, &w->pending[i], 2);
+        p += 2;
+      }
+      prev = w->pending[i];
+    }
+  } else {
+    memcpy(p, w->pending, w->npending * sizeof(*w->pending));
+    p += w->npending * sizeof(*w->pending);
+  }
+  while ((p - start) & 7) *p++ = 0;
+  blk.size = p - start;
+  memcpy(w->buf + w->used, &blk, sizeof(blk));
+  w->used += sizeof(blk) + blk.size;
+
+  w->blocks++;
+  w->npending = 0;
+  if (++w->unsynced >= w->sync_every) {
+    if (adc_capture_drain(w) || fdatasync(w->fd)) return -1;
+    w->unsynced = 0;
+  }
+  return 0;
+}
+
+/**
+ * Create a capture file, return 0 on success (-1 and errno on failure)
+ *
+ * rate_hz is the nominal rate stored in the header (0: free running).
+ */
+int adc_capture_create(struct adc_capture_writer *w, const char *path,
+                       double vref, int resolution, double rate_hz,
+                       int encoding, int sync_every, uint64_t t_start_ns) {
+  memset(w, 0, sizeof(*w));
+  w->encoding = encoding;
+  w->sync_every = sync_every > 0 ? sync_every : 1;
+  w->buf = malloc(ADC_CAPTURE_BUFFER);
+  if (!w->buf) return -1;
+  w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (w->fd < 0) {
+    free(w->buf);
+    return -1;
+  }
+
+  struct adc_capture_header hdr = {
+      .magic = ADC_CAPTURE_MAGIC,
+      .version = ADC_CAPTURE_VERSION,
+      .resolution = resolution,
+      .vref_uv = vref * 1e6 + 0.5,
+      .rate_mhz = rate_hz * 1e3 + 0.5,
+      .t_start_ns = t_start_ns,
+  };
+  memcpy(w->buf, &hdr, sizeof(hdr));
+  w->used = sizeof(hdr);
+  return 0;
+}
+
+/**
+ * Append n samples with their timestamps, return 0 on success
+ */
+int adc_capture_append(struct adc_capture_writer *w, const uint16_t *code,
+                       const uint64_t *t_ns, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (w->npending == 0) w->t_first = t_ns[i];
+    w->t_last = t_ns[i];
+    w->pending[w->npending++] = code[i];
+    if (w->npending == ADC_CAPTURE_BLOCK_SAMPLES &&
+        adc_capture_seal_block(w))
+      return -1;
+  }
+  w->samples += n;
+  return 0;
+}
+
+/**
+ * Seal the partial block, flush, fsync and close, return 0 on success
+ */
+int adc_capture_close(struct adc_capture_writer *w) {
+  int ret = 0;
+  if (adc_capture_seal_block(w) || adc_capture_drain(w) || fdatasync(w->fd))
+    ret = -1;
+  if (close(w->fd)) ret = -1;
+  free(w->buf);
+  return ret;
+}
+
+/* -------------------------------- reader -------------------------------- */
+
+/**
+ * Map a capture file for replay, return 0 on success
+ */
+int adc_capture_map(struct adc_capture_reader *r, const char *path) {
+  memset(r, 0, sizeof(*r));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(r->hdr)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  r->map = map;
+  r->size = st.st_size;
+  memcpy(&r->hdr, r->map, sizeof(r->hdr));
+  r->off = sizeof(r->hdr);
+  if (memcmp(r->hdr.magic, ADC_CAPTURE_MAGIC, sizeof(r->hdr.magic)) ||
+      r->hdr.version != ADC_CAPTURE_VERSION) {
+    munmap(map, r->size);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+void adc_capture_unmap(struct adc_capture_reader *r) {
+  munmap((void *)r->map, r->size);
+}
+
+/**
+ * Decode the next block into code (room for ADC_CAPTURE_BLOCK_SAMPLES)
+ *
+ * Return the number of samples, 0 at the end of the file or at a torn /
+ * corrupt block.
+ */
+int adc_capture_next(struct adc_capture_reader *r, uint16_t *code,
+                     struct adc_capture_block *blk) {
+  if (r->size - r->off < sizeof(*blk)) return 0;
+  memcpy(blk, r->map + r->off, sizeof(*blk));
+  if (blk->magic != ADC_CAPTURE_BLOCK_MAGIC ||
+      blk->count > ADC_CAPTURE_BLOCK_SAMPLES ||
+      r->size - r->off - sizeof(*blk) < blk->size)
+    return 0;
+
+  const uint8_t *p = r->map + r->off + sizeof(*blk);
+  const uint8_t *end = p + blk->size;
+  if (blk->encoding == ADC_ENC_RAW) {
+    if (blk->size < blk->count * sizeof(*code)) return 0;
+    memcpy(code, p, blk->count * sizeof(*code));
+  } else if (blk->encoding == ADC_ENC_DELTA && blk->count) {
+    uint16_t v;
+    if (end - p < 2) return 0;
+    memcpy(&v, p, 2);
+    p += 2;
+    code[0] = v;
+    for (int i = 1; i < blk->count; i++) {
+      if (p >= end) return 0;
+      int8_t d = (int8_t)*p++;
+      if ((uint8_t)d == 0x80) {
+        if (end - p < 2) return 0;
+        memcpy(&v, p, 2);
+        p += 2;
+      } else {
+        v += d;
+      }
+      code[i] = v;
+    }
+  } else if (blk->count) {
+    return 0;  // unknown encoding
+  }
+  r->off += sizeof(*blk) + blk->size;
+  return blk->count;
+}
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * @file
+ * Bit-banged MCP3201 / MCP3204 / MCP3208 behind one driver interface
+ *
+ * All three parts share the CLK / DOUT / CS pins of the HAT socket; the
+ * MCP3204 and MCP3208 additionally need DIN for the channel select command.
+ * Each part is an adc_ops table; adc_dev_open() picks one by name.
+ *
+ * The parts only convert once per CS frame (clocking on after B0 shifts out
+ * the LSB-first copy, not a new sample), so a scan of several channels is a
+ * train of frames: the scan loop keeps CS high only for t_CSH between them
+ * and does no other work, which is as close to one burst as the parts allow.
+ *
+ * Frame layout with the clock idling high, data read after each rising edge:
+ *   MCP3201:     3 cycles sample + null, then B11..B0               15 cycles
+ *   MCP3204/08:  start, SGL, D2, D1, D0 on DIN, 1 cycle sample,
+ *                1 null, then B11..B0                              19 cycles
+ *
+ * Datasheets:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21298e.pdf
+ */
+
+#ifndef ADC_DRIVER_H
+#define ADC_DRIVER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "adc_stream.h"
+
+// DIN of an MCP3204/08 in the MCP3201 socket; not routed on the HAT, wire it
+// to any free header pin and override with -DUP_HAT_MCP320X_DIN=<pin>
+#ifndef UP_HAT_MCP320X_DIN
+#define UP_HAT_MCP320X_DIN 36
+#endif
+
+#define ADC_MAX_CHANNELS 8
+
+struct adc_dev;
+
+struct adc_ops {
+  const char *name;
+  int channels;
+  int needs_din;
+  /** One CS frame on channel ch; t_ns gets the CS falling edge */
+  uint16_t (*convert)(struct adc_dev *dev, int ch, uint64_t *t_ns);
+};
+
+struct adc_dev {
+  const struct adc_ops *ops;
+  mraa_gpio_context clk, dout, din, cs;
+  long half_clock_ns;
+  uint64_t scans;
+  uint64_t t_open;
+  uint64_t conversions[ADC_MAX_CHANNELS];
+  uint64_t busy_ns[ADC_MAX_CHANNELS];  // CS low time per channel
+};
+
+/**
+ * Clock out cmd_bits of cmd (MSB first) on DIN, then skip and read 12 bits
+ */
+uint16_t adc_dev_frame(struct adc_dev *dev, uint32_t cmd, int cmd_bits,
+                       int skip, uint64_t *t_ns) {
+  mraa_gpio_write(dev->cs, 0);
+  *t_ns = monotonic_raw_ns();
+  delay_spin_ns(dev->half_clock_ns);
+  for (int i = cmd_bits - 1; i >= 0; i--) {
+    mraa_gpio_write(dev->clk, 0);
+    mraa_gpio_write(dev->din, (cmd >> i) & 1);  // latched on the rising edge
+    delay_spin_ns(dev->half_clock_ns);
+    mraa_gpio_write(dev->clk, 1);
+    delay_spin_ns(dev->half_clock_ns);
+  }
+  uint16_t code = 0;
+  for (int i = 0; i < skip + 12; i++) {
+    mraa_gpio_write(dev->clk, 0);
+    delay_spin_ns(dev->half_clock_ns);
+    mraa_gpio_write(dev->clk, 1);
+    if (i >= skip) code = (code << 1) | mraa_gpio_read(dev->dout);
+    delay_spin_ns(dev->half_clock_ns);
+  }
+  mraa_gpio_write(dev->cs, 1);
+  return code;
+}
+
+uint16_t adc_mcp3201_convert(struct adc_dev *dev, int ch, uint64_t *t_ns) {
+  (void)ch;
+  return adc_dev_frame(dev, 0, 0, 3, t_ns);
+}
+
+uint16_t adc_mcp320x_convert(struct adc_dev *dev, int ch, uint64_t *t_ns) {
+  // start, single-ended, D2..D0 (D2 is don't-care on the MCP3204)
+  return adc_dev_frame(dev, 0x18 | ch, 5, 2, t_ns);
+}
+
+const struct adc_ops adc_mcp3201_ops = {"mcp3201", 1, 0, adc_mcp3201_convert};
+const struct adc_ops adc_mcp3204_ops = {"mcp3204", 4, 1, adc_mcp320x_convert};
+const struct adc_ops adc_mcp3208_ops = {"mcp3208", 8, 1, adc_mcp320x_convert};
+
+/**
+ * Claim the pins for the part called name, return 0 on success
+ */
+int adc_dev_open(struct adc_dev *dev, const char *name) {
+  static const struct adc_ops *const parts[] = {
+      &adc_mcp3201_ops, &adc_mcp3204_ops, &adc_mcp3208_ops};
+  memset(dev, 0, sizeof(*dev));
+  for (size_t i = 0; i < sizeof(parts) / sizeof(*parts); i++)
+    if (!strcmp(parts[i]->name, name)) dev->ops = parts[i];
+  if (!dev->ops) return -1;
+
+  dev->clk = mraa_gpio_init(UP_HAT_MCP3201_CLK);
+  dev->dout = mraa_gpio_init(UP_HAT_MCP3201_DOUT);
+  dev->cs = mraa_gpio_init(UP_HAT_MCP3201_CS);
+  if (dev->ops->needs_din) dev->din = mraa_gpio_init(UP_HAT_MCP320X_DIN);
+  // 1 us per phase keeps f_CLK well below the 0.8 MHz limit at 2.7 V
+  dev->half_clock_ns = 1000;
+  if (!(dev->clk && dev->dout && dev->cs) ||
+      (dev->ops->needs_din && !dev->din))
+    return -1;
+
+  mraa_gpio_dir(dev->clk, MRAA_GPIO_OUT);
+  mraa_gpio_dir(dev->dout, MRAA_GPIO_IN);
+  mraa_gpio_dir(dev->cs, MRAA_GPIO_OUT);
+  mraa_gpio_write(dev->clk, 1);
+  mraa_gpio_write(dev->cs, 1);
+  if (dev->din) mraa_gpio_dir(dev->din, MRAA_GPIO_OUT);
+  dev->t_open = monotonic_raw_ns();
+  return 0;
+}
+
+void adc_dev_close(struct adc_dev *dev) {
+  if (dev->din) mraa_gpio_close(dev->din);
+  mraa_gpio_close(dev->dout);
+  mraa_gpio_close(dev->cs);
+  mraa_gpio_close(dev->clk);
+}
+
+/**
+ * Convert channels ch[0..n) back to back
+ *
+ * code[i] / t_ns[i] receive the result and CS falling edge of ch[i]. Return
+ * 0, or -1 if a channel does not exist on this part (nothing is converted).
+ */
+int adc_dev_scan(struct adc_dev *dev, const uint8_t *ch, int n, uint16_t *code,
+                 uint64_t *t_ns) {
+  for (int i = 0; i < n; i++)
+    if (ch[i] >= dev->ops->channels) return -1;
+
+  uint16_t (*convert)(struct adc_dev *, int, uint64_t *) = dev->ops->convert;
+  for (int i = 0; i < n; i++) {
+    code[i] = convert(dev, ch[i], &t_ns[i]);
+    // CS stays high for t_CSH (>= 500 ns) before the next frame; the time
+    // stamp of the next frame marks the end of this one
+    delay_spin_ns(dev->half_clock_ns);
+  }
+  uint64_t t_end = monotonic_raw_ns();
+  for (int i = 0; i < n; i++) {
+    dev->conversions[ch[i]]++;
+    dev->busy_ns[ch[i]] += (i + 1 < n ? t_ns[i + 1] : t_end) - t_ns[i];
+  }
+  dev->scans++;
+  return 0;
+}
+
+/**
+ * Scans per second since adc_dev_open()
+ */
+double adc_dev_scan_rate(const struct adc_dev *dev) {
+  uint64_t dt = monotonic_raw_ns() - dev->t_open;
+  return dt ? dev->scans * 1e9 / dt : 0;
+}
+
+/**
+ * Average time per conversion of channel ch in ns, including t_CSH
+ */
+double adc_dev_channel_ns(const struct adc_dev *dev, int ch) {
+  return dev->conversions[ch] ? (double)dev->busy_ns[ch] / dev->conversions[ch]
+                              : 0;
+}
+
+/** A scan list with one adc_ring per scanned channel */
+struct adc_scanner {
+  struct adc_dev *dev;
+  int n;
+  uint8_t ch[ADC_MAX_CHANNELS];
+  struct adc_ring ring[ADC_MAX_CHANNELS];  // ring[i] holds channel ch[i]
+};
+
+/**
+ * Return 0 on success, -1 on a bad channel list or allocation failure
+ */
+int adc_scanner_init(struct adc_scanner *s, struct adc_dev *dev,
+                     const uint8_t *ch, int n, uint64_t capacity) {
+  if (n < 1 || n > ADC_MAX_CHANNELS) return -1;
+  s->dev = dev;
+  s->n = n;
+  for (int i = 0; i < n; i++) {
+    if (ch[i] >= dev->ops->channels) return -1;
+    s->ch[i] = ch[i];
+    if (adc_ring_init(&s->ring[i], capacity)) return -1;
+  }
+  return 0;
+}
+
+/**
+ * Run one scan and push every result into its channel ring
+ */
+void adc_scanner_step(struct adc_scanner *s) {
+  uint16_t code[ADC_MAX_CHANNELS];
+  uint64_t t_ns[ADC_MAX_CHANNELS];
+  adc_dev_scan(s->dev, s->ch, s->n, code, t_ns);
+  for (int i = 0; i < s->n; i++) adc_ring_push(&s->ring[i], code[i], t_ns[i]);
+}
+
+void adc_scanner_free(struct adc_scanner *s) {
+  for (int i = 0; i < s->n; i++) adc_ring_free(&s->ring[i]);
+}
+
+#endif
@@ -0,0 +1,292 @@
+/**
+ * @file
+ * Block filters for raw MCP3201 samples
+ *
+ * Every filter consumes a block of int16_t codes and keeps whatever history it
+ * needs between blocks, so a stream can be cut into blocks of any size up to
+ * the max_block given at init. Scratch memory is allocated once at init; the
+ * process functions never allocate.
+ *
+ * The element-wise loops (differences, compare-exchange, min/max, sums) are
+ * written over plain contiguous arrays without branches so that gcc -O2/-O3
+ * turns them into SIMD code. Only the true recurrences (running sum, IIR,
+ * CIC integrators) stay scalar.
+ *
+ *   moving average : mean of the last `window` samples
+ *   IIR            : y += (x - y) / 2^shift
+ *   median         : median of the last `taps` samples (odd taps)
+ *   CIC            : order-N cascaded integrator-comb, decimation by rate
+ *   stats          : min, max, mean and RMS per block and running
+ */
+
+#ifndef ADC_FILTER_H
+#define ADC_FILTER_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADC_CIC_MAX_ORDER 5
+
+struct adc_movavg {
+  int window;
+  int32_t sum;        // sum of the last `window` samples
+  int32_t recip_q16;  // 65536 / window
+  int16_t *ext;       // last `window` samples followed by the current block
+  int32_t *diff;      // ext[i + window] - ext[i]
+};
+
+struct adc_iir {
+  int shift;  // alpha = 1 / 2^shift
+  int primed;
+  int32_t y_q16;
+};
+
+struct adc_median {
+  int taps;
+  int16_t *ext;    // last taps - 1 samples followed by the current block
+  int16_t *lanes;  // taps rows of max_block: row j holds ext[i + j]
+  size_t max_block;
+};
+
+struct adc_cic {
+  int rate, order;
+  int phase;  // input samples since the last output
+  int gain_shift;  // log2(rate^order) when rate is a power of two, else -1
+  int32_t gain;
+  uint32_t integ[ADC_CIC_MAX_ORDER];
+  uint32_t comb[ADC_CIC_MAX_ORDER];  // previous input of each comb
+  uint32_t *acc;  // integrator output for the current block
+};
+
+struct adc_stats {
+  uint64_t count;
+  int16_t min, max;
+  int64_t sum;
+  uint64_t sumsq;
+};
+
+/* ------------------------------------------------------------------------ */
+
+int adc_movavg_init(struct adc_movavg *f, int window, size_t max_block) {
+  f->window = window;
+  f->sum = 0;
+  f->recip_q16 = (65536 + window / 2) / window;
+  f->ext = calloc(window + max_block, sizeof(*f->ext));
+  f->diff = malloc(max_block * sizeof(*f->diff));
+  return window > 0 && f->ext && f->diff ? 0 : -1;
+}
+
+void adc_movavg_free(struct adc_movavg *f) {
+  free(f->ext);
+  free(f->diff);
+}
+
+void adc_movavg_process(struct adc_movavg *f, const int16_t *in, int16_t *out,
+                        size_t n) {
+  const int w = f->window;
+  int16_t *ext = f->ext;
+  int32_t *diff = f->diff;
+  memcpy(ext + w, in, n * sizeof(*in));
+  for (size_t i = 0; i < n; i++) diff[i] = ext[i + w] - ext[i];
+
+  int32_t sum = f->sum;
+  for (size_t i = 0; i < n; i++) {
+    sum += diff[i];
+    out[i] = ((int64_t)sum * f->recip_q16) >> 16;
+  }
+  f->sum = sum;
+  memmove(ext, ext + n, w * sizeof(*ext));
+}
+
+/* ------------------------------------------------------------------------ */
+
+void adc_iir_init(struct adc_iir *f, int shift) {
+  f->shift = shift;
+  f->primed = 0;
+  f->y_q16 = 0;
+}
+
+void adc_iir_process(struct adc_iir *f, const int16_t *in, int16_t *out,
+                     size_t n) {
+  if (n && !f->primed) {  // start from the first sample instead of 0
+    f->y_q16 = (int32_t)in[0] << 16;
+    f->primed = 1;
+  }
+  int32_t y = f->y_q16;
+  const int shift = f->shift;
+  for (size_t i = 0; i < n; i++) {
+    y += (((int32_t)in[i] << 16) - y) >> shift;
+    out[i] = y >> 16;
+  }
+  f->y_q16 = y;
+}
+
+/* ------------------------------------------------------------------------ */
+
+int adc_median_init(struct adc_median *f, int taps, size_t max_block) {
+  f->taps = taps;
+  f->max_block = max_block;
+  f->ext = calloc(taps - 1 + max_block, sizeof(*f->ext));
+  f->lanes = malloc((size_t)taps * max_block * sizeof(*f->lanes));
+  return taps > 0 && (taps & 1) && f->ext && f->lanes ? 0 : -1;
+}
+
+void adc_median_free(struct adc_median *f) {
+  free(f->ext);
+  free(f->lanes);
+}
+
+/**
+ * Sliding median by an odd-even transposition network
+ *
+ * The network is applied to all n windows at once: each compare-exchange is
+ * a min/max over two whole rows, which vectorises instead of sorting one
+ * window at a time with data-dependent branches.
+ */
+void adc_median_process(struct adc_median *f, const int16_t *in, int16_t *out,
+                        size_t n) {
+  const int taps = f->taps;
+  const size_t stride = f->max_block;
+  int16_t *ext = f->ext;
+  memcpy(ext + taps - 1, in, n * sizeof(*in));
+
+  for (int j = 0; j < taps; j++)
+    memcpy(f->lanes + j * stride, ext + j, n * sizeof(*ext));
+
+  for (int pass = 0; pass < taps; pass++) {
+    for (int j = pass & 1; j + 1 < taps; j += 2) {
+      int16_t *restrict a = f->lanes + j * stride;
+      int16_t *restrict b = f->lanes + (j + 1) * stride;
+      for (size_t i = 0; i < n; i++) {
+        int16_t lo = a[i] < b[i] ? a[i] : b[i];
+        int16_t hi = a[i] < b[i] ? b[i] : a[i];
+        a[i] = lo;
+        b[i] = hi;
+      }
+    }
+  }
+  memcpy(out, f->lanes + (taps / 2) * stride, n * sizeof(*out));
+  memmove(ext, ext + n, (taps - 1) * sizeof(*ext));
+}
+
+/* ------------------------------------------------------------------------ */
+
+/**
+ * Set up a CIC decimator, return 0 on success
+ *
+ * The integrators wrap modulo 2^32, which is harmless as long as the gain
+ * rate^order times the 12-bit input still fits in 31 bits (rate^order <= 2^19).
+ */
+int adc_cic_init(struct adc_cic *f, int rate, int order, size_t max_block) {
+  memset(f, 0, sizeof(*f));
+  f->rate = rate;
+  f->order = order;
+  if (rate < 1 || order < 1 || order > ADC_CIC_MAX_ORDER) return -1;
+
+  int64_t gain = 1;
+  for (int k = 0; k < order; k++) gain *= rate;
+  if (gain > (1 << 19)) return -1;
+  f->gain = gain;
+  f->gain_shift = (rate & (rate - 1)) ? -1 : __builtin_ctzll(gain);
+
+  f->acc = malloc(max_block * sizeof(*f->acc));
+  return f->acc ? 0 : -1;
+}
+
+void adc_cic_free(struct adc_cic *f) { free(f->acc); }
+
+/**
+ * Filter n input samples, write one output per `rate` inputs
+ *
+ * Return the number of outputs written (at most n / rate + 1).
+ */
+size_t adc_cic_process(struct adc_cic *f, const int16_t *in, int16_t *out,
+                       size_t n) {
+  uint32_t *acc = f->acc;
+  for (size_t i = 0; i < n; i++) acc[i] = (uint32_t)in[i];
+
+  // integrators run at the input rate, one stage over the whole block at a time
+  for (int k = 0; k < f->order; k++) {
+    uint32_t s = f->integ[k];
+    for (size_t i = 0; i < n; i++) acc[i] = s += acc[i];
+    f->integ[k] = s;
+  }
+
+  // decimate, then the combs run at the output rate
+  size_t produced = 0;
+  for (size_t i = f->rate - 1 - f->phase; i < n; i += f->rate) {
+    uint32_t v = acc[i];
+    for (int k = 0; k < f->order; k++) {
+      uint32_t prev = f->comb[k];
+      f->comb[k] = v;
+      v -= prev;
+    }
+    int32_t y = (int32_t)v;
+    out[produced++] = f->gain_shift >= 0 ? y >> f->gain_shift : y / f->gain;
+  }
+  f->phase = (f->phase + n) % f->rate;
+  return produced;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void adc_stats_reset(struct adc_stats *st) {
+  st->count = 0;
+  st->min = INT16_MAX;
+  st->max = INT16_MIN;
+  st->sum = 0;
+  st->sumsq = 0;
+}
+
+/**
+ * Statistics of one block of 12-bit codes
+ *
+ * Squares are summed in 32 bits over chunks of 256 (4095^2 * 256 < 2^32) so
+ * the inner loop vectorises, then folded into 64 bits.
+ */
+void adc_stats_block(struct adc_stats *st, const int16_t *in, size_t n) {
+  int16_t lo = INT16_MAX, hi = INT16_MIN;
+  int64_t sum = 0;
+  uint64_t sumsq = 0;
+  for (size_t base = 0; base < n; base += 256) {
+    size_t end = n - base < 256 ? n : base + 256;
+    int32_t s = 0;
+    uint32_t sq = 0;
+    for (size_t i = base; i < end; i++) {
+      lo = in[i] < lo ? in[i] : lo;
+      hi = in[i] > hi ? in[i] : hi;
+      s += in[i];
+      sq += (uint32_t)(in[i] * in[i]);
+    }
+    sum += s;
+    sumsq += sq;
+  }
+  st->count = n;
+  st->min = lo;
+  st->max = hi;
+  st->sum = sum;
+  st->sumsq = sumsq;
+}
+
+/**
+ * Fold the statistics of one block into running totals
+ */
+void adc_stats_merge(struct adc_stats *total, const struct adc_stats *block) {
+  total->count += block->count;
+  if (block->min < total->min) total->min = block->min;
+  if (block->max > total->max) total->max = block->max;
+  total->sum += block->sum;
+  total->sumsq += block->sumsq;
+}
+
+double adc_stats_mean(const struct adc_stats *st) {
+  return st->count ? (double)st->sum / st->count : 0;
+}
+
+double adc_stats_rms(const struct adc_stats *st) {
+  return st->count ? sqrt((double)st->sumsq / st->count) : 0;
+}
+
+#endif
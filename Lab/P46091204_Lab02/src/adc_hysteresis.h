@@ -0,0 +1,88 @@
+/**
+ * @file
+ * Multi-level quantiser with hysteresis
+ *
+ * The band edges come from the level table of an adc_lut. Around every edge
+ * a dead band of +/- band codes is added: the level only rises once the code
+ * reaches edge + band and only falls once it drops below edge - band. A
+ * potentiometer resting on an edge therefore produces one level change
+ * instead of one per noisy sample, and a driver that only rewrites its
+ * output on a change event stays quiet.
+ *
+ * changes counts emitted level changes, suppressed counts samples whose raw
+ * level differed from the held level but did not leave the dead band.
+ */
+
+#ifndef ADC_HYSTERESIS_H
+#define ADC_HYSTERESIS_H
+
+#include <stdint.h>
+
+#include "adc_levels.h"
+
+#define ADC_HYST_MAX_LEVELS 32
+
+struct adc_hyst {
+  const struct adc_lut *lut;
+  int nlevels;
+  int level;  // -1 until the first sample
+  uint16_t edge[ADC_HYST_MAX_LEVELS];  // first code of level k + 1
+  uint16_t up[ADC_HYST_MAX_LEVELS];    // code that lifts level k to k + 1
+  uint16_t down[ADC_HYST_MAX_LEVELS];  // codes below this drop k + 1 to k
+  uint64_t changes, suppressed;
+};
+
+/**
+ * Set the dead band around one edge (edge k separates level k and k + 1)
+ */
+void adc_hyst_set_band(struct adc_hyst *h, int k, uint16_t band) {
+  int up = h->edge[k] + band, down = h->edge[k] - band;
+  h->up[k] = up < ADC_CODES ? up : ADC_CODES - 1;
+  h->down[k] = down > 0 ? down : 0;
+}
+
+/**
+ * Derive the edges from lut->level, with the same dead band on every edge
+ *
+ * Return 0 on success, -1 when the table has too many levels.
+ */
+int adc_hyst_init(struct adc_hyst *h, const struct adc_lut *lut, uint16_t band) {
+  h->lut = lut;
+  h->level = -1;
+  h->changes = h->suppressed = 0;
+  h->nlevels = lut->level[ADC_CODES - 1] + 1;
+  if (h->nlevels > ADC_HYST_MAX_LEVELS) return -1;
+
+  int k = 0;
+  for (int code = 1; code < ADC_CODES; code++) {
+    while (k < lut->level[code]) h->edge[k++] = code;
+  }
+  for (k = 0; k < h->nlevels - 1; k++) adc_hyst_set_band(h, k, band);
+  return 0;
+}
+
+/**
+ * Feed one raw code, return 1 when the held level changed
+ */
+int adc_hyst_update(struct adc_hyst *h, uint16_t code) {
+  int raw = h->lut->level[code];
+  if (raw == h->level) return 0;
+  if (h->level < 0) {  // first sample: take it as is
+    h->level = raw;
+    h->changes++;
+    return 1;
+  }
+
+  int level = h->level;
+  while (level < h->nlevels - 1 && code >= h->up[level]) level++;
+  while (level > 0 && code < h->down[level - 1]) level--;
+  if (level == h->level) {
+    h->suppressed++;
+    return 0;
+  }
+  h->level = level;
+  h->changes++;
+  return 1;
+}
+
+#endif
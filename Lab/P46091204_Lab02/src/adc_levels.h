@@ -0,0 +1,116 @@
+/**
+ * @file
+ * Table-driven ADC conversion
+ *
+ * All conversions of a 12-bit MCP3201 code are precomputed once at startup,
+ * so the per-sample path is an array lookup with no floating point and no
+ * branches:
+ *   lut.mv[code]      calibrated input voltage in millivolts
+ *   lut.duty_ns[code] PWM high time for the given PWM period
+ *   lut.level[code]   display level, i.e. how many thresholds are reached
+ *
+ * The calibration curve is piecewise linear through (code, mV) points
+ * measured on a particular board; without one the ideal VREF * code / 4096
+ * transfer function is used. A calibration file holds one "code mV" pair per
+ * line, '#' starts a comment.
+ */
+
+#ifndef ADC_LEVELS_H
+#define ADC_LEVELS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mcp3201.h"
+
+#define ADC_CODES (1 << ADC_RESOLUTION)
+#define ADC_CALIB_MAX 16
+#define ADC_CALIB_FILE "adc_calib.txt"
+
+struct adc_calib {
+  int npoints;
+  uint16_t code[ADC_CALIB_MAX];  // strictly increasing
+  uint16_t mv[ADC_CALIB_MAX];
+  uint16_t full_scale_mv;  // input that counts as 100% for PWM and levels
+};
+
+struct adc_lut {
+  uint16_t mv[ADC_CODES];
+  uint32_t duty_ns[ADC_CODES];
+  uint8_t level[ADC_CODES];
+};
+
+/**
+ * Ideal transfer function: code 0 is 0 V, code 4096 would be VREF
+ */
+void adc_calib_ideal(struct adc_calib *cal) {
+  cal->npoints = 2;
+  cal->code[0] = 0;
+  cal->mv[0] = 0;
+  cal->code[1] = ADC_CODES;
+  cal->mv[1] = VREF * 1000 + 0.5f;
+  cal->full_scale_mv = cal->mv[1];
+}
+
+/**
+ * Load calibration points from path, return 0 on success
+ *
+ * Leaves the ideal curve in cal when the file is missing or malformed.
+ */
+int adc_calib_load(struct adc_calib *cal, const char *path) {
+  adc_calib_ideal(cal);
+  FILE *f = fopen(path, "r");
+  if (!f) return -1;
+
+  struct adc_calib c = *cal;
+  c.npoints = 0;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned code, mv;
+    if (line[0] == '#' || sscanf(line, "%u %u", &code, &mv) != 2) continue;
+    if (c.npoints == ADC_CALIB_MAX || code > ADC_CODES ||
+        (c.npoints && code <= c.code[c.npoints - 1])) {
+      fclose(f);
+      return -1;
+    }
+    c.code[c.npoints] = code;
+    c.mv[c.npoints] = mv;
+    c.npoints++;
+  }
+  fclose(f);
+  if (c.npoints < 2) return -1;
+  *cal = c;
+  return 0;
+}
+
+/**
+ * Fill the lookup tables
+ *
+ * thresholds_permille: ascending band edges in per mille of full scale;
+ * level[code] is the number of edges at or below the calibrated input.
+ */
+void adc_lut_build(struct adc_lut *lut, const struct adc_calib *cal,
+                   uint32_t pwm_period_ns, const uint16_t *thresholds_permille,
+                   int nthresholds) {
+  int seg = 0;
+  for (int code = 0; code < ADC_CODES; code++) {
+    // piecewise linear, the outer segments extrapolate
+    while (seg < cal->npoints - 2 && code >= cal->code[seg + 1]) seg++;
+    int32_t c0 = cal->code[seg], c1 = cal->code[seg + 1];
+    int32_t m0 = cal->mv[seg], m1 = cal->mv[seg + 1];
+    int32_t mv = m0 + ((m1 - m0) * (code - c0) + (c1 - c0) / 2) / (c1 - c0);
+    if (mv < 0) mv = 0;
+    if (mv > cal->full_scale_mv) mv = cal->full_scale_mv;
+    lut->mv[code] = mv;
+
+    lut->duty_ns[code] = (uint64_t)pwm_period_ns * mv / cal->full_scale_mv;
+
+    uint32_t permille = mv * 1000 / cal->full_scale_mv;
+    int level = 0;
+    while (level < nthresholds && permille >= thresholds_permille[level])
+      level++;
+    lut->level[code] = level;
+  }
+}
+
+#endif
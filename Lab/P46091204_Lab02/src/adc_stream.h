@@ -0,0 +1,264 @@
+/**
+ * @file
+ * Streaming ADC acquisition
+ *
+ * An acquisition thread reads the ADC back-to-back (or on an absolute-deadline
+ * schedule at a target rate) into a preallocated ring of raw codes and
+ * timestamps. The read callback stamps each sample itself (for the MCP3201:
+ * CLOCK_MONOTONIC_RAW at the CS falling edge). Consumers own an adc_reader
+ * each and pull batches at their own pace; the producer never waits for
+ * them. A reader that falls more than a ring behind skips ahead and counts
+ * the lost samples as overruns.
+ */
+
+#ifndef ADC_STREAM_H
+#define ADC_STREAM_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+/** Single-producer ring of samples, capacity is a power of two */
+struct adc_ring {
+  uint16_t *code;
+  uint64_t *t_ns;
+  uint64_t mask;
+  _Atomic uint64_t head;  // number of samples ever written
+};
+
+/** Per-consumer cursor into an adc_ring */
+struct adc_reader {
+  struct adc_ring *ring;
+  uint64_t tail;      // next sample to read
+  uint64_t overruns;  // samples overwritten before they were read
+};
+
+/** Producer statistics, read them with adc_stream_get_stats() */
+struct adc_stream_stats {
+  uint64_t samples;
+  uint64_t late;  // deadlines missed because a read took longer than a period
+  uint64_t t_first, t_last;
+  uint64_t dt_min, dt_max;  // inter-sample interval extremes
+  double dt_mean, dt_m2;    // running mean / sum of squares (Welford)
+};
+
+struct adc_stream {
+  struct adc_ring ring;
+  uint16_t (*read)(void *ctx, uint64_t *t_ns);  // one stamped conversion
+  void *ctx;
+  uint64_t period_ns;  // 0 means back-to-back
+  pthread_t thread;
+  atomic_int running;
+  pthread_mutex_t lock;  // guards stats
+  struct adc_stream_stats stats;
+};
+
+/**
+ * Allocate a ring holding at least capacity samples, return 0 on success
+ */
+int adc_ring_init(struct adc_ring *ring, uint64_t capacity) {
+  uint64_t size = 1;
+  while (size < capacity) size <<= 1;
+  ring->code = malloc(size * sizeof(*ring->code));
+  ring->t_ns = malloc(size * sizeof(*ring->t_ns));
+  if (!ring->code || !ring->t_ns) {
+    free(ring->code);
+    free(ring->t_ns);
+    ring->code = NULL;
+    ring->t_ns = NULL;
+    return -1;
+  }
+  ring->mask = size - 1;
+  atomic_init(&ring->head, 0);
+  return 0;
+}
+
+void adc_ring_free(struct adc_ring *ring) {
+  free(ring->code);
+  free(ring->t_ns);
+}
+
+/**
+ * Append one sample (producer side only)
+ */
+void adc_ring_push(struct adc_ring *ring, uint16_t code, uint64_t t_ns) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  ring->code[head & ring->mask] = code;
+  ring->t_ns[head & ring->mask] = t_ns;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Start reading at the current head, i.e. only samples written from now on
+ */
+void adc_reader_init(struct adc_reader *reader, struct adc_ring *ring) {
+  reader->ring = ring;
+  reader->tail = atomic_load_explicit(&ring->head, memory_order_acquire);
+  reader->overruns = 0;
+}
+
+/**
+ * Copy up to max pending samples into code / t_ns (t_ns may be NULL)
+ *
+ * Return the number of samples copied. Samples that the producer overwrote
+ * before or during the copy are dropped and added to reader->overruns.
+ */
+size_t adc_reader_read(struct adc_reader *reader, uint16_t *code,
+                       uint64_t *t_ns, size_t max) {
+  struct adc_ring *ring = reader->ring;
+  uint64_t size = ring->mask + 1;
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  // the slot at head is the one being written next: at most size - 1
+  // samples are safe to read
+  if (head - reader->tail >= size) {
+    reader->overruns += head - reader->tail - size + 1;
+    reader->tail = head - size + 1;
+  }
+  size_t n = head - reader->tail;
+  if (n > max) n = max;
+  if (n == 0) return 0;
+
+  // copy in at most two contiguous runs
+  uint64_t start = reader->tail & ring->mask;
+  size_t first = n < size - start ? n : size - start;
+  memcpy(code, ring->code + start, first * sizeof(*code));
+  memcpy(code + first, ring->code, (n - first) * sizeof(*code));
+  if (t_ns) {
+    memcpy(t_ns, ring->t_ns + start, first * sizeof(*t_ns));
+    memcpy(t_ns + first, ring->t_ns, (n - first) * sizeof(*t_ns));
+  }
+
+  // anything older than head2 - size + 1 may have been torn while copying,
+  // the slot of head2 included: the writer fills it before publishing
+  atomic_thread_fence(memory_order_acquire);
+  uint64_t head2 = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t lost = 0;
+  if (head2 - reader->tail >= size) lost = head2 - reader->tail - size + 1;
+  if (lost > n) lost = n;
+  if (lost) {
+    memmove(code, code + lost, (n - lost) * sizeof(*code));
+    if (t_ns) memmove(t_ns, t_ns + lost, (n - lost) * sizeof(*t_ns));
+    reader->overruns += lost;
+  }
+  reader->tail += n;
+  return n - lost;
+}
+
+/**
+ * Fold one interval into the statistics (called with lock held)
+ */
+void adc_stream_account(struct adc_stream_stats *st, uint64_t t_ns) {
+  if (st->samples++ == 0) {
+    st->t_first = st->t_last = t_ns;
+    return;
+  }
+  uint64_t dt = t_ns - st->t_last;
+  st->t_last = t_ns;
+  uint64_t n = st->samples - 1;  // number of intervals
+  if (n == 1 || dt < st->dt_min) st->dt_min = dt;
+  if (dt > st->dt_max) st->dt_max = dt;
+  double delta = dt - st->dt_mean;
+  st->dt_mean += delta / n;
+  st->dt_m2 += delta * (dt - st->dt_mean);
+}
+
+void *adc_stream_thread(void *arg) {
+  struct adc_stream *s = arg;
+  uint64_t deadline = monotonic_ns();
+
+  while (atomic_load_explicit(&s->running, memory_order_relaxed)) {
+    if (s->period_ns) {
+      deadline += s->period_ns;
+      uint64_t now = monotonic_ns();
+      if (now > deadline + s->period_ns) {
+        // a read overran a whole period: resynchronise instead of bursting
+        pthread_mutex_lock(&s->lock);
+        s->stats.late += (now - deadline) / s->period_ns;
+        pthread_mutex_unlock(&s->lock);
+        deadline = now;
+      }
+      struct timespec ts = {.tv_sec = deadline / 1000000000,
+                            .tv_nsec = deadline % 1000000000};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+      }
+    }
+    uint64_t t;
+    uint16_t code = s->read(s->ctx, &t);
+    adc_ring_push(&s->ring, code, t);
+
+    pthread_mutex_lock(&s->lock);
+    adc_stream_account(&s->stats, t);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+/**
+ * Allocate the ring and start acquiring at rate_hz (0: as fast as possible)
+ *
+ * Return 0 on success.
+ */
+int adc_stream_start(struct adc_stream *s,
+                     uint16_t (*read)(void *ctx, uint64_t *t_ns), void *ctx,
+                     double rate_hz, uint64_t capacity) {
+  memset(&s->stats, 0, sizeof(s->stats));
+  s->read = read;
+  s->ctx = ctx;
+  s->period_ns = rate_hz > 0 ? 1e9 / rate_hz : 0;
+  if (adc_ring_init(&s->ring, capacity)) return -1;
+  pthread_mutex_init(&s->lock, NULL);
+  atomic_init(&s->running, 1);
+  if (pthread_create(&s->thread, NULL, adc_stream_thread, s)) {
+    pthread_mutex_destroy(&s->lock);
+    adc_ring_free(&s->ring);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Stop the acquisition thread, the ring and statistics stay readable
+ */
+void adc_stream_stop(struct adc_stream *s) {
+  atomic_store(&s->running, 0);
+  pthread_join(s->thread, NULL);
+}
+
+void adc_stream_free(struct adc_stream *s) {
+  pthread_mutex_destroy(&s->lock);
+  adc_ring_free(&s->ring);
+}
+
+struct adc_stream_stats adc_stream_get_stats(struct adc_stream *s) {
+  pthread_mutex_lock(&s->lock);
+  struct adc_stream_stats st = s->stats;
+  pthread_mutex_unlock(&s->lock);
+  return st;
+}
+
+/**
+ * Print achieved rate, missed deadlines and inter-sample jitter
+ */
+void adc_stream_print_stats(FILE *out, struct adc_stream *s,
+                            uint64_t overruns) {
+  struct adc_stream_stats st = adc_stream_get_stats(s);
+  double span = (st.t_last - st.t_first) / 1e9;
+  double rate = st.samples > 1 && span > 0 ? (st.samples - 1) / span : 0;
+  double jitter = st.samples > 2 ? sqrt(st.dt_m2 / (st.samples - 2)) : 0;
+  fprintf(out,
+          "samples %llu  rate %.1f Hz  late %llu  overruns %llu  "
+          "dt min/mean/max %.1f/%.1f/%.1f us  jitter %.2f us\n",
+          (unsigned long long)st.samples, rate, (unsigned long long)st.late,
+          (unsigned long long)overruns, st.dt_min / 1e3, st.dt_mean / 1e3,
+          st.dt_max / 1e3, jitter / 1e3);
+}
+
+#endif
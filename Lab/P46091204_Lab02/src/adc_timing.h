@@ -0,0 +1,182 @@
+/**
+ * @file
+ * Sample spacing analysis and uniform-grid resampling
+ *
+ * adc_timing collects the intervals between consecutive sample timestamps
+ * into a linear histogram (bin_ns wide, the last bin catches everything
+ * longer) and keeps the effective rate and the worst gap with its position.
+ *
+ * adc_resampler turns irregular (t_ns, code) pairs into samples on the grid
+ * t0 + k * period by linear interpolation between the two neighbouring
+ * samples, so filters that assume a constant rate (moving average, CIC) see
+ * one. Input may arrive in batches of any size; the last sample of a batch
+ * is kept to interpolate across the boundary.
+ */
+
+#ifndef ADC_TIMING_H
+#define ADC_TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ADC_TIMING_BINS 64
+
+struct adc_timing {
+  uint64_t bin_ns;
+  uint64_t bins[ADC_TIMING_BINS];
+  uint64_t samples;
+  uint64_t t_first, t_last;
+  uint64_t dt_min, dt_max;
+  uint64_t worst_at;  // index of the sample that ends the worst gap
+};
+
+/**
+ * Reset, with bins of bin_ns (pick about period / 16 for a fixed rate)
+ */
+void adc_timing_init(struct adc_timing *t, uint64_t bin_ns) {
+  memset(t, 0, sizeof(*t));
+  t->bin_ns = bin_ns ? bin_ns : 1;
+}
+
+void adc_timing_add(struct adc_timing *t, const uint64_t *t_ns, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (t->samples == 0) {
+      t->t_first = t->t_last = t_ns[i];
+      t->samples = 1;
+      continue;
+    }
+    // timestamps of one clock never go back, but a replayed log might
+    uint64_t dt = t_ns[i] > t->t_last ? t_ns[i] - t->t_last : 0;
+    t->t_last = t_ns[i];
+    uint64_t bin = dt / t->bin_ns;
+    t->bins[bin < ADC_TIMING_BINS ? bin : ADC_TIMING_BINS - 1]++;
+    if (t->samples == 1 || dt < t->dt_min) t->dt_min = dt;
+    if (dt > t->dt_max) {
+      t->dt_max = dt;
+      t->worst_at = t->samples;
+    }
+    t->samples++;
+  }
+}
+
+/**
+ * Effective rate over the whole run in Hz
+ */
+double adc_timing_rate(const struct adc_timing *t) {
+  if (t->samples < 2 || t->t_last == t->t_first) return 0;
+  return (t->samples - 1) * 1e9 / (t->t_last - t->t_first);
+}
+
+/**
+ * Interval below which fraction q (0..1) of all intervals fall, in ns
+ *
+ * Resolution is one bin; the overflow bin reports dt_max.
+ */
+uint64_t adc_timing_quantile(const struct adc_timing *t, double q) {
+  uint64_t total = t->samples > 1 ? t->samples - 1 : 0;
+  uint64_t want = q * total, seen = 0;
+  for (int b = 0; b < ADC_TIMING_BINS - 1; b++) {
+    seen += t->bins[b];
+    if (seen > want) return (b + 1) * t->bin_ns;
+  }
+  return t->dt_max;
+}
+
+/**
+ * Print the rate, worst gap and every non-empty bin with a bar
+ */
+void adc_timing_print(FILE *f, const struct adc_timing *t) {
+  uint64_t total = t->samples > 1 ? t->samples - 1 : 0;
+  fprintf(f,
+          "%llu samples over %.3f s, effective rate %.1f Hz\n"
+          "interval min %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us "
+          "(before sample %llu)\n",
+          (unsigned long long)t->samples, (t->t_last - t->t_first) / 1e9,
+          adc_timing_rate(t), t->dt_min / 1e3,
+          adc_timing_quantile(t, 0.5) / 1e3, adc_timing_quantile(t, 0.99) / 1e3,
+          t->dt_max / 1e3, (unsigned long long)t->worst_at);
+  uint64_t peak = 0;
+  for (int b = 0; b < ADC_TIMING_BINS; b++)
+    if (t->bins[b] > peak) peak = t->bins[b];
+  for (int b = 0; b < ADC_TIMING_BINS; b++) {
+    if (!t->bins[b]) continue;
+    if (b == ADC_TIMING_BINS - 1)
+      fprintf(f, "  >= %8.1f us", b * t->bin_ns / 1e3);
+    else
+      fprintf(f, "  %8.1f us", b * t->bin_ns / 1e3);
+    fprintf(f, " %10llu %6.2f%% ", (unsigned long long)t->bins[b],
+            100.0 * t->bins[b] / total);
+    for (uint64_t i = 0; i < t->bins[b] * 40 / peak; i++) fputc('#', f);
+    fputc('\n', f);
+  }
+}
+
+struct adc_resampler {
+  uint64_t period_ns;
+  uint64_t next_ns;  // next grid point
+  uint64_t prev_t;
+  uint16_t prev_code;
+  int primed;
+};
+
+/**
+ * Resample onto t0 + k * period_ns; t0 = 0 starts at the first sample
+ */
+void adc_resampler_init(struct adc_resampler *r, uint64_t period_ns,
+                        uint64_t t0) {
+  r->period_ns = period_ns;
+  r->next_ns = t0;
+  r->primed = 0;
+}
+
+/**
+ * Consume n samples, write up to max grid samples to out
+ *
+ * Return the number written. Grid points before the first sample are
+ * skipped; a grid point is emitted once a sample at or after it arrived, so
+ * out never extrapolates. If max is too small the input is still consumed and
+ * the excess grid points are dropped, so size out for n * input period /
+ * period_ns + 1.
+ */
+size_t adc_resampler_process(struct adc_resampler *r, const uint16_t *code,
+                             const uint64_t *t_ns, size_t n, uint16_t *out,
+                             uint64_t *out_t_ns, size_t max) {
+  size_t m = 0, i = 0;
+  if (!r->primed && n) {
+    r->prev_t = t_ns[0];
+    r->prev_code = code[0];
+    r->primed = 1;
+    if (!r->next_ns)  // t0 = 0: the grid starts at the first sample
+      r->next_ns = r->prev_t;
+    else if (r->next_ns < r->prev_t)  // first grid point at or after it
+      r->next_ns += (r->prev_t - r->next_ns + r->period_ns - 1) /
+                    r->period_ns * r->period_ns;
+    i = 1;
+  }
+  for (; i < n; i++) {
+    uint64_t t1 = t_ns[i];
+    if (t1 <= r->prev_t) continue;  // duplicate stamp, keep the first
+    uint64_t span = t1 - r->prev_t;
+    int32_t d = (int32_t)code[i] - r->prev_code;
+    while (r->next_ns <= t1) {
+      if (m < max) {
+        uint64_t off = r->next_ns - r->prev_t;
+        // round to nearest: off <= span, |d| < 4096, the product fits
+        int64_t num = (int64_t)d * (int64_t)off;
+        int64_t v = r->prev_code +
+                    (num >= 0 ? (num + (int64_t)span / 2) / (int64_t)span
+                              : (num - (int64_t)span / 2) / (int64_t)span);
+        out[m] = v;
+        if (out_t_ns) out_t_ns[m] = r->next_ns;
+        m++;
+      }
+      r->next_ns += r->period_ns;
+    }
+    r->prev_t = t1;
+    r->prev_code = code[i];
+  }
+  return m;
+}
+
+#endif
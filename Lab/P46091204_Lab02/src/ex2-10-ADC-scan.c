@@ -0,0 +1,91 @@
+/**
+ * @file
+ * Scan several ADC channels
+ *
+ * Convert a list of channels back to back on an MCP3201, MCP3204 or MCP3208
+ * (see adc_driver.h for the DIN wiring of the latter two). Every result goes
+ * into the ring of its channel; five times a second the newest voltage of
+ * each channel is printed with the scan rate and the time per conversion.
+ *
+ * Usage: ex2-10-ADC-scan [mcp3201|mcp3204|mcp3208] [channels, e.g. 0,1,3]
+ *
+ * Datasheets:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21298e.pdf
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "adc_stream.h"
+#include "adc_driver.h"
+
+// Reference Voltage
+#define VREF 3.3f
+#define BATCH 1024
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+int main(int argc, char *argv[]) {
+  const char *part = argc > 1 ? argv[1] : "mcp3201";
+  uint8_t ch[ADC_MAX_CHANNELS];
+  int n = 0;
+  if (argc > 2) {
+    for (char *tok = strtok(argv[2], ","); tok && n < ADC_MAX_CHANNELS;
+         tok = strtok(NULL, ","))
+      ch[n++] = atoi(tok);
+  } else {
+    ch[n++] = 0;
+  }
+
+  struct adc_dev adc;
+  if (adc_dev_open(&adc, part)) {
+    fprintf(stderr, "Failed to initalize GPIO for %s. Did you run with sudo?\n",
+            part);
+    return EXIT_FAILURE;
+  }
+  struct adc_scanner scanner;
+  if (adc_scanner_init(&scanner, &adc, ch, n, 1 << 14)) {
+    fprintf(stderr, "%s has channels 0..%d\n", part, adc.ops->channels - 1);
+    return EXIT_FAILURE;
+  }
+  struct adc_reader reader[ADC_MAX_CHANNELS];
+  for (int i = 0; i < n; i++) adc_reader_init(&reader[i], &scanner.ring[i]);
+
+  signal(SIGINT, int_handler);
+
+  static uint16_t code[BATCH];
+  uint16_t latest[ADC_MAX_CHANNELS] = {0};
+  uint64_t next_print = monotonic_ns();
+  while (!stopped) {
+    adc_scanner_step(&scanner);
+    if (monotonic_ns() < next_print) continue;
+    next_print += 200000000;
+
+    for (int i = 0; i < n; i++) {
+      size_t got;
+      while ((got = adc_reader_read(&reader[i], code, NULL, BATCH)) > 0)
+        latest[i] = code[got - 1];
+      printf("ch%u %.3fv  ", ch[i], VREF * latest[i] / 4096);
+    }
+    printf("| %.0f scans/s", adc_dev_scan_rate(&adc));
+    for (int i = 0; i < n; i++)
+      printf("  ch%u %.1fus", ch[i], adc_dev_channel_ns(&adc, ch[i]) / 1e3);
+    printf("\n");
+  }
+
+  /* release resource section */
+  adc_scanner_free(&scanner);
+  adc_dev_close(&adc);
+}
@@ -4,24 +4,39 @@
  * Read the voltage at the potentiometer VR1 measured by the MCP3201 ADC
  *
  * Then set the brightness of LED 5 by the voltage
+ *
+ * With -c the program runs as a control loop instead: sample and PWM update
+ * happen back to back on an absolute-deadline schedule, the sample optionally
+ * goes through an IIR filter and a deadband, the PWM is only written when the
+ * quantised duty changes, and the time from the CS falling edge to the end
+ * of the PWM write is measured for every update.
+ *
+ * Duty cycles go through pwm_out (pwm_sysfs.h): unchanged values are not
+ * written, and max_update_hz coalesces bursts of changes.
+ *
+ * Usage:
+ *   ex2-3-ADC+PWM
+ *   ex2-3-ADC+PWM -c [rate_hz] [iir_shift (0 = off)] [deadband_codes]
+ *                    [max_update_hz (0 = no limit)]
  * 
  * Datasheet:
  * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
  */
 
 #include <signal.h>
+#include <string.h>
 #include <time.h>
 
 #include "mraa.h"
 #include "upboard_hat.h"
 #include "util.h"
+#include "mcp3201.h"
+#include "adc_filter.h"
+#include "adc_levels.h"
+#include "pwm_sysfs.h"
 
-// ADC output resolution in bits
-#define ADC_RESOLUTION 12
-// Reference Voltage
-#define VREF 3.3f
-
-mraa_gpio_context pin_clk, pin_data, pin_cs;
+// PWM period in ns (5000 Hz)
+#define PWM_PERIOD_NS 200000
 
 volatile sig_atomic_t stopped = 0;
 
@@ -30,60 +45,120 @@ void int_handler(int sig) {
   stopped = 1;
 }
 
-int main() {
+/** Sample-to-output latency of the writes issued by control_loop() */
+struct loop_latency {
+  uint64_t samples, writes, late;
+  uint64_t min_ns, max_ns, sum_ns;
+};
+
+void control_loop(struct mcp3201 *adc, struct pwm_out *out,
+                  const struct adc_lut *lut, double rate_hz, int iir_shift,
+                  int deadband) {
+  struct adc_iir iir;
+  adc_iir_init(&iir, iir_shift);
+  struct loop_latency lat = {0};
+  uint64_t period_ns = 1e9 / rate_hz;
+  uint64_t deadline = monotonic_ns();
+  int held = -1;  // code the current output was computed from
+
+  while (!stopped) {
+    deadline += period_ns;
+    uint64_t now = monotonic_ns();
+    if (now > deadline + period_ns) {  // overran a whole period: resync
+      lat.late += (now - deadline) / period_ns;
+      deadline = now;
+    }
+    struct timespec ts = {.tv_sec = deadline / 1000000000,
+                          .tv_nsec = deadline % 1000000000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+    }
+
+    pwm_out_flush(out, monotonic_ns());
+
+    uint64_t t_sample;
+    int16_t code = mcp3201_read_stamped(adc, &t_sample);
+    lat.samples++;
+    if (iir_shift) adc_iir_process(&iir, &code, &code, 1);
+    if (held >= 0 && abs(code - held) <= deadband) continue;
+    held = code;
+
+    if (!pwm_out_set(out, lut->duty_ns[code], monotonic_ns())) continue;
+
+    uint64_t dt = monotonic_raw_ns() - t_sample;
+    if (lat.writes++ == 0 || dt < lat.min_ns) lat.min_ns = dt;
+    if (dt > lat.max_ns) lat.max_ns = dt;
+    lat.sum_ns += dt;
+  }
+
+  printf("%llu samples, %llu periods overrun\n",
+         (unsigned long long)lat.samples, (unsigned long long)lat.late);
+  // coalesced values written later by pwm_out_flush() are not included
+  if (lat.writes)
+    printf("sample-to-output latency over %llu immediate writes: min %.1f us, "
+           "mean %.1f us, max %.1f us\n",
+           (unsigned long long)lat.writes, lat.min_ns / 1e3,
+           (double)lat.sum_ns / lat.writes / 1e3, lat.max_ns / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+  int loop_mode = argc > 1 && !strcmp(argv[1], "-c");
+  double rate_hz = loop_mode && argc > 2 ? atof(argv[2]) : 2000;
+  if (rate_hz <= 0) {
+    fprintf(stderr, "Invalid sample rate\n");
+    return EXIT_FAILURE;
+  }
+
   // pin 32: pwm pin with LED5
   mraa_pwm_context pin_pwm = mraa_pwm_init(UP_HAT_LED5);
   mraa_pwm_period_us(pin_pwm, 200);  // set pwm frequency to 5000hz
   mraa_pwm_enable(pin_pwm, 1);       // enable pwm pin
 
-  float duty_cycle = 1.0f;
+  // code -> duty table, calibrated by adc_calib.txt when present
+  static struct adc_lut lut;
+  struct adc_calib cal;
+  adc_calib_load(&cal, ADC_CALIB_FILE);
+  adc_lut_build(&lut, &cal, PWM_PERIOD_NS, NULL, 0);
+
+  uint32_t duty_ns = PWM_PERIOD_NS;
 
   // This line is used for resource collection. Ignore it.
   signal(SIGINT, int_handler);
 
-  // pin 12(CLK): clock pin
-  pin_clk = mraa_gpio_init(UP_HAT_MCP3201_CLK);
-  // pin 38(DOUT): SPI data pin 
-  pin_data = mraa_gpio_init(UP_HAT_MCP3201_DOUT);
-  // pin 40(CS/SHDN): pin_cs used to initiate communication with the device
-  pin_cs = mraa_gpio_init(UP_HAT_MCP3201_CS);
+  struct mcp3201 adc;
+  if (mcp3201_init(&adc)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
+
+  struct pwm_out out;
+  pwm_out_open(&out, pin_pwm, UP_HAT_LED5_PWMCHIP, UP_HAT_LED5_PWM,
+               loop_mode && argc > 5 ? atof(argv[5]) : 0);
 
-  mraa_gpio_dir(pin_clk, MRAA_GPIO_OUT);
-  mraa_gpio_dir(pin_data, MRAA_GPIO_IN);
-  mraa_gpio_dir(pin_cs, MRAA_GPIO_OUT);
+  if (loop_mode) {
+    control_loop(&adc, &out, &lut, rate_hz,
+                 argc > 3 ? atoi(argv[3]) : 2, argc > 4 ? atoi(argv[4]) : 2);
+  }
 
   while (!stopped) {
-    mraa_gpio_write(pin_cs, 0);  // SPI communication start
-    delay_ns(1000);
-    uint16_t data_ADC = 0;
-    for (int SPICount = 0; SPICount < 15; SPICount++) {
-      mraa_gpio_write(pin_clk, 0);
-      delay_ns(1000);
-      mraa_gpio_write(pin_clk, 1);
-      if (SPICount >= 3) {  // first 3 cycles doesn't matter
-        data_ADC = (data_ADC << 1) + mraa_gpio_read(pin_data);
-      }
-      delay_ns(1000);
-    }
-    mraa_gpio_write(pin_cs, 1);  //SPI communication end
-    float voltage = VREF * data_ADC / (1 << ADC_RESOLUTION);
-    // printf("%fv\n", voltage);
+    uint16_t data_ADC = mcp3201_read(&adc);
+    // printf("%umV\n", lut.mv[data_ADC]);
 
-    // printf("DUTY CYCLE: %f\n", duty_cycle);
+    // printf("DUTY CYCLE: %uns\n", duty_ns);
 
-    mraa_pwm_write(pin_pwm, duty_cycle);  // change LED duty cycle
+    pwm_out_set(&out, duty_ns, monotonic_ns());  // change LED duty cycle
 
-    duty_cycle = voltage / 3.3; 
+    duty_ns = lut.duty_ns[data_ADC];
 
     delay_ms(100);
   }
   
+  pwm_out_print_stats(stdout, &out);
+
   /* release resource section */
+  pwm_out_close(&out);
   mraa_pwm_write(pin_pwm, 0.0);
   mraa_pwm_enable(pin_pwm, 0);
   mraa_pwm_close(pin_pwm);
 
-  mraa_gpio_close(pin_data);
-  mraa_gpio_close(pin_cs);
-  mraa_gpio_close(pin_clk);
+  mcp3201_close(&adc);
 }
@@ -4,7 +4,8 @@
  *
  * Read the voltage at the potentiometer VR1 measured by the MCP3201 ADC
  * 
- * Then set LED by voltage
+ * Then set LED by voltage. The 74HC595 is only rewritten when the level
+ * really crosses a band edge, not every time noise flickers around it.
  *
  * Datasheet:
  * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
@@ -16,16 +17,14 @@
 #include "mraa.h"
 #include "upboard_hat.h"
 #include "util.h"
-
-// ADC output resolution in bits
-#define ADC_RESOLUTION 12
-// Reference Voltage
-#define VREF 3.3f
+#include "mcp3201.h"
+#include "adc_levels.h"
+#include "adc_hysteresis.h"
 
 /** total number of leds (only 3 out of 8 outputs are used) */
 #define LED_COUNT 3
-
-mraa_gpio_context pin_clk, pin_data_ADC, pin_cs;
+/** dead band around each edge in ADC codes (~16 mV) */
+#define HYSTERESIS_CODES 20
 
 volatile sig_atomic_t stopped = 0;
 
@@ -45,12 +44,18 @@ int main() {
   };
   bool led_status[8] = {0};
 
-  // pin 12(CLK): clock pin
-  pin_clk = mraa_gpio_init(UP_HAT_MCP3201_CLK);
-  // pin 38(DOUT): SPI data pin 
-  pin_data_ADC = mraa_gpio_init(UP_HAT_MCP3201_DOUT);
-  // pin 40(CS/SHDN): pin_cs used to initiate communication with the device
-  pin_cs = mraa_gpio_init(UP_HAT_MCP3201_CS);
+  // band edges at 33% and 66% of full scale: level 0, 1 or 2
+  static const uint16_t thresholds[] = {330, 660};
+  // low voltage lights LED4, high voltage LED2
+  static const int level_to_template[] = {2, 1, 0};
+  static struct adc_lut lut;
+  struct adc_calib cal;
+  adc_calib_load(&cal, ADC_CALIB_FILE);
+  adc_lut_build(&lut, &cal, 0, thresholds, 2);
+  struct adc_hyst hyst;
+  adc_hyst_init(&hyst, &lut, HYSTERESIS_CODES);
+
+  struct mcp3201 adc;
 
   // pin 13(DS): serial data pin (input)
   mraa_gpio_context pin_data_LED = mraa_gpio_init(UP_HAT_74HC595_DS);
@@ -59,51 +64,26 @@ int main() {
   // pin 16(SHCP): when positive edge trigger, shift parallel register & load form pin_DS
   mraa_gpio_context pin_sl = mraa_gpio_init(UP_HAT_74HC595_SHCP);
 
-  if (!(pin_data_LED && pin_en && pin_sl)) {
+  if (mcp3201_init(&adc) || !(pin_data_LED && pin_en && pin_sl)) {
     fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
     return EXIT_FAILURE;
   }
 
-  mraa_gpio_dir(pin_clk, MRAA_GPIO_OUT);
-  mraa_gpio_dir(pin_data_ADC, MRAA_GPIO_IN);
-  mraa_gpio_dir(pin_cs, MRAA_GPIO_OUT);
   mraa_gpio_dir(pin_data_LED, MRAA_GPIO_OUT);
   mraa_gpio_dir(pin_en, MRAA_GPIO_OUT);
   mraa_gpio_dir(pin_sl, MRAA_GPIO_OUT);
 
   while (!stopped) {
-    mraa_gpio_write(pin_cs, 0);  // SPI communication start
-    delay_ns(1000);
-    uint16_t data_ADC = 0;
-    for (int SPICount = 0; SPICount < 15; SPICount++) {
-      mraa_gpio_write(pin_clk, 0);
-      delay_ns(1000);
-      mraa_gpio_write(pin_clk, 1);
-      if (SPICount >= 3) {  // first 3 cycles doesn't matter
-        data_ADC = (data_ADC << 1) + mraa_gpio_read(pin_data_ADC);
-      }
-      delay_ns(1000);
-    }
-    mraa_gpio_write(pin_cs, 1);  //SPI communication end
-    float voltage = VREF * data_ADC / (1 << ADC_RESOLUTION);
-    printf("%fv\n", voltage);
-    float percentage = voltage / 3.3;
-    printf("Percentage = %f\n", percentage);
-
-    if (percentage < 0.33){
-        for (int i = 0; i < LED_COUNT; ++i) {  // for each LED
-            led_status[i+1] = led_template[2][i+1]; 
-        }
+    uint16_t data_ADC = mcp3201_read(&adc);
+    if (!adc_hyst_update(&hyst, data_ADC)) {
+      delay_ms(10);
+      continue;
     }
-    else if (percentage > 0.66){
-        for (int i = 0; i < LED_COUNT; ++i) {  // for each LED
-            led_status[i+1] = led_template[0][i+1];     
-        }
-    }
-    else {
-        for (int i = 0; i < LED_COUNT; ++i) {  // for each LED
-            led_status[i+1] = led_template[1][i+1];
-        }
+    printf("%umV -> level %d\n", lut.mv[data_ADC], hyst.level);
+
+    const bool *led_row = led_template[level_to_template[hyst.level]];
+    for (int i = 0; i < LED_COUNT; ++i) {  // for each LED
+      led_status[i+1] = led_row[i+1];
     }
 
     mraa_gpio_write(pin_en, 1);  // unset pin_en to simulate positive edge later
@@ -120,10 +100,12 @@ int main() {
     delay_ms(10);
   }
   
+  printf("level changes: %llu, suppressed transitions: %llu\n",
+         (unsigned long long)hyst.changes,
+         (unsigned long long)hyst.suppressed);
+
   /* release resource section */
-  mraa_gpio_close(pin_data_ADC);
-  mraa_gpio_close(pin_cs);
-  mraa_gpio_close(pin_clk);
+  mcp3201_close(&adc);
 
 /* release resource section */
   mraa_gpio_write(pin_en, 0);
@@ -4,6 +4,9 @@
  *
  * Read the voltage at the potentiometer VR1 measured by the MCP3201 ADC
  *
+ * Then show the level on the LED matrix. The MAX7219 is only rewritten when
+ * the level really crosses a band edge.
+ *
  * Datasheet:
  * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
  */
@@ -14,13 +17,12 @@
 #include "mraa.h"
 #include "upboard_hat.h"
 #include "util.h"
+#include "mcp3201.h"
+#include "adc_levels.h"
+#include "adc_hysteresis.h"
 
-// ADC output resolution in bits
-#define ADC_RESOLUTION 12
-// Reference Voltage
-#define VREF 3.3f
-
-mraa_gpio_context pin_clk_ADC, pin_data, pin_cs;
+/** dead band around each edge in ADC codes (~16 mV) */
+#define HYSTERESIS_CODES 20
 
 volatile sig_atomic_t stopped = 0;
 
@@ -75,87 +77,56 @@ int main() {
   // This line is used for resource collection. Ignore it.
   signal(SIGINT, int_handler);
 
-  // pin 12(CLK): clock pin
-  pin_clk_ADC = mraa_gpio_init(UP_HAT_MCP3201_CLK);
-  // pin 38(DOUT): SPI data pin 
-  pin_data = mraa_gpio_init(UP_HAT_MCP3201_DOUT);
-  // pin 40(CS/SHDN): pin_cs used to initiate communication with the device
-  pin_cs = mraa_gpio_init(UP_HAT_MCP3201_CS);
+  struct mcp3201 adc;
+  if (mcp3201_init(&adc)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
 
   pin_load = mraa_gpio_init(UP_HAT_MAX7219_LOAD);
   pin_din = mraa_gpio_init(UP_HAT_MAX7219_DIN);
   pin_clk_MATRIX = mraa_gpio_init(UP_HAT_MAX7219_CLK);
 
-  mraa_gpio_dir(pin_clk_ADC, MRAA_GPIO_OUT);
-  mraa_gpio_dir(pin_data, MRAA_GPIO_IN);
-  mraa_gpio_dir(pin_cs, MRAA_GPIO_OUT);
-
   mraa_gpio_dir(pin_load, MRAA_GPIO_OUT);
   mraa_gpio_dir(pin_din, MRAA_GPIO_OUT);
 
+  // band edges every 11.1% of full scale: level 0 .. 8
+  static const uint16_t thresholds[] = {111, 222, 333, 444, 555, 666, 777, 888};
+  // the higher the voltage, the fewer columns are lit
+  static const uint8_t level_to_pattern[] = {
+      0xFF, 0xFF >> 1, 0xFF >> 2, 0xFF >> 3, 0xFF >> 4,
+      0xFF >> 5, 0xFF >> 6, 0xFF >> 7, 0x00,
+  };
+  static struct adc_lut lut;
+  struct adc_calib cal;
+  adc_calib_load(&cal, ADC_CALIB_FILE);
+  adc_lut_build(&lut, &cal, 0, thresholds, 8);
+  struct adc_hyst hyst;
+  adc_hyst_init(&hyst, &lut, HYSTERESIS_CODES);
+
   uint8_t row_pattern = 0xFF;
 
   while (!stopped) {
-    mraa_gpio_write(pin_cs, 0);  // SPI communication start
-    delay_ns(1000);
-    uint16_t data_ADC = 0;
-    for (int SPICount = 0; SPICount < 15; SPICount++) {
-      mraa_gpio_write(pin_clk_ADC, 0);
-      delay_ns(1000);
-      mraa_gpio_write(pin_clk_ADC, 1);
-      if (SPICount >= 3) {  // first 3 cycles doesn't matter
-        data_ADC = (data_ADC << 1) + mraa_gpio_read(pin_data);
+    uint16_t data_ADC = mcp3201_read(&adc);
+    if (adc_hyst_update(&hyst, data_ADC)) {
+      printf("%umV -> level %d\n", lut.mv[data_ADC], hyst.level);
+
+      row_pattern = level_to_pattern[hyst.level];
+      // printf("row_pattern = %d\n", row_pattern);
+      for (int i = 1; i <= 8; ++i) {
+         write_reg(i, row_pattern);
       }
-      delay_ns(1000);
-    }
-    mraa_gpio_write(pin_cs, 1);  //SPI communication end
-    float voltage = VREF * data_ADC / (1 << ADC_RESOLUTION);
-    printf("%fv\n", voltage);
-    
-    float percentage = voltage / 3.3;
-    printf("Percentage = %f\n", percentage);
- 
-    if (percentage < 0.111){
-        row_pattern = 0xFF;
-    } 
-    else if (percentage >= 0.888){
-        row_pattern = 0x00;
-    }
-    else{
-        if (percentage >= 0.111 && percentage < 0.222){
-            row_pattern = 0xFF>>1;
-        }
-        else if (percentage >= 0.222 && percentage < 0.333){
-            row_pattern = 0xFF>>2;
-        }
-        else if (percentage >= 0.333 && percentage < 0.444){
-            row_pattern = 0xFF>>3;
-        }
-        else if (percentage >= 0.444 && percentage < 0.555){
-            row_pattern = 0xFF>>4;
-        }
-        else if (percentage >= 0.555 && percentage < 0.666){
-            row_pattern = 0xFF>>5;
-        }
-        else if (percentage >= 0.666 && percentage < 0.777){
-            row_pattern = 0xFF>>6;
-        }
-        else if (percentage >= 0.777 && percentage < 0.888){
-            row_pattern = 0xFF>>7;
-        }
-    }
-    // printf("row_pattern = %d\n", row_pattern);
-    for (int i = 1; i <= 8; ++i) {
-       write_reg(i, row_pattern);
     }
 
     delay_ms(100);
   }
+
+  printf("level changes: %llu, suppressed transitions: %llu\n",
+         (unsigned long long)hyst.changes,
+         (unsigned long long)hyst.suppressed);
   
   /* release resource section */
-  mraa_gpio_close(pin_data);
-  mraa_gpio_close(pin_cs);
-  mraa_gpio_close(pin_clk_ADC);
+  mcp3201_close(&adc);
 
   for (int i = 1; i <= 8; ++i) {
     write_reg(i, 0x00);
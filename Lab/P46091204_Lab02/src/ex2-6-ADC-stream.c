@@ -0,0 +1,120 @@
+/**
+ * @file
+ * Streaming ADC acquisition
+ *
+ * Sample the potentiometer VR1 through the MCP3201 on a dedicated thread at a
+ * target rate and hand the samples to three decoupled consumers that each
+ * read in batches:
+ *   control : mean of each batch sets the brightness of LED5
+ *   log     : raw "timestamp code" lines appended to a file (optional)
+ *   display : latest voltage and acquisition statistics, 5 times a second
+ *
+ * Usage: ex2-6-ADC-stream [rate_hz (0 = back-to-back)] [log_file]
+ *
+ * Datasheet:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "mcp3201.h"
+#include "adc_stream.h"
+
+// samples kept in the ring: 2^16 covers > 6 s at 10 kHz
+#define RING_CAPACITY (1 << 16)
+#define BATCH 4096
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+uint16_t read_adc(void *ctx, uint64_t *t_ns) {
+  return mcp3201_read_stamped(ctx, t_ns);
+}
+
+int main(int argc, char *argv[]) {
+  double rate_hz = argc > 1 ? atof(argv[1]) : 1000;
+  FILE *log_file = NULL;
+  if (argc > 2 && !(log_file = fopen(argv[2], "w"))) {
+    perror(argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  struct mcp3201 adc;
+  if (mcp3201_init(&adc)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
+
+  // pin 32: pwm pin with LED5
+  mraa_pwm_context pin_pwm = mraa_pwm_init(UP_HAT_LED5);
+  mraa_pwm_period_us(pin_pwm, 200);  // set pwm frequency to 5000hz
+  mraa_pwm_enable(pin_pwm, 1);       // enable pwm pin
+
+  signal(SIGINT, int_handler);
+
+  struct adc_stream stream;
+  if (adc_stream_start(&stream, read_adc, &adc, rate_hz, RING_CAPACITY)) {
+    fprintf(stderr, "Failed to start the acquisition thread\n");
+    return EXIT_FAILURE;
+  }
+
+  struct adc_reader control, logger, display;
+  adc_reader_init(&control, &stream.ring);
+  adc_reader_init(&logger, &stream.ring);
+  adc_reader_init(&display, &stream.ring);
+
+  static uint16_t code[BATCH];
+  static uint64_t t_ns[BATCH];
+  uint16_t latest = 0;
+
+  for (int tick = 0; !stopped; tick++) {
+    // control: one PWM update per batch
+    size_t n = adc_reader_read(&control, code, NULL, BATCH);
+    if (n) {
+      uint32_t sum = 0;
+      for (size_t i = 0; i < n; i++) sum += code[i];
+      mraa_pwm_write(pin_pwm, (float)sum / n / (1 << ADC_RESOLUTION));
+    }
+
+    // log: everything, in one buffered write per batch
+    if (log_file) {
+      while ((n = adc_reader_read(&logger, code, t_ns, BATCH)) > 0) {
+        for (size_t i = 0; i < n; i++)
+          fprintf(log_file, "%llu %u\n", (unsigned long long)t_ns[i], code[i]);
+      }
+    }
+
+    // display: only the newest sample matters
+    if (tick % 10 == 0) {
+      while ((n = adc_reader_read(&display, code, NULL, BATCH)) > 0)
+        latest = code[n - 1];
+      printf("%fv  ", VREF * latest / (1 << ADC_RESOLUTION));
+      adc_stream_print_stats(stdout, &stream,
+                             control.overruns + logger.overruns);
+    }
+
+    delay_ms(20);
+  }
+
+  adc_stream_stop(&stream);
+  printf("final: ");
+  adc_stream_print_stats(stdout, &stream, control.overruns + logger.overruns);
+
+  /* release resource section */
+  adc_stream_free(&stream);
+  if (log_file) fclose(log_file);
+  mraa_pwm_write(pin_pwm, 0.0);
+  mraa_pwm_enable(pin_pwm, 0);
+  mraa_pwm_close(pin_pwm);
+  mcp3201_close(&adc);
+}
@@ -0,0 +1,184 @@
+/**
+ * @file
+ * Filter ADC samples
+ *
+ * Clean up the potentiometer reading before it drives anything: samples from
+ * the acquisition thread go through median-of-5 (spikes), a 16-tap moving
+ * average (noise) and a CIC decimator by 16 (rate), and per-block min, max,
+ * mean and RMS are printed.
+ *
+ * Usage:
+ *   ex2-7-ADC-filter [rate_hz]   filter live samples
+ *   ex2-7-ADC-filter -b          benchmark every filter in samples per second
+ *                                on synthetic data (no hardware needed)
+ *
+ * Datasheet:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ */
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "mcp3201.h"
+#include "adc_stream.h"
+#include "adc_filter.h"
+
+#define BLOCK 1024
+#define BENCH_SAMPLES (1 << 22)
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+uint16_t read_adc(void *ctx, uint64_t *t_ns) {
+  return mcp3201_read_stamped(ctx, t_ns);
+}
+
+/**
+ * Print samples per second of one filter run over `total` samples
+ */
+void report(const char *name, uint64_t t0, size_t total) {
+  double s = (monotonic_ns() - t0) / 1e9;
+  printf("%-18s %8.1f Msamples/s\n", name, total / s / 1e6);
+}
+
+int benchmark() {
+  static int16_t in[BENCH_SAMPLES];
+  static int16_t out[BLOCK];
+  // potentiometer at mid scale with noise and occasional spikes
+  srand(1);
+  for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+    int v = 2048 + 600 * sin(i * 0.001) + rand() % 33 - 16;
+    if (rand() % 1000 == 0) v = rand() % 4096;
+    in[i] = v;
+  }
+
+  struct adc_movavg ma;
+  struct adc_iir iir;
+  struct adc_median med3, med7;
+  struct adc_cic cic;
+  struct adc_stats st, total;
+  if (adc_movavg_init(&ma, 16, BLOCK) || adc_median_init(&med3, 3, BLOCK) ||
+      adc_median_init(&med7, 7, BLOCK) || adc_cic_init(&cic, 16, 3, BLOCK)) {
+    fprintf(stderr, "filter init failed\n");
+    return EXIT_FAILURE;
+  }
+  adc_iir_init(&iir, 4);
+
+  uint64_t t0 = monotonic_ns();
+  for (size_t i = 0; i < BENCH_SAMPLES; i += BLOCK)
+    adc_movavg_process(&ma, in + i, out, BLOCK);
+  report("moving average 16", t0, BENCH_SAMPLES);
+
+  t0 = monotonic_ns();
+  for (size_t i = 0; i < BENCH_SAMPLES; i += BLOCK)
+    adc_iir_process(&iir, in + i, out, BLOCK);
+  report("IIR 1/16", t0, BENCH_SAMPLES);
+
+  t0 = monotonic_ns();
+  for (size_t i = 0; i < BENCH_SAMPLES; i += BLOCK)
+    adc_median_process(&med3, in + i, out, BLOCK);
+  report("median 3", t0, BENCH_SAMPLES);
+
+  t0 = monotonic_ns();
+  for (size_t i = 0; i < BENCH_SAMPLES; i += BLOCK)
+    adc_median_process(&med7, in + i, out, BLOCK);
+  report("median 7", t0, BENCH_SAMPLES);
+
+  t0 = monotonic_ns();
+  size_t produced = 0;
+  for (size_t i = 0; i < BENCH_SAMPLES; i += BLOCK)
+    produced += adc_cic_process(&cic, in + i, out, BLOCK);
+  report("CIC 3rd order /16", t0, BENCH_SAMPLES);
+
+  t0 = monotonic_ns();
+  adc_stats_reset(&total);
+  for (size_t i = 0; i < BENCH_SAMPLES; i += BLOCK) {
+    adc_stats_block(&st, in + i, BLOCK);
+    adc_stats_merge(&total, &st);
+  }
+  report("stats", t0, BENCH_SAMPLES);
+
+  printf("CIC outputs %zu, input min %d max %d mean %.1f rms %.1f\n", produced,
+         total.min, total.max, adc_stats_mean(&total), adc_stats_rms(&total));
+
+  adc_movavg_free(&ma);
+  adc_median_free(&med3);
+  adc_median_free(&med7);
+  adc_cic_free(&cic);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && !strcmp(argv[1], "-b")) return benchmark();
+  double rate_hz = argc > 1 ? atof(argv[1]) : 2000;
+
+  struct mcp3201 adc;
+  if (mcp3201_init(&adc)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
+
+  struct adc_median med;
+  struct adc_movavg ma;
+  struct adc_cic cic;
+  if (adc_median_init(&med, 5, BLOCK) || adc_movavg_init(&ma, 16, BLOCK) ||
+      adc_cic_init(&cic, 16, 3, BLOCK)) {
+    fprintf(stderr, "filter init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, int_handler);
+
+  struct adc_stream stream;
+  if (adc_stream_start(&stream, read_adc, &adc, rate_hz, 1 << 14)) {
+    fprintf(stderr, "Failed to start the acquisition thread\n");
+    return EXIT_FAILURE;
+  }
+  struct adc_reader reader;
+  adc_reader_init(&reader, &stream.ring);
+
+  static uint16_t raw[BLOCK];
+  static int16_t a[BLOCK], b[BLOCK], dec[BLOCK];
+  struct adc_stats st, total;
+  adc_stats_reset(&total);
+
+  while (!stopped) {
+    delay_ms(200);
+    size_t n;
+    while ((n = adc_reader_read(&reader, raw, NULL, BLOCK)) > 0) {
+      memcpy(a, raw, n * sizeof(*a));  // codes are 12-bit, int16 is lossless
+      adc_stats_block(&st, a, n);
+      adc_stats_merge(&total, &st);
+      adc_median_process(&med, a, b, n);
+      adc_movavg_process(&ma, b, a, n);
+      size_t m = adc_cic_process(&cic, a, dec, n);
+      printf("block %4zu: min %4d max %4d mean %7.1f rms %7.1f  "
+             "filtered %fv  decimated %zu\n",
+             n, st.min, st.max, adc_stats_mean(&st), adc_stats_rms(&st),
+             VREF * a[n - 1] / (1 << ADC_RESOLUTION), m);
+    }
+  }
+
+  adc_stream_stop(&stream);
+  printf("total: min %d max %d mean %.1f rms %.1f over %llu samples\n",
+         total.min, total.max, adc_stats_mean(&total), adc_stats_rms(&total),
+         (unsigned long long)total.count);
+
+  /* release resource section */
+  adc_stream_free(&stream);
+  adc_median_free(&med);
+  adc_movavg_free(&ma);
+  adc_cic_free(&cic);
+  mcp3201_close(&adc);
+}
@@ -0,0 +1,193 @@
+/**
+ * @file
+ * Record and replay ADC captures
+ *
+ * record: stream MCP3201 samples into a capture file (see adc_capture.h)
+ * replay: feed a capture through the lookup tables of ex2-3 (LED5 duty),
+ *         ex2-4 (which of LED2..LED4) or ex2-5 (matrix row pattern) without
+ *         any hardware, either as fast as possible or at a multiple of the
+ *         recorded speed, and count how often each output would change,
+ *         with and without hysteresis on the band edges
+ *
+ * Usage:
+ *   ex2-8-ADC-capture record <file> [rate_hz] [seconds] [raw|delta]
+ *   ex2-8-ADC-capture replay <file> [pwm|leds|matrix] [speed (0 = max)]
+ *                           [hysteresis_codes]
+ *
+ * Datasheet:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "mcp3201.h"
+#include "adc_stream.h"
+#include "adc_capture.h"
+#include "adc_levels.h"
+#include "adc_hysteresis.h"
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+uint16_t read_adc(void *ctx, uint64_t *t_ns) {
+  return mcp3201_read_stamped(ctx, t_ns);
+}
+
+// band edges of ex2-4 (LED2..LED4) and ex2-5 (matrix), per mille of full scale
+static const uint16_t leds_thresholds[] = {330, 660};
+static const uint16_t matrix_thresholds[] = {111, 222, 333, 444,
+                                             555, 666, 777, 888};
+
+int record(const char *path, double rate_hz, double seconds, int encoding) {
+  struct mcp3201 adc;
+  if (mcp3201_init(&adc)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
+
+  struct adc_capture_writer w;
+  // fsync every 16 blocks: at most 16k samples are lost on power failure
+  if (adc_capture_create(&w, path, VREF, ADC_RESOLUTION, rate_hz, encoding, 16,
+                         monotonic_raw_ns())) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+
+  struct adc_stream stream;
+  if (adc_stream_start(&stream, read_adc, &adc, rate_hz, 1 << 16)) {
+    fprintf(stderr, "Failed to start the acquisition thread\n");
+    return EXIT_FAILURE;
+  }
+  struct adc_reader reader;
+  adc_reader_init(&reader, &stream.ring);
+
+  static uint16_t code[4096];
+  static uint64_t t_ns[4096];
+  uint64_t end = monotonic_ns() + seconds * 1e9;
+  while (!stopped && (seconds <= 0 || monotonic_ns() < end)) {
+    delay_ms(50);
+    size_t n;
+    while ((n = adc_reader_read(&reader, code, t_ns, 4096)) > 0) {
+      if (adc_capture_append(&w, code, t_ns, n)) {
+        perror("write");
+        stopped = 1;
+        break;
+      }
+    }
+  }
+
+  adc_stream_stop(&stream);
+  adc_stream_print_stats(stdout, &stream, reader.overruns);
+  if (adc_capture_close(&w)) perror("close");
+  printf("%llu samples in %llu blocks, %llu bytes (%.2f bytes/sample)\n",
+         (unsigned long long)w.samples, (unsigned long long)w.blocks,
+         (unsigned long long)w.bytes,
+         w.samples ? (double)w.bytes / w.samples : 0);
+
+  adc_stream_free(&stream);
+  mcp3201_close(&adc);
+  return 0;
+}
+
+int replay(const char *path, const char *mode, double speed, int band) {
+  // same tables as the live programs: ex2-3 follows duty_ns, the others level
+  static struct adc_lut lut;
+  struct adc_calib cal;
+  adc_calib_load(&cal, ADC_CALIB_FILE);
+  int use_duty = 0;
+  if (!strcmp(mode, "leds")) {
+    adc_lut_build(&lut, &cal, 200000, leds_thresholds, 2);
+  } else if (!strcmp(mode, "matrix")) {
+    adc_lut_build(&lut, &cal, 200000, matrix_thresholds, 8);
+  } else {
+    adc_lut_build(&lut, &cal, 200000, NULL, 0);
+    use_duty = 1;
+  }
+  struct adc_hyst hyst;
+  adc_hyst_init(&hyst, &lut, band);
+
+  struct adc_capture_reader r;
+  if (adc_capture_map(&r, path)) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+  printf("VREF %.3f V, %u bits, nominal rate %.1f Hz\n", r.hdr.vref_uv / 1e6,
+         r.hdr.resolution, r.hdr.rate_mhz / 1e3);
+
+  static uint16_t code[ADC_CAPTURE_BLOCK_SAMPLES];
+  struct adc_capture_block blk;
+  uint64_t samples = 0, changes = 0, t_rec0 = 0, t_rec1 = 0;
+  int last = -1, n;
+  uint64_t t0 = monotonic_ns();
+
+  while (!stopped && (n = adc_capture_next(&r, code, &blk)) > 0) {
+    if (samples == 0) t_rec0 = blk.t_first_ns;
+    t_rec1 = blk.t_last_ns;
+    if (speed > 0) {  // pace per block against the recorded timestamps
+      uint64_t due = t0 + (blk.t_first_ns - t_rec0) / speed;
+      struct timespec ts = {.tv_sec = due / 1000000000,
+                            .tv_nsec = due % 1000000000};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    if (use_duty) {
+      for (int i = 0; i < n; i++) {
+        int out = lut.duty_ns[code[i]];
+        changes += out != last;
+        last = out;
+      }
+    } else {
+      for (int i = 0; i < n; i++) {
+        int out = lut.level[code[i]];
+        changes += out != last;
+        last = out;
+        adc_hyst_update(&hyst, code[i]);
+      }
+    }
+    samples += n;
+  }
+
+  double wall = (monotonic_ns() - t0) / 1e9;
+  double recorded = (t_rec1 - t_rec0) / 1e9;
+  printf("%s: %llu samples, %llu output changes\n", mode,
+         (unsigned long long)samples, (unsigned long long)changes);
+  if (!use_duty)
+    printf("with +/-%d codes hysteresis: %llu changes, %llu suppressed\n", band,
+           (unsigned long long)hyst.changes,
+           (unsigned long long)hyst.suppressed);
+  printf("recorded %.3f s, replayed in %.3f s (%.1fx real time, "
+         "%.1f Msamples/s)\n",
+         recorded, wall, wall > 0 ? recorded / wall : 0,
+         wall > 0 ? samples / wall / 1e6 : 0);
+  adc_capture_unmap(&r);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  signal(SIGINT, int_handler);
+  if (argc >= 3 && !strcmp(argv[1], "record")) {
+    return record(argv[2], argc > 3 ? atof(argv[3]) : 1000,
+                  argc > 4 ? atof(argv[4]) : 10,
+                  argc > 5 && !strcmp(argv[5], "raw") ? ADC_ENC_RAW
+                                                      : ADC_ENC_DELTA);
+  }
+  if (argc >= 3 && !strcmp(argv[1], "replay")) {
+    return replay(argv[2], argc > 3 ? argv[3] : "pwm",
+                  argc > 4 ? atof(argv[4]) : 0, argc > 5 ? atoi(argv[5]) : 20);
+  }
+  fprintf(stderr,
+          "usage: %s record <file> [rate_hz] [seconds] [raw|delta]\n"
+          "       %s replay <file> [pwm|leds|matrix] [speed] [hysteresis]\n",
+          argv[0], argv[0]);
+  return EXIT_FAILURE;
+}
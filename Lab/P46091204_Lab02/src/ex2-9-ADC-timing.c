@@ -0,0 +1,180 @@
+/**
+ * @file
+ * Measure the real ADC sample spacing
+ *
+ * Every sample carries the CLOCK_MONOTONIC_RAW time of its CS falling edge.
+ * Collect the intervals between them, then print the interval histogram, the
+ * effective rate and the worst gap. With grid_hz the samples are also
+ * resampled onto a uniform grid (linear interpolation) and written as
+ * "timestamp code" lines, ready for filters that assume a constant rate.
+ *
+ * Usage:
+ *   ex2-9-ADC-timing [rate_hz] [seconds] [grid_hz [out_file]]
+ *                                       acquire live (rate 0 = back-to-back)
+ *   ex2-9-ADC-timing -f <log_file> [grid_hz [out_file]]
+ *                                       analyse a log written by ex2-6
+ *
+ * Datasheet:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+#include "mcp3201.h"
+#include "adc_stream.h"
+#include "adc_timing.h"
+
+#define BATCH 4096
+// grid output per batch: enough for a grid up to 16x the input rate
+#define GRID_BATCH (16 * BATCH)
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+uint16_t read_adc(void *ctx, uint64_t *t_ns) {
+  return mcp3201_read_stamped(ctx, t_ns);
+}
+
+struct analysis {
+  struct adc_timing timing;
+  struct adc_resampler rs;
+  int resample;
+  int auto_bin;  // size the bins from the first batch
+  FILE *out;
+  uint64_t grid_samples;
+};
+
+void analysis_init(struct analysis *a, double rate_hz, double grid_hz,
+                   FILE *out) {
+  // 16 bins per nominal period
+  adc_timing_init(&a->timing, rate_hz > 0 ? 1e9 / rate_hz / 16 : 1000);
+  a->auto_bin = rate_hz <= 0;
+  a->resample = grid_hz > 0;
+  if (a->resample) adc_resampler_init(&a->rs, 1e9 / grid_hz, 0);
+  a->out = out;
+  a->grid_samples = 0;
+}
+
+void analysis_feed(struct analysis *a, const uint16_t *code,
+                   const uint64_t *t_ns, size_t n) {
+  static uint16_t grid[GRID_BATCH];
+  static uint64_t grid_t[GRID_BATCH];
+  if (a->auto_bin && n >= 2) {  // no nominal rate: use the first batch mean
+    adc_timing_init(&a->timing, (t_ns[n - 1] - t_ns[0]) / (n - 1) / 16);
+    a->auto_bin = 0;
+  }
+  adc_timing_add(&a->timing, t_ns, n);
+  if (!a->resample) return;
+  size_t m = adc_resampler_process(&a->rs, code, t_ns, n, grid, grid_t,
+                                   GRID_BATCH);
+  a->grid_samples += m;
+  if (a->out) {
+    for (size_t i = 0; i < m; i++)
+      fprintf(a->out, "%llu %u\n", (unsigned long long)grid_t[i], grid[i]);
+  }
+}
+
+void analysis_report(struct analysis *a) {
+  adc_timing_print(stdout, &a->timing);
+  if (a->resample)
+    printf("resampled onto a %.1f us grid: %llu samples\n",
+           a->rs.period_ns / 1e3, (unsigned long long)a->grid_samples);
+}
+
+int live(double rate_hz, double seconds, double grid_hz, FILE *out) {
+  struct mcp3201 adc;
+  if (mcp3201_init(&adc)) {
+    fprintf(stderr, "Failed to initalize GPIO. Did you run with sudo?\n");
+    return EXIT_FAILURE;
+  }
+
+  struct analysis a;
+  analysis_init(&a, rate_hz, grid_hz, out);
+
+  struct adc_stream stream;
+  if (adc_stream_start(&stream, read_adc, &adc, rate_hz, 1 << 16)) {
+    fprintf(stderr, "Failed to start the acquisition thread\n");
+    return EXIT_FAILURE;
+  }
+  struct adc_reader reader;
+  adc_reader_init(&reader, &stream.ring);
+
+  static uint16_t code[BATCH];
+  static uint64_t t_ns[BATCH];
+  uint64_t end = monotonic_ns() + seconds * 1e9;
+  while (!stopped && (seconds <= 0 || monotonic_ns() < end)) {
+    delay_ms(50);
+    size_t n;
+    while ((n = adc_reader_read(&reader, code, t_ns, BATCH)) > 0)
+      analysis_feed(&a, code, t_ns, n);
+  }
+
+  adc_stream_stop(&stream);
+  analysis_report(&a);
+  if (reader.overruns)
+    printf("%llu samples lost to overruns, their gaps are in the histogram\n",
+           (unsigned long long)reader.overruns);
+
+  /* release resource section */
+  adc_stream_free(&stream);
+  mcp3201_close(&adc);
+  return 0;
+}
+
+int from_log(const char *path, double grid_hz, FILE *out) {
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+
+  struct analysis a;
+  analysis_init(&a, 0, grid_hz, out);
+
+  static uint16_t code[BATCH];
+  static uint64_t t_ns[BATCH];
+  size_t n = 0;
+  unsigned long long t;
+  unsigned c;
+  while (!stopped && fscanf(in, "%llu %u", &t, &c) == 2) {
+    t_ns[n] = t;
+    code[n] = c;
+    if (++n == BATCH) {
+      analysis_feed(&a, code, t_ns, n);
+      n = 0;
+    }
+  }
+  analysis_feed(&a, code, t_ns, n);
+  analysis_report(&a);
+  fclose(in);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  signal(SIGINT, int_handler);
+  int offline = argc > 2 && !strcmp(argv[1], "-f");
+  // grid_hz and out_file are the 3rd and 4th argument in both modes
+  double grid_hz = argc > 3 ? atof(argv[3]) : 0;
+  FILE *out = NULL;
+  if (argc > 4 && !(out = fopen(argv[4], "w"))) {
+    perror(argv[4]);
+    return EXIT_FAILURE;
+  }
+
+  int ret = offline ? from_log(argv[2], grid_hz, out)
+                    : live(argc > 1 ? atof(argv[1]) : 1000,
+                           argc > 2 ? atof(argv[2]) : 10, grid_hz, out);
+  if (out) fclose(out);
+  return ret;
+}
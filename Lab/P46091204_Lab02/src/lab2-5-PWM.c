@@ -3,15 +3,22 @@
  * Control LED brightness with PWM
  *
  * Set the LED brigthness to resemble a sawtooth wave pattern with UP Board's
- * builtin PWM
+ * builtin PWM. Other shapes are precomputed the same way (see pwm_wave.h),
+ * and the achieved update rate and timing jitter are printed once per wave
+ * period.
+ *
+ * Usage: lab2-5-PWM [sawtooth|triangle|sine|breathing|<table file>]
+ *                   [update_hz] [wave_period_s] [gamma]
  */
 
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "mraa.h"
 #include "upboard_hat.h"
 #include "util.h"
+#include "pwm_wave.h"
 
 volatile sig_atomic_t stopped = 0;
 
@@ -20,26 +27,53 @@ void int_handler(int sig) {
   stopped = 1;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  const char *shape_name = argc > 1 ? argv[1] : "sawtooth";
+  // default: 0.01 duty steps every 10 ms, as before
+  double update_hz = argc > 2 ? atof(argv[2]) : 100;
+  double wave_period_s = argc > 3 ? atof(argv[3]) : 1;
+  // 1.0 keeps the linear ramp; ~2.2 makes brightness look linear to the eye
+  double gamma = argc > 4 ? atof(argv[4]) : 1.0;
+
+  static const char *const names[] = {"sawtooth", "triangle", "sine",
+                                      "breathing"};
+  enum pwm_shape shape = PWM_USER;
+  for (int i = 0; i < 4; i++)
+    if (!strcmp(shape_name, names[i])) shape = i;
+
+  static float user[PWM_WAVE_MAX_USER];
+  int nuser = 0;
+  if (shape == PWM_USER &&
+      (nuser = pwm_wave_load_user(shape_name, user, PWM_WAVE_MAX_USER)) <= 0) {
+    fprintf(stderr, "%s: not a shape and no brightness table found\n",
+            shape_name);
+    return EXIT_FAILURE;
+  }
+
+  struct pwm_wave wave;
+  if (pwm_wave_build(&wave, shape, update_hz * wave_period_s + 0.5, gamma,
+                     user, nuser)) {
+    fprintf(stderr, "Invalid update rate or wave period\n");
+    return EXIT_FAILURE;
+  }
+
   // pin 32: pwm pin with LED5
   mraa_pwm_context pin_pwm = mraa_pwm_init(UP_HAT_LED5);
   mraa_pwm_period_us(pin_pwm, 200);  // set pwm frequency to 5000hz
   mraa_pwm_enable(pin_pwm, 1);       // enable pwm pin
 
-  float duty_cycle = 0.0f;
-
   signal(SIGINT, int_handler);
+
+  struct pwm_player player;
+  pwm_player_init(&player, pin_pwm, &wave, update_hz);
   while (!stopped) {
-    printf("DUTY CYCLE: %f\n", duty_cycle);
-    mraa_pwm_write(pin_pwm, duty_cycle);  // change LED duty cycle
-
-    duty_cycle = duty_cycle + 0.01f;  // increment the duty cycle
-    if (duty_cycle >= 1.0f) {
-      duty_cycle = 0.0f;
-    }
-    delay_ms(10);
+    pwm_player_step(&player);
+    if (player.index == 0) pwm_player_print_stats(stdout, &player);
   }
+  pwm_player_print_stats(stdout, &player);
+
   /* release resource section */
+  pwm_wave_free(&wave);
   mraa_pwm_write(pin_pwm, 0.0);
   mraa_pwm_enable(pin_pwm, 0);
   mraa_pwm_close(pin_pwm);
@@ -0,0 +1,83 @@
+/**
+ * @file
+ * Bit-banged MCP3201 12-bit ADC on the UP board HAT
+ *
+ * Datasheet:
+ * https://ww1.microchip.com/downloads/en/DeviceDoc/21290F.pdf
+ */
+
+#ifndef MCP3201_H
+#define MCP3201_H
+
+#include <stdint.h>
+
+#include "mraa.h"
+#include "upboard_hat.h"
+#include "util.h"
+
+// ADC output resolution in bits
+#define ADC_RESOLUTION 12
+// Reference Voltage
+#define VREF 3.3f
+
+struct mcp3201 {
+  mraa_gpio_context clk, dout, cs;
+  long half_clock_ns;  // time spent in each clock phase
+};
+
+/**
+ * Claim the CLK / DOUT / CS pins, return 0 on success
+ */
+int mcp3201_init(struct mcp3201 *adc) {
+  // pin 12(CLK): clock pin
+  adc->clk = mraa_gpio_init(UP_HAT_MCP3201_CLK);
+  // pin 38(DOUT): SPI data pin
+  adc->dout = mraa_gpio_init(UP_HAT_MCP3201_DOUT);
+  // pin 40(CS/SHDN): pin_cs used to initiate communication with the device
+  adc->cs = mraa_gpio_init(UP_HAT_MCP3201_CS);
+  // 1 us per phase keeps f_CLK well below the 0.8 MHz limit at 2.7 V
+  adc->half_clock_ns = 1000;
+  if (!(adc->clk && adc->dout && adc->cs)) return -1;
+
+  mraa_gpio_dir(adc->clk, MRAA_GPIO_OUT);
+  mraa_gpio_dir(adc->dout, MRAA_GPIO_IN);
+  mraa_gpio_dir(adc->cs, MRAA_GPIO_OUT);
+  mraa_gpio_write(adc->cs, 1);
+  return 0;
+}
+
+/**
+ * Run one conversion and return the raw 12-bit code
+ *
+ * If t_ns is not NULL it receives the CLOCK_MONOTONIC_RAW time of the CS
+ * falling edge, which is when the MCP3201 starts sampling.
+ */
+uint16_t mcp3201_read_stamped(struct mcp3201 *adc, uint64_t *t_ns) {
+  mraa_gpio_write(adc->cs, 0);  // SPI communication start
+  if (t_ns) *t_ns = monotonic_raw_ns();
+  delay_spin_ns(adc->half_clock_ns);
+  uint16_t data_ADC = 0;
+  for (int SPICount = 0; SPICount < 15; SPICount++) {
+    mraa_gpio_write(adc->clk, 0);
+    delay_spin_ns(adc->half_clock_ns);
+    mraa_gpio_write(adc->clk, 1);
+    if (SPICount >= 3) {  // first 3 cycles doesn't matter
+      data_ADC = (data_ADC << 1) + mraa_gpio_read(adc->dout);
+    }
+    delay_spin_ns(adc->half_clock_ns);
+  }
+  mraa_gpio_write(adc->cs, 1);  // SPI communication end
+  return data_ADC;
+}
+
+uint16_t mcp3201_read(struct mcp3201 *adc) {
+  return mcp3201_read_stamped(adc, NULL);
+}
+
+void mcp3201_close(struct mcp3201 *adc) {
+  mraa_gpio_close(adc->dout);
+  mraa_gpio_close(adc->cs);
+  mraa_gpio_close(adc->clk);
+}
+
+#endif
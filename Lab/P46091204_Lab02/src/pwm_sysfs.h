@@ -0,0 +1,153 @@
+/**
+ * @file
+ * Cached PWM duty cycle output
+ *
+ * mraa's sysfs backend formats the duty in nanoseconds and writes it to
+ * /sys/class/pwm/pwmchipN/pwmM/duty_cycle on every call, identical or not.
+ * pwm_out keeps that file open after mraa has exported and enabled the
+ * channel, formats the number without stdio and writes it with a single
+ * pwrite(), and only when the duty actually differs from what the hardware
+ * already has.
+ *
+ * With a maximum update rate, a change that arrives less than one interval
+ * after the previous write is held as pending and only the newest pending
+ * value is written once the interval has passed (pwm_out_flush()), so a burst
+ * of updates costs one write.
+ *
+ * When the sysfs file cannot be opened (another backend, or no permission to
+ * the attribute) writes go through mraa_pwm_pulsewidth_us() instead, with the
+ * same caching.
+ */
+
+#ifndef PWM_SYSFS_H
+#define PWM_SYSFS_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "mraa.h"
+#include "util.h"
+
+// sysfs PWM channel behind UP_HAT_LED5 (header pin 32)
+#ifndef UP_HAT_LED5_PWMCHIP
+#define UP_HAT_LED5_PWMCHIP 0
+#endif
+#ifndef UP_HAT_LED5_PWM
+#define UP_HAT_LED5_PWM 0
+#endif
+
+struct pwm_out {
+  mraa_pwm_context pwm;
+  int fd;  // duty_cycle attribute, -1 when falling back to mraa
+  int64_t written;  // duty in ns the hardware has, -1 if unknown
+  int64_t pending;  // coalesced duty waiting for the interval, -1 if none
+  uint64_t min_interval_ns;
+  uint64_t t_write;  // time of the last write
+  uint64_t requested, issued, suppressed, coalesced, errors;
+};
+
+/**
+ * Attach to an initialised and enabled mraa PWM
+ *
+ * max_rate_hz limits how often the duty is written (0: no limit). Return 0
+ * when the sysfs attribute is used directly, 1 when falling back to mraa.
+ */
+int pwm_out_open(struct pwm_out *out, mraa_pwm_context pwm, int chip,
+                 int channel, double max_rate_hz) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/class/pwm/pwmchip%d/pwm%d/duty_cycle",
+           chip, channel);
+  out->pwm = pwm;
+  out->fd = open(path, O_WRONLY | O_CLOEXEC);
+  out->written = out->pending = -1;
+  out->min_interval_ns = max_rate_hz > 0 ? 1e9 / max_rate_hz : 0;
+  out->t_write = 0;
+  out->requested = out->issued = out->suppressed = out->coalesced = 0;
+  out->errors = 0;
+  return out->fd < 0;
+}
+
+/**
+ * Write duty_ns now, bypassing the cache checks, return 0 on success
+ */
+int pwm_out_write(struct pwm_out *out, uint32_t duty_ns, uint64_t now) {
+  uint32_t value = duty_ns;
+  int ok;
+  if (out->fd >= 0) {
+    char buf[12];
+    char *p = buf + sizeof(buf);
+    *--p = '\n';
+    do {
+      *--p = '0' + value % 10;
+      value /= 10;
+    } while (value);
+    size_t len = buf + sizeof(buf) - p;
+    ok = pwrite(out->fd, p, len, 0) == (ssize_t)len;
+  } else {
+    ok = mraa_pwm_pulsewidth_us(out->pwm, duty_ns / 1000) == MRAA_SUCCESS;
+  }
+  out->issued++;
+  out->t_write = now;
+  if (!ok) {
+    out->errors++;
+    out->written = -1;  // state unknown: the next set must write again
+    return -1;
+  }
+  out->written = duty_ns;
+  return 0;
+}
+
+/**
+ * Request duty_ns, return 1 if it was written now
+ */
+int pwm_out_set(struct pwm_out *out, uint32_t duty_ns, uint64_t now) {
+  out->requested++;
+  if (out->fd < 0) duty_ns -= duty_ns % 1000;  // mraa takes microseconds
+  if (out->pending >= 0) {  // a newer value replaces the held one
+    out->coalesced++;
+    out->pending = -1;
+  }
+  if ((int64_t)duty_ns == out->written) {
+    out->suppressed++;
+    return 0;
+  }
+  if (out->min_interval_ns && out->issued &&
+      now - out->t_write < out->min_interval_ns) {
+    out->pending = duty_ns;
+    return 0;
+  }
+  pwm_out_write(out, duty_ns, now);
+  return 1;
+}
+
+/**
+ * Write the pending value if its interval has passed, return 1 if written
+ *
+ * Call it from the update loop so a held value does not wait for the next
+ * pwm_out_set().
+ */
+int pwm_out_flush(struct pwm_out *out, uint64_t now) {
+  if (out->pending < 0 || now - out->t_write < out->min_interval_ns) return 0;
+  uint32_t duty_ns = out->pending;
+  out->pending = -1;
+  pwm_out_write(out, duty_ns, now);
+  return 1;
+}
+
+void pwm_out_print_stats(FILE *f, const struct pwm_out *out) {
+  fprintf(f,
+          "PWM (%s): %llu requested, %llu written, %llu unchanged, "
+          "%llu coalesced, %llu errors\n",
+          out->fd >= 0 ? "sysfs" : "mraa", (unsigned long long)out->requested,
+          (unsigned long long)out->issued, (unsigned long long)out->suppressed,
+          (unsigned long long)out->coalesced, (unsigned long long)out->errors);
+}
+
+void pwm_out_close(struct pwm_out *out) {
+  if (out->fd >= 0) close(out->fd);
+  out->fd = -1;
+}
+
+#endif
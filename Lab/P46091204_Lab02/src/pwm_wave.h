@@ -0,0 +1,183 @@
+/**
+ * @file
+ * Table-driven PWM waveforms
+ *
+ * One period of the waveform is precomputed as Q16 duty cycles (0 = off,
+ * 65535 = fully on) with gamma correction already applied, so playback is a
+ * table index and one PWM write per update. The player wakes on an absolute
+ * CLOCK_MONOTONIC deadline, so timing errors do not accumulate, and records
+ * how late every update was relative to its deadline.
+ */
+
+#ifndef PWM_WAVE_H
+#define PWM_WAVE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mraa.h"
+#include "util.h"
+
+#define PWM_WAVE_MAX_USER 1024
+
+enum pwm_shape {
+  PWM_SAWTOOTH,
+  PWM_TRIANGLE,
+  PWM_SINE,
+  PWM_BREATHING,
+  PWM_USER,  // linear interpolation through user supplied points
+};
+
+struct pwm_wave {
+  uint16_t *duty;  // Q16 duty cycle of each update
+  size_t len;
+};
+
+/** Update timing of a pwm_player */
+struct pwm_jitter {
+  uint64_t updates;
+  uint64_t late;  // deadlines missed by a whole update period or more
+  uint64_t t_first, t_last;
+  uint64_t lat_min, lat_max;  // wake-up minus deadline
+  double lat_mean, lat_m2;    // Welford running mean / sum of squares
+};
+
+struct pwm_player {
+  mraa_pwm_context pwm;
+  const struct pwm_wave *wave;
+  uint64_t period_ns;  // between updates
+  uint64_t deadline;
+  size_t index;
+  struct pwm_jitter jitter;
+};
+
+/**
+ * Linear brightness (0..1) of shape at phase x (0..1)
+ */
+double pwm_shape_value(enum pwm_shape shape, double x, const float *user,
+                       size_t nuser) {
+  switch (shape) {
+    case PWM_SAWTOOTH:
+      return x;
+    case PWM_TRIANGLE:
+      return x < 0.5 ? 2 * x : 2 - 2 * x;
+    case PWM_SINE:
+      return 0.5 - 0.5 * cos(2 * M_PI * x);
+    case PWM_BREATHING:  // exp(sin), started at its minimum: a resting breath
+      return (exp(-cos(2 * M_PI * x)) - 1 / M_E) / (M_E - 1 / M_E);
+    case PWM_USER: {
+      if (nuser == 0) return 0;
+      double pos = x * nuser;  // the table wraps around, like the others
+      size_t i = (size_t)pos % nuser;
+      double f = pos - floor(pos);
+      return user[i] + (user[(i + 1) % nuser] - user[i]) * f;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Build len updates of one period, duty = value ^ gamma
+ *
+ * user / nuser are only used by PWM_USER. Return 0 on success.
+ */
+int pwm_wave_build(struct pwm_wave *w, enum pwm_shape shape, size_t len,
+                   double gamma, const float *user, size_t nuser) {
+  if (len == 0 || !(w->duty = malloc(len * sizeof(*w->duty)))) return -1;
+  w->len = len;
+  for (size_t i = 0; i < len; i++) {
+    double v = pwm_shape_value(shape, (double)i / len, user, nuser);
+    if (v < 0) v = 0;
+    if (v > 1) v = 1;
+    w->duty[i] = pow(v, gamma) * 65535 + 0.5;
+  }
+  return 0;
+}
+
+void pwm_wave_free(struct pwm_wave *w) { free(w->duty); }
+
+/**
+ * Read up to max brightness values (0..1), one per line, '#' starts a comment
+ *
+ * Return the number read, -1 if the file cannot be opened.
+ */
+int pwm_wave_load_user(const char *path, float *user, size_t max) {
+  FILE *f = fopen(path, "r");
+  if (!f) return -1;
+  char line[128];
+  size_t n = 0;
+  while (n < max && fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%f", &user[n]) == 1) n++;
+  }
+  fclose(f);
+  return n;
+}
+
+/**
+ * Start at the first table entry, first update one period from now
+ */
+void pwm_player_init(struct pwm_player *p, mraa_pwm_context pwm,
+                     const struct pwm_wave *wave, double update_hz) {
+  memset(p, 0, sizeof(*p));
+  p->pwm = pwm;
+  p->wave = wave;
+  p->period_ns = 1e9 / update_hz;
+  p->deadline = monotonic_ns() + p->period_ns;
+}
+
+/**
+ * Sleep until the next deadline, write the next duty cycle and account it
+ */
+void pwm_player_step(struct pwm_player *p) {
+  struct timespec ts = {.tv_sec = p->deadline / 1000000000,
+                        .tv_nsec = p->deadline % 1000000000};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+  }
+  uint64_t now = monotonic_ns();
+  mraa_pwm_write(p->pwm, p->wave->duty[p->index] * (1.0f / 65535));
+  if (++p->index == p->wave->len) p->index = 0;
+
+  struct pwm_jitter *j = &p->jitter;
+  uint64_t lat = now - p->deadline;
+  if (j->updates++ == 0) {
+    j->t_first = now;
+    j->lat_min = lat;
+  }
+  j->t_last = now;
+  if (lat < j->lat_min) j->lat_min = lat;
+  if (lat > j->lat_max) j->lat_max = lat;
+  double delta = lat - j->lat_mean;
+  j->lat_mean += delta / j->updates;
+  j->lat_m2 += delta * (lat - j->lat_mean);
+
+  p->deadline += p->period_ns;
+  if (now > p->deadline + p->period_ns) {
+    // a whole update was missed: skip it instead of bursting to catch up
+    uint64_t missed = (now - p->deadline) / p->period_ns;
+    j->late += missed;
+    p->deadline += missed * p->period_ns;
+    p->index = (p->index + missed) % p->wave->len;
+  }
+}
+
+/**
+ * One line: achieved update rate and wake-up latency min / mean / sd / max
+ */
+void pwm_player_print_stats(FILE *f, const struct pwm_player *p) {
+  const struct pwm_jitter *j = &p->jitter;
+  double span = (j->t_last - j->t_first) / 1e9;
+  double sd = j->updates > 1 ? sqrt(j->lat_m2 / (j->updates - 1)) : 0;
+  fprintf(f,
+          "%llu updates, %.1f Hz (target %.1f), jitter min %.1f mean %.1f "
+          "sd %.1f max %.1f us, %llu skipped\n",
+          (unsigned long long)j->updates,
+          span > 0 ? (j->updates - 1) / span : 0, 1e9 / p->period_ns,
+          j->lat_min / 1e3, j->lat_mean / 1e3, sd / 1e3, j->lat_max / 1e3,
+          (unsigned long long)j->late);
+}
+
+#endif
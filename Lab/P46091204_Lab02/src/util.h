@@ -1,3 +1,7 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -18,6 +22,39 @@ void delay_ns(long ns) {
 
 void delay_ms(double ms) { delay_ns(ms * 1000000); }
 
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds (served by the vDSO, no syscall)
+ */
+uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Current CLOCK_MONOTONIC_RAW time in nanoseconds
+ *
+ * Not slewed by NTP, so differences are true oscillator time; use it to
+ * measure sample spacing.
+ */
+uint64_t monotonic_raw_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Busy-wait for ns nanoseconds
+ *
+ * nanosleep() rounds a 1 us request up to the timer slack (~50 us), which
+ * dominates a bit-banged transfer; spinning keeps the clock close to spec.
+ */
+void delay_spin_ns(long ns) {
+  uint64_t end = monotonic_ns() + ns;
+  while (monotonic_ns() < end) {
+  }
+}
+
 // Check MRAA return status
 #define MRAA_ASSERT(ret)                  \
   do {                                    \
@@ -28,3 +65,5 @@ void delay_ms(double ms) { delay_ns(ms * 1000000); }
       exit(EXIT_FAILURE);                 \
     }                                     \
   } while (0)
+
+#endif
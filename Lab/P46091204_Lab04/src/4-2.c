@@ -11,6 +11,8 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "tx_queue.h"
+
 #define SERIAL_DEVICE "/dev/ttyS0"
 
 #define NONE "\033[m"
@@ -70,15 +72,20 @@ int main() {
   struct termios old_term;
   setup_terminal(fd, &old_term);
 
-  dprintf(fd, LIGHT_RED"Hello World! \n");
-  dprintf(fd, LIGHT_GREEN"Hello World! \n");
-  dprintf(fd, LIGHT_BLUE"Hello World! \n");
-  dprintf(fd, DARY_GRAY"Hello World! \n");
-  dprintf(fd, LIGHT_CYAN"Hello World! \n");
-  dprintf(fd, LIGHT_PURPLE"Hello World! \n");
-  dprintf(fd, BROWN"Hello World! \n");
-  dprintf(fd, LIGHT_GRAY"Hello World! \n");
-  dprintf(fd, WHITE"Hello World! \n");
+  // the nine lines go out in one writev(), paced to the line
+  struct tx_queue tx;
+  tx_queue_init(&tx, fd, 115200);
+  tx_queue_printf(&tx, LIGHT_RED"Hello World! \n");
+  tx_queue_printf(&tx, LIGHT_GREEN"Hello World! \n");
+  tx_queue_printf(&tx, LIGHT_BLUE"Hello World! \n");
+  tx_queue_printf(&tx, DARY_GRAY"Hello World! \n");
+  tx_queue_printf(&tx, LIGHT_CYAN"Hello World! \n");
+  tx_queue_printf(&tx, LIGHT_PURPLE"Hello World! \n");
+  tx_queue_printf(&tx, BROWN"Hello World! \n");
+  tx_queue_printf(&tx, LIGHT_GRAY"Hello World! \n");
+  tx_queue_printf(&tx, WHITE"Hello World! \n");
+  if (tx_queue_flush(&tx)) perror("write");
+  tx_queue_report(&tx, stdout);
 
   restore_terminal(fd, &old_term);
   close(fd);
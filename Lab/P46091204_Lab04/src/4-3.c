@@ -13,13 +13,16 @@
 **/
 
 #include <errno.h>
+#include <fcntl.h>
 #include <mraa.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
-#include <assert.h>
+
+#include "line_edit.h"
+#include "tx_queue.h"
 
 #define SERIAL_DEVICE "/dev/ttyS0"
 
@@ -34,8 +37,9 @@ void setup_terminal(int fd, struct termios *old_term) {
   }
   struct termios new_term = *old_term;
 
-  new_term.c_lflag |= ECHO | ECHOE | ICRNL | NOFLSH;
-  new_term.c_lflag &= ~(ICANON | ECHOCTL);
+  // the line editor echoes, the tty must not
+  new_term.c_lflag |= NOFLSH;
+  new_term.c_lflag &= ~(ICANON | ECHO | ECHOCTL);
 
   cfsetspeed(&new_term, B115200);  // set baud rate to 115200
   if (tcsetattr(fd, TCSANOW, &new_term) != 0) {
@@ -54,76 +58,29 @@ void restore_terminal(int fd, struct termios *old_term) {
   }
 }
 
-#define max(a,b)(a>b?a:b)
-#define min(a,b)(a<b?a:b)
-
-
-int my_getline(char* line, int maxSize, FILE* fp){  
-    char c;  
-    int len = 0;  
-    int index = 0;
-
-    char line_[maxSize];
-
-    do {
-      c = fgetc(fp);
-
-      while (c == 27) { // if the first value is esc
-        c = fgetc(fp); // skip the [
-        switch(c = fgetc(fp)) { // the real value
-            case 67:  // for arrow right
-                index = min(len, index + 1);
-                break;
-            case 68:  // for arrow left
-                index = max(0, index - 1);
-                break;
-        }
-        c = fgetc(fp);
-      }
-
-      if (c >= 32 && c <= 126) {
-        for (int i = 0; i < len; i++){line_[i] = line[i];}  // copy line to line_
-
-        len++;
-
-        for (int i = 0; i < index; i++){line[i] = line_[i];}  
-        line[index] = c;                                    // insert the character to line
-        for (int i = index+1; i < len; i++){line[i] = line_[i-1];}
-
-        index++;
-      }
-
-      if ('\n' == c)  break;
-
-    } while( c != EOF && len < maxSize );
-
-    line[len] = '\0';  
-    return len;  
-}  
-
-
 int main() {
   int fd = open(SERIAL_DEVICE, O_RDWR | O_NOCTTY);
   if (fd == -1) {
     perror("open_port: Unable to open " SERIAL_DEVICE " - ");
   }
-  FILE *file = fdopen(fd, "r+");
-  if (!file) {
-    perror("fdopen");
-  }
 
-  dprintf(fd, "\n\rPlease input something. Server will show the same string.\n\r");
-  dprintf(fd, "Enter quit to quit\n\n\r");
+  struct tx_queue tx;
+  tx_queue_init(&tx, fd, 115200);
+  tx_queue_put_const(&tx, "\n\rPlease input something. Server will show the same string.\n\r");
+  tx_queue_put_const(&tx, "Enter quit to quit\n\n\r");
+  tx_queue_flush(&tx);
   struct termios old_term;
   setup_terminal(fd, &old_term);
-  int maxSize = 20;
-  char *line = (char*)malloc( sizeof(char) * maxSize);
-  int i = 0;
+  struct line_edit editor;
+  if (line_edit_init(&editor, fd)) {
+    perror("line_edit_init");
+    exit(EXIT_FAILURE);
+  }
+  char *line;
   while (1) {
-    dprintf(fd, "\n\rinput> ");
-    // ssize_t length = readline(&line, &(size_t){0}, file);
-    int length = my_getline(line, maxSize, file);
-
+    // sent with the "\r\n" of the line before
+    line_edit_put(&editor, "\rinput> ", 8);
+    ssize_t length = line_edit_getline(&editor, &line);
 
     if (length == -1) {
       if (!errno) break;
@@ -131,16 +88,17 @@ int main() {
       exit(EXIT_FAILURE);
     }
 
-    if (length >= 1 && line[length - 1] == '\n') {
-      line[length - 1] = '\0';
-    }
-
     if (!strcmp("quit", line)) break;
-    printf("\n\rClient says: %s (length=%ld)\n\r", line, strlen(line));
-    if (i == 0) break;
+    printf("\n\rClient says: %s (length=%zd)\n\r", line, length);
   }
-  dprintf(fd, "\n\rbye\n\r");
-  free(line);
+  line_edit_flush(&editor);
+  tx_queue_put_const(&tx, "\n\rbye\n\r");
+  tx_queue_flush(&tx);
+  tx_queue_report(&tx, stdout);
+  printf("editor: %llu bytes in %llu writes\n",
+         (unsigned long long)editor.bytes_out,
+         (unsigned long long)editor.writes);
+  line_edit_free(&editor);
   restore_terminal(fd, &old_term);
   close(fd);
 }
@@ -0,0 +1,73 @@
+/**
+ * @file
+ * BH1750 ambient light sensor on an i2c_bus
+ *
+ * Measurements are one-shot high resolution (1 lx, typ. 120 ms, max. 180 ms).
+ * The sensor does not NACK while converting, a read before the conversion
+ * finished just returns the previous result, so bh1750_try_collect() only
+ * reads once the maximum conversion time has passed.
+ */
+
+#ifndef BH1750_H
+#define BH1750_H
+
+#include <stdint.h>
+
+#include "util.h"
+#include "i2c_bus.h"
+
+#define BH1750_ADDRESS 0x23  // ADDR low, 0x5c with ADDR high
+#define BH1750_POWER_ON 0x01
+#define BH1750_ONE_TIME_H_RES 0x20
+#define BH1750_TYP_US 120000
+#define BH1750_MAX_US 180000
+
+struct bh1750 {
+  struct i2c_bus *bus;
+  uint16_t addr;
+  int pending;
+  uint64_t t_start;
+};
+
+/**
+ * Power the sensor on, return 0 on success
+ */
+int bh1750_init(struct bh1750 *dev, struct i2c_bus *bus, uint16_t addr) {
+  uint8_t cmd = BH1750_POWER_ON;
+  dev->bus = bus;
+  dev->addr = addr;
+  dev->pending = 0;
+  return i2c_bus_write_read(bus, addr, &cmd, 1, NULL, 0);
+}
+
+/**
+ * Start a one-shot conversion, return 0 on success
+ */
+int bh1750_start(struct bh1750 *dev) {
+  uint8_t cmd = BH1750_ONE_TIME_H_RES;
+  dev->pending = 0;
+  if (i2c_bus_write_read(dev->bus, dev->addr, &cmd, 1, NULL, 0)) return -1;
+  dev->t_start = monotonic_ns();
+  dev->pending = 1;
+  return 0;
+}
+
+/**
+ * Read the result into raw if the conversion is done
+ *
+ * Return 0 on success, 1 if it is too early, -1 on error or if nothing is
+ * pending.
+ */
+int bh1750_try_collect(struct bh1750 *dev, uint16_t *raw) {
+  if (!dev->pending) return -1;
+  if (monotonic_ns() - dev->t_start < BH1750_MAX_US * 1000ull) return 1;
+  dev->pending = 0;
+  uint8_t buf[2];
+  if (i2c_bus_write_read(dev->bus, dev->addr, NULL, 0, buf, 2)) return -1;
+  *raw = (buf[0] << 8) | buf[1];
+  return 0;
+}
+
+double bh1750_lux(uint16_t raw) { return raw / 1.2; }
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @file
+ * BMP180 pressure sensor on an i2c_bus
+ *
+ * A reading is a temperature conversion followed by a pressure conversion;
+ * the pressure compensation needs the temperature. Both are started by
+ * writing the control register and are finished when its SCO bit clears,
+ * which is polled with one combined write + read. Compensation follows the
+ * integer algorithm of the datasheet.
+ */
+
+#ifndef BMP180_H
+#define BMP180_H
+
+#include <stdint.h>
+
+#include "util.h"
+#include "i2c_bus.h"
+
+#define BMP180_ADDRESS 0x77
+#define BMP180_CALIBRATION 0xaa  // 11 big endian words
+#define BMP180_CTRL_MEAS 0xf4
+#define BMP180_OUT_MSB 0xf6
+#define BMP180_SCO 0x20  // start of conversion, cleared when done
+#define BMP180_TEMPERATURE 0x2e
+#define BMP180_PRESSURE 0x34  // | oss << 6
+#define BMP180_TIMEOUT_US 50000
+
+enum bmp180_kind { BMP180_TEMP, BMP180_PRES };
+
+struct bmp180 {
+  struct i2c_bus *bus;
+  uint16_t addr;
+  int oss;  // oversampling, 0..3
+  int16_t ac1, ac2, ac3, b1, b2, mb, mc, md;
+  uint16_t ac4, ac5, ac6;
+  int pending;  // kind being converted, -1 if idle
+  uint64_t t_start;
+  int32_t b5;  // from the last temperature, needed for the pressure
+};
+
+/**
+ * Read the calibration, return 0 on success
+ */
+int bmp180_init(struct bmp180 *dev, struct i2c_bus *bus, uint16_t addr,
+                int oss) {
+  uint8_t reg = BMP180_CALIBRATION, c[22];
+  dev->bus = bus;
+  dev->addr = addr;
+  dev->oss = oss & 3;
+  dev->pending = -1;
+  dev->b5 = 0;
+  if (i2c_bus_write_read(bus, addr, &reg, 1, c, sizeof(c))) return -1;
+#define BMP180_WORD(i) ((c[2 * (i)] << 8) | c[2 * (i) + 1])
+  dev->ac1 = BMP180_WORD(0);
+  dev->ac2 = BMP180_WORD(1);
+  dev->ac3 = BMP180_WORD(2);
+  dev->ac4 = BMP180_WORD(3);
+  dev->ac5 = BMP180_WORD(4);
+  dev->ac6 = BMP180_WORD(5);
+  dev->b1 = BMP180_WORD(6);
+  dev->b2 = BMP180_WORD(7);
+  dev->mb = BMP180_WORD(8);
+  dev->mc = BMP180_WORD(9);
+  dev->md = BMP180_WORD(10);
+#undef BMP180_WORD
+  return 0;
+}
+
+/**
+ * Maximum conversion time of kind in microseconds
+ */
+uint32_t bmp180_conversion_us(const struct bmp180 *dev,
+                              enum bmp180_kind kind) {
+  static const uint32_t pressure_us[4] = {4500, 7500, 13500, 25500};
+  return kind == BMP180_TEMP ? 4500 : pressure_us[dev->oss];
+}
+
+/**
+ * Start a conversion, return 0 on success
+ */
+int bmp180_start(struct bmp180 *dev, enum bmp180_kind kind) {
+  uint8_t buf[2] = {BMP180_CTRL_MEAS, kind == BMP180_TEMP
+                                          ? BMP180_TEMPERATURE
+                                          : BMP180_PRESSURE | dev->oss << 6};
+  dev->pending = -1;
+  if (i2c_bus_write_read(dev->bus, dev->addr, buf, 2, NULL, 0)) return -1;
+  dev->t_start = monotonic_ns();
+  dev->pending = kind;
+  return 0;
+}
+
+/**
+ * Read the uncompensated result into raw if the conversion is done
+ *
+ * Return 0 on success, 1 if still converting, -1 on error, timeout or if
+ * nothing is pending.
+ */
+int bmp180_try_collect(struct bmp180 *dev, int32_t *raw) {
+  if (dev->pending < 0) return -1;
+  uint8_t reg = BMP180_CTRL_MEAS, ctrl;
+  if (i2c_bus_write_read(dev->bus, dev->addr, &reg, 1, &ctrl, 1)) {
+    dev->pending = -1;
+    return -1;
+  }
+  if (ctrl & BMP180_SCO) {
+    if (monotonic_ns() - dev->t_start <= BMP180_TIMEOUT_US * 1000ull) return 1;
+    dev->pending = -1;
+    return -1;
+  }
+  int kind = dev->pending;
+  dev->pending = -1;
+  uint8_t out[3];
+  reg = BMP180_OUT_MSB;
+  if (i2c_bus_write_read(dev->bus, dev->addr, &reg, 1, out,
+                         kind == BMP180_TEMP ? 2 : 3))
+    return -1;
+  if (kind == BMP180_TEMP)
+    *raw = (out[0] << 8) | out[1];
+  else
+    *raw = ((out[0] << 16) | (out[1] << 8) | out[2]) >> (8 - dev->oss);
+  return 0;
+}
+
+/**
+ * Compensated temperature in 0.1 C; remembers B5 for bmp180_pressure()
+ */
+int32_t bmp180_temperature(struct bmp180 *dev, int32_t ut) {
+  int32_t x1 = ((ut - dev->ac6) * dev->ac5) >> 15;
+  int32_t x2 = (dev->mc * 2048) / (x1 + dev->md);
+  dev->b5 = x1 + x2;
+  return (dev->b5 + 8) >> 4;
+}
+
+/**
+ * Compensated pressure in Pa, using the B5 of the last temperature
+ */
+int32_t bmp180_pressure(const struct bmp180 *dev, int32_t up) {
+  int32_t b6 = dev->b5 - 4000;
+  int32_t x1 = (dev->b2 * ((b6 * b6) >> 12)) >> 11;
+  int32_t x2 = (dev->ac2 * b6) >> 11;
+  int32_t x3 = x1 + x2;
+  int32_t b3 = ((((int32_t)dev->ac1 * 4 + x3) << dev->oss) + 2) / 4;
+  x1 = (dev->ac3 * b6) >> 13;
+  x2 = (dev->b1 * ((b6 * b6) >> 12)) >> 16;
+  x3 = ((x1 + x2) + 2) >> 2;
+  uint32_t b4 = (dev->ac4 * (uint32_t)(x3 + 32768)) >> 15;
+  uint32_t b7 = ((uint32_t)up - b3) * (50000 >> dev->oss);
+  int32_t p = b7 < 0x80000000 ? (b7 * 2) / b4 : (b7 / b4) * 2;
+  x1 = (p >> 8) * (p >> 8);
+  x1 = (x1 * 3038) >> 16;
+  x2 = (-7357 * p) >> 16;
+  return p + ((x1 + x2 + 3791) >> 4);
+}
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * @file
+ * Samples per second through a serial link: binary frames against ASCII
+ *
+ * Formats the same simulated readings as the ASCII output of the serial
+ * programs and as frames (frame.h), counts the bytes and converts them to
+ * the samples per second a link of the given baud rate sustains (8N1: 10
+ * bits per byte). Three workloads:
+ *   reply    one temperature per message: "Temperature: 24.69 C\r\n> "
+ *   adc      a stream of 12 bit ADC codes, "%d\r\n" against FRAME_BLOCK
+ *            frames of ADC_BLOCK codes
+ *   pairs    temperature + humidity per tick, serial's "TEMP: ... HUM: ..."
+ * For each it also times formatting and parsing per sample on this CPU and
+ * checks that every frame decodes to the values sent.
+ *
+ * Then the pairs stream goes through a channel flipping each bit with
+ * probability bit_error_rate; the decoder must resynchronise after every
+ * damaged frame and must not deliver a wrong value (reported as
+ * undetected).
+ *
+ * Usage: frame-bench [baud=115200] [messages=100000] [bit_error_rate=1e-4]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "frame.h"
+
+#define ADC_BLOCK 64
+
+struct workload {
+  const char *name;
+  int samples;  // per message
+  size_t ascii_bytes, binary_bytes;
+  double ascii_fmt_ns, ascii_parse_ns, bin_fmt_ns, bin_parse_ns;
+  uint64_t mismatches;
+  int32_t *expect;  // the fixed-point values sent, message by message
+};
+
+struct check {
+  const int32_t *expect;  // raw values in send order
+  size_t next;
+  uint64_t mismatches;
+};
+
+void check_frame(void *ctx, const struct frame *f) {
+  struct check *c = ctx;
+  for (int i = 0; i < f->n; i++)
+    if (f->s[i].raw != c->expect[c->next++]) c->mismatches++;
+}
+
+/**
+ * Noisy link: a pairs frame must carry the values of the message its time
+ * field (the message index) names
+ */
+void check_noisy(void *ctx, const struct frame *f) {
+  struct check *c = ctx;
+  size_t i = f->t_ms;
+  if (i >= c->next || f->n != 2 || f->s[0].raw != c->expect[2 * i] ||
+      f->s[1].raw != c->expect[2 * i + 1])
+    c->mismatches++;
+}
+
+volatile double sink;
+
+double temperature(int i, unsigned short xs[3]) {
+  return 24 + 3 * sin(i / 5000.0) + 0.02 * (erand48(xs) - 0.5);
+}
+
+double humidity(int i, unsigned short xs[3]) {
+  return 55 - 10 * sin(i / 5000.0) + 0.05 * (erand48(xs) - 0.5);
+}
+
+int adc_code(int i, unsigned short xs[3]) {
+  return lround(2048 + 500 * sin(i / 50.0) + 2 * (erand48(xs) - 0.5));
+}
+
+/**
+ * Encode n messages of workload w both ways, into ascii and bin
+ */
+void run(struct workload *w, int n, char *ascii, uint8_t *bin) {
+  unsigned short xs[3] = {7, 8, 9};
+  int per = w->samples;
+  double *v = malloc((size_t)n * per * sizeof(*v));
+  int32_t *expect = malloc((size_t)n * per * sizeof(*expect));
+  int ch[2] = {FRAME_CH_TEMPERATURE, FRAME_CH_HUMIDITY};
+  if (per == ADC_BLOCK) ch[0] = FRAME_CH_ADC;
+  for (int i = 0; i < n; i++)
+    for (int k = 0; k < per; k++) {
+      int j = i * per + k;
+      v[j] = per == ADC_BLOCK ? adc_code(j, xs)
+             : k == 0         ? temperature(j, xs)
+                              : humidity(j, xs);
+      expect[j] = frame_quantize(ch[per == ADC_BLOCK ? 0 : k], v[j]);
+    }
+
+  uint64_t t0 = monotonic_ns();
+  size_t a = 0;
+  for (int i = 0; i < n; i++) {
+    const double *s = v + (size_t)i * per;
+    if (per == 1)
+      a += sprintf(ascii + a, "Temperature: %.2f C\r\n> ", s[0]);
+    else if (per == 2)
+      a += sprintf(ascii + a, "TEMP: %.2f C\tHUM: %.2f %%\n", s[0], s[1]);
+    else
+      for (int k = 0; k < per; k++)
+        a += sprintf(ascii + a, "%d\r\n", (int)s[k]);
+  }
+  uint64_t t1 = monotonic_ns();
+  double sum = 0;
+  for (char *p = ascii; p < ascii + a; p++) {
+    // what a host does with the text: find the numbers and convert them
+    if ((*p >= '0' && *p <= '9') || *p == '-') {
+      char *end;
+      sum += strtod(p, &end);
+      p = end;
+    }
+  }
+  uint64_t t2 = monotonic_ns();
+  sink = sum;
+
+  struct frame_writer fw;
+  frame_writer_init(&fw);
+  size_t b = 0;
+  for (int i = 0; i < n; i++) {
+    const double *s = v + (size_t)i * per;
+    if (per == ADC_BLOCK)
+      frame_begin_block(&fw, i, FRAME_CH_ADC, 1000);
+    else
+      frame_begin(&fw, i);
+    for (int k = 0; k < per; k++)
+      frame_add(&fw, ch[per == ADC_BLOCK ? 0 : k], s[k]);
+    b += frame_finish(&fw, bin + b);
+  }
+  uint64_t t3 = monotonic_ns();
+  struct frame_decoder d;
+  frame_decoder_init(&d);
+  struct check c = {.expect = expect};
+  frame_decoder_feed(&d, bin, b, check_frame, &c);
+  uint64_t t4 = monotonic_ns();
+
+  double samples = (double)n * per;
+  w->ascii_bytes = a;
+  w->binary_bytes = b;
+  w->ascii_fmt_ns = (t1 - t0) / samples;
+  w->ascii_parse_ns = (t2 - t1) / samples;
+  w->bin_fmt_ns = (t3 - t2) / samples;
+  w->bin_parse_ns = (t4 - t3) / samples;
+  w->mismatches = c.mismatches + (samples - c.next) + d.crc_errors + d.bad;
+  w->expect = expect;
+  free(v);
+}
+
+int main(int argc, char *argv[]) {
+  double baud = argc > 1 ? atof(argv[1]) : 115200;
+  int n = argc > 2 ? atoi(argv[2]) : 100000;
+  double ber = argc > 3 ? atof(argv[3]) : 1e-4;
+  double bytes_per_s = baud / 10;
+
+  char *ascii = malloc((size_t)n * ADC_BLOCK * 8);
+  uint8_t *bin = malloc((size_t)n * FRAME_MAX_ENCODED);
+  struct workload w[] = {
+      {.name = "reply", .samples = 1},
+      {.name = "adc", .samples = ADC_BLOCK},
+      {.name = "pairs", .samples = 2},  // last: bin still holds its frames
+  };
+  printf("%.0f baud, %.0f bytes/s\n", baud, bytes_per_s);
+  printf("%-6s %13s %13s %13s %13s %7s %15s %15s\n", "", "ascii B/smpl",
+         "binary B/smpl", "ascii smpl/s", "binary smpl/s", "gain",
+         "ascii fmt/parse", "bin enc/dec ns");
+  uint64_t bad = 0;
+  for (int i = 0; i < 3; i++) {
+    int messages = w[i].samples == ADC_BLOCK ? n / 16 : n;
+    run(&w[i], messages, ascii, bin);
+    double samples = (double)messages * w[i].samples;
+    double ab = w[i].ascii_bytes / samples, bb = w[i].binary_bytes / samples;
+    printf("%-6s %13.2f %13.2f %13.0f %13.0f %6.2fx %7.0f/%-7.0f %7.0f/%-7.0f"
+           "%s\n",
+           w[i].name, ab, bb, bytes_per_s / ab, bytes_per_s / bb, ab / bb,
+           w[i].ascii_fmt_ns, w[i].ascii_parse_ns, w[i].bin_fmt_ns,
+           w[i].bin_parse_ns, w[i].mismatches ? "  MISMATCH" : "");
+    bad += w[i].mismatches;
+  }
+
+  // noisy link: the pairs stream with bit errors
+  size_t len = w[2].binary_bytes;
+  unsigned short xs[3] = {3, 1, 4};
+  uint64_t flipped = 0;
+  if (ber > 0) {
+    for (size_t bit = (size_t)(log(erand48(xs)) / log1p(-ber)); bit < len * 8;
+         bit += 1 + (size_t)(log(erand48(xs)) / log1p(-ber))) {
+      bin[bit / 8] ^= 1 << (bit % 8);
+      flipped++;
+    }
+  }
+  struct frame_decoder d;
+  frame_decoder_init(&d);
+  struct check c = {.expect = w[2].expect, .next = n};
+  frame_decoder_feed(&d, bin, len, check_noisy, &c);
+  printf("\nbit error rate %g: %llu bits flipped, %llu of %d frames "
+         "delivered, %llu CRC errors, %llu damaged, %llu counted lost, "
+         "%llu undetected\n",
+         ber, (unsigned long long)flipped, (unsigned long long)d.frames, n,
+         (unsigned long long)d.crc_errors, (unsigned long long)d.bad,
+         (unsigned long long)d.lost, (unsigned long long)c.mismatches);
+
+  /* release resource section */
+  for (int i = 0; i < 3; i++) free(w[i].expect);
+  free(ascii);
+  free(bin);
+  return bad || c.mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
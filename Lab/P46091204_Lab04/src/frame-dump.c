@@ -0,0 +1,84 @@
+/**
+ * @file
+ * Decode a binary sensor frame stream (frame.h) and print the samples
+ *
+ * Reads a serial port, a file or stdin ("-") until end of file or Ctrl-C
+ * and prints one line per sample: time in ms, sequence number, channel and
+ * value. A serial port is put in raw mode at the given baud rate. The frame,
+ * CRC error, damaged frame and lost frame counts go to stderr at the end.
+ *
+ * Usage: frame-dump [device|file|-] [baud=115200]
+ *   ./bin/serial -b 20 | ./bin/frame-dump
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "serial_port.h"
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  (void)sig;
+  stopped = 1;
+}
+
+void print_frame(void *ctx, const struct frame *f) {
+  (void)ctx;
+  for (int i = 0; i < f->n; i++) {
+    double t = f->t_ms + (double)i * f->period_us / 1000;
+    printf("%.3f\t%u\t%s\t%g\n", t, f->seq,
+           frame_channel_names[f->s[i].channel], f->s[i].value);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : "-";
+  int fd = strcmp(path, "-") ? open(path, O_RDONLY | O_NOCTTY) : 0;
+  if (fd < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  struct termios old_term;
+  int tty = isatty(fd);
+  // a stream of frames: let the driver gather SERIAL_BATCH bytes per read
+  if (tty && serial_setup(fd, argc > 2 ? atol(argv[2]) : 115200,
+                          SERIAL_THROUGHPUT, &old_term)) {
+    perror("serial_setup");
+    exit(EXIT_FAILURE);
+  }
+  struct sigaction sa = {.sa_handler = int_handler};  // no SA_RESTART
+  sigaction(SIGINT, &sa, NULL);
+
+  struct frame_decoder d;
+  frame_decoder_init(&d);
+  uint8_t buf[4096];
+  while (!stopped) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n == 0) break;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("read");
+      break;
+    }
+    frame_decoder_feed(&d, buf, n, print_frame, NULL);
+  }
+  fflush(stdout);
+  fprintf(stderr,
+          "%llu bytes, %llu frames, %llu samples, %llu CRC errors, "
+          "%llu damaged, %llu lost\n",
+          (unsigned long long)d.bytes, (unsigned long long)d.frames,
+          (unsigned long long)d.samples, (unsigned long long)d.crc_errors,
+          (unsigned long long)d.bad, (unsigned long long)d.lost);
+
+  /* release resource section */
+  if (tty) tcsetattr(fd, TCSANOW, &old_term);
+  if (fd) close(fd);
+}
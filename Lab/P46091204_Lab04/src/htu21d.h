@@ -0,0 +1,321 @@
+/**
+ * @file
+ * HTU21D humidity / temperature sensor, no hold master mode
+ *
+ * A measurement is split in two so the caller can work while the sensor
+ * converts:
+ *   htu21d_start()    sends the measurement command and returns at once
+ *   htu21d_collect()  sleeps until the typical conversion time for the
+ *                     configured resolution has passed, then polls the read
+ *                     (the sensor NACKs its address while busy) with a short
+ *                     growing back-off until the maximum time plus a margin
+ * Instead of delay_ms(50) / delay_ms(20) per reading, a 14-bit temperature is
+ * ready in ~44 ms and a 12-bit humidity in ~14 ms, and a loop that starts the
+ * next conversion before processing the current result hides the processing
+ * time entirely.
+ *
+ * Results are read with their CRC byte and checked.
+ *
+ * The sensor is reached through mraa (htu21d_init()) or through an i2c_bus
+ * (htu21d_init_bus(), see i2c_bus.h), which reads the user register as one
+ * combined write + read and shares the bus with other threads in order.
+ *
+ * Sampling profiles trade resolution for speed by programming the
+ * resolution bits of the user register (the other bits are preserved):
+ *   HTU21D_PRECISE   RH 12 / Temp 14 bit   pair <= 66 ms
+ *   HTU21D_BALANCED  RH 10 / Temp 13 bit   pair <= 30 ms
+ *   HTU21D_FAST      RH  8 / Temp 12 bit   pair <= 16 ms
+ * htu21d_set_rate() picks the most precise profile that still sustains a
+ * requested number of temperature + humidity pairs per second.
+ *
+ * Conversion times from the datasheet (typical / max, ms):
+ *   user reg bits 7,0   RH          Temp
+ *   00                  12 bit 14/16  14 bit 44/50
+ *   01                   8 bit  2/3   12 bit 11/13
+ *   10                  10 bit  4/5   13 bit 22/25
+ *   11                  11 bit  7/8   11 bit  6/7
+ *
+ * Datasheet:
+ * https://cdn-shop.adafruit.com/datasheets/1899_HTU21D.pdf
+ */
+
+#ifndef HTU21D_H
+#define HTU21D_H
+
+#include <stdint.h>
+
+#include "mraa.h"
+#include "util.h"
+#include "i2c_bus.h"
+
+#define HTU21D_ADDRESS 0x40
+#define HTU21D_TEMPERATURE_MEASUREMENT 0xf3  // No Hold master mode
+#define HTU21D_HUMIDITY_MEASUREMENT 0xf5     // No Hold master mode
+#define HTU21D_WRITE_USER_REG 0xe6
+#define HTU21D_READ_USER_REG 0xe7
+// discard the last 2 status bits: 1111_1100
+#define HTU21D_DATA_MASK 0xfc
+// give up this long after the datasheet maximum
+#define HTU21D_TIMEOUT_MARGIN_US 20000
+
+enum htu21d_kind { HTU21D_TEMP, HTU21D_HUM };
+
+enum htu21d_profile { HTU21D_PRECISE, HTU21D_BALANCED, HTU21D_FAST };
+
+// user register resolution bits (7 and 0) of each profile
+static const uint8_t htu21d_profile_bits[] = {0x00, 0x80, 0x01};
+static const char *const htu21d_profile_names[] = {"precise", "balanced",
+                                                   "fast"};
+#define HTU21D_PROFILES 3
+#define HTU21D_RESOLUTION_BITS 0x81
+
+struct htu21d {
+  mraa_i2c_context i2c;
+  struct i2c_bus *bus;  // used instead of i2c when not NULL
+  uint8_t user_reg;
+  uint32_t typ_us[2], max_us[2];  // conversion time, indexed by htu21d_kind
+  int pending;                    // kind being converted, -1 if idle
+  uint64_t t_start;
+  uint64_t reads, polls, crc_errors, timeouts;
+};
+
+/** typical / max conversion times in us, indexed by user reg bits 7,0 */
+static const uint32_t htu21d_times_us[4][2][2] = {
+    // {temp typ, temp max}, {RH typ, RH max}
+    {{44000, 50000}, {14000, 16000}},
+    {{11000, 13000}, {2000, 3000}},
+    {{22000, 25000}, {4000, 5000}},
+    {{6000, 7000}, {7000, 8000}},
+};
+
+/**
+ * Index of the resolution setting in a user register value
+ */
+int htu21d_resolution_index(uint8_t user_reg) {
+  return ((user_reg >> 6) & 2) | (user_reg & 1);
+}
+
+void htu21d_update_times(struct htu21d *dev) {
+  int r = htu21d_resolution_index(dev->user_reg);
+  for (int k = 0; k < 2; k++) {
+    dev->typ_us[k] = htu21d_times_us[r][k][0];
+    dev->max_us[k] = htu21d_times_us[r][k][1];
+  }
+}
+
+/**
+ * CRC-8 of the datasheet, polynomial x^8 + x^5 + x^4 + 1, initial value 0
+ */
+uint8_t htu21d_crc(const uint8_t *data, int n) {
+  uint8_t crc = 0;
+  for (int i = 0; i < n; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++)
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+  }
+  return crc;
+}
+
+/**
+ * Write n bytes to the sensor, return 0 on success
+ */
+int htu21d_write(struct htu21d *dev, const uint8_t *buf, int n) {
+  if (dev->bus)
+    return i2c_bus_write_read(dev->bus, HTU21D_ADDRESS, buf, n, NULL, 0);
+  if (n == 1) return mraa_i2c_write_byte(dev->i2c, buf[0]) != MRAA_SUCCESS;
+  return mraa_i2c_write_byte_data(dev->i2c, buf[1], buf[0]) != MRAA_SUCCESS;
+}
+
+/**
+ * Read n bytes, return 0 on success (the sensor NACKs while converting)
+ */
+int htu21d_read(struct htu21d *dev, uint8_t *buf, int n) {
+  if (dev->bus)
+    return i2c_bus_write_read(dev->bus, HTU21D_ADDRESS, NULL, 0, buf, n);
+  return mraa_i2c_read(dev->i2c, buf, n) != n;
+}
+
+/**
+ * Read the user register and derive the conversion times, return 0 on success
+ */
+int htu21d_read_user_reg(struct htu21d *dev) {
+  uint8_t cmd = HTU21D_READ_USER_REG, reg;
+  if (dev->bus) {
+    if (i2c_bus_write_read(dev->bus, HTU21D_ADDRESS, &cmd, 1, &reg, 1))
+      return -1;
+  } else if (htu21d_write(dev, &cmd, 1) || htu21d_read(dev, &reg, 1)) {
+    return -1;
+  }
+  dev->user_reg = reg;
+  htu21d_update_times(dev);
+  return 0;
+}
+
+/**
+ * Max time of one temperature + humidity pair with profile p, in us
+ */
+uint32_t htu21d_profile_pair_us(enum htu21d_profile p) {
+  int r = htu21d_resolution_index(htu21d_profile_bits[p]);
+  return htu21d_times_us[r][HTU21D_TEMP][1] + htu21d_times_us[r][HTU21D_HUM][1];
+}
+
+/**
+ * Profile the sensor currently runs, -1 if it matches none
+ */
+int htu21d_get_profile(const struct htu21d *dev) {
+  for (int p = 0; p < HTU21D_PROFILES; p++)
+    if ((dev->user_reg & HTU21D_RESOLUTION_BITS) == htu21d_profile_bits[p])
+      return p;
+  return -1;
+}
+
+/**
+ * Program the resolution bits for profile p, return 0 on success
+ *
+ * Read-modify-write: the heater, OTP and reserved bits stay as they are. The
+ * register is read back, so dev->user_reg and the waits match the sensor.
+ * The sensor does not answer while converting, so call it with no conversion
+ * pending.
+ */
+int htu21d_set_profile(struct htu21d *dev, enum htu21d_profile p) {
+  if (dev->pending >= 0 || htu21d_read_user_reg(dev)) return -1;
+  uint8_t reg =
+      (dev->user_reg & ~HTU21D_RESOLUTION_BITS) | htu21d_profile_bits[p];
+  if (reg == dev->user_reg) return 0;
+  uint8_t buf[2] = {HTU21D_WRITE_USER_REG, reg};
+  if (htu21d_write(dev, buf, 2)) return -1;
+  if (htu21d_read_user_reg(dev)) return -1;
+  return htu21d_get_profile(dev) == (int)p ? 0 : -1;
+}
+
+/**
+ * Most precise profile whose pair time fits 1 / pairs_per_s
+ *
+ * A rate that no profile sustains gets HTU21D_FAST.
+ */
+enum htu21d_profile htu21d_profile_for_rate(double pairs_per_s) {
+  for (int p = HTU21D_PRECISE; p < HTU21D_FAST; p++)
+    if (pairs_per_s <= 0 || htu21d_profile_pair_us(p) * pairs_per_s <= 1e6)
+      return p;
+  return HTU21D_FAST;
+}
+
+/**
+ * Switch to the profile for pairs_per_s if it differs, return 0 on success
+ */
+int htu21d_set_rate(struct htu21d *dev, double pairs_per_s) {
+  enum htu21d_profile p = htu21d_profile_for_rate(pairs_per_s);
+  if (htu21d_get_profile(dev) == (int)p) return 0;
+  return htu21d_set_profile(dev, p);
+}
+
+/**
+ * Open the sensor on bus, return 0 on success
+ */
+int htu21d_init(struct htu21d *dev, int bus) {
+  dev->bus = NULL;
+  dev->pending = -1;
+  dev->reads = dev->polls = dev->crc_errors = dev->timeouts = 0;
+  dev->user_reg = 0x02;  // power-on default: RH 12 bit / Temp 14 bit
+  htu21d_update_times(dev);
+  if (!(dev->i2c = mraa_i2c_init(bus))) return -1;
+  if (mraa_i2c_address(dev->i2c, HTU21D_ADDRESS) != MRAA_SUCCESS) return -1;
+  return htu21d_read_user_reg(dev);
+}
+
+/**
+ * Use the sensor through an open i2c_bus, return 0 on success
+ */
+int htu21d_init_bus(struct htu21d *dev, struct i2c_bus *bus) {
+  dev->i2c = NULL;
+  dev->bus = bus;
+  dev->pending = -1;
+  dev->reads = dev->polls = dev->crc_errors = dev->timeouts = 0;
+  dev->user_reg = 0x02;
+  htu21d_update_times(dev);
+  return htu21d_read_user_reg(dev);
+}
+
+/**
+ * Start a conversion, return 0 on success
+ *
+ * A conversion still pending is abandoned; its result is never read.
+ */
+int htu21d_start(struct htu21d *dev, enum htu21d_kind kind) {
+  uint8_t cmd = kind == HTU21D_TEMP ? HTU21D_TEMPERATURE_MEASUREMENT
+                                    : HTU21D_HUMIDITY_MEASUREMENT;
+  dev->pending = -1;
+  if (htu21d_write(dev, &cmd, 1)) return -1;
+  dev->t_start = monotonic_ns();
+  dev->pending = kind;
+  return 0;
+}
+
+/**
+ * Try once to read the pending conversion into raw (status bits cleared)
+ *
+ * Does not wait. Return 0 on success, 1 if the sensor is still converting,
+ * -1 on timeout, CRC mismatch or if nothing is pending.
+ */
+int htu21d_try_collect(struct htu21d *dev, uint16_t *raw) {
+  if (dev->pending < 0) return -1;
+  int kind = dev->pending;
+  uint8_t buf[3];
+  dev->polls++;
+  if (htu21d_read(dev, buf, 3)) {  // NACKed: still converting
+    uint64_t give_up = dev->t_start +
+                       (dev->max_us[kind] + HTU21D_TIMEOUT_MARGIN_US) * 1000ull;
+    if (monotonic_ns() <= give_up) return 1;
+    dev->pending = -1;
+    dev->timeouts++;
+    return -1;
+  }
+  dev->pending = -1;
+  dev->reads++;
+  if (htu21d_crc(buf, 2) != buf[2]) {
+    dev->crc_errors++;
+    return -1;
+  }
+  *raw = (buf[0] << 8) + (buf[1] & HTU21D_DATA_MASK);
+  return 0;
+}
+
+/**
+ * Wait for the pending conversion and read it into raw (status bits cleared)
+ *
+ * Return 0 on success, -1 on timeout, CRC mismatch or if nothing is pending.
+ */
+int htu21d_collect(struct htu21d *dev, uint16_t *raw) {
+  if (dev->pending < 0) return -1;
+  uint64_t ready = dev->t_start + dev->typ_us[dev->pending] * 1000ull;
+  uint64_t now = monotonic_ns();
+  if (now < ready) delay_ns(ready - now);
+
+  long backoff_ns = 250000;
+  int ret;
+  while ((ret = htu21d_try_collect(dev, raw)) == 1) {
+    delay_ns(backoff_ns);
+    if (backoff_ns < 2000000) backoff_ns *= 2;
+  }
+  return ret;
+}
+
+/**
+ * Start and collect one conversion
+ */
+int htu21d_measure(struct htu21d *dev, enum htu21d_kind kind, uint16_t *raw) {
+  if (htu21d_start(dev, kind)) return -1;
+  return htu21d_collect(dev, raw);
+}
+
+double htu21d_temperature(uint16_t raw) {
+  return -46.85 + 175.72 * raw / (1 << 16);
+}
+
+double htu21d_humidity(uint16_t raw) { return -6.0 + 125.0 * raw / (1 << 16); }
+
+void htu21d_close(struct htu21d *dev) {
+  if (dev->i2c) mraa_i2c_stop(dev->i2c);
+}
+
+#endif
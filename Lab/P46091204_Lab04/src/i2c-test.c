@@ -0,0 +1,130 @@
+/**
+ * @file
+ * Exercise the I2C transport with several clients on one bus
+ *
+ * Writes a pattern into registers 0..NREGS-1 of the device, then every
+ * thread reads registers back as "write register pointer, read value"
+ * transactions, batch transactions per i2c_bus_transfer(), and checks the
+ * values. Prints the transfer rate and the bus latency summary.
+ *
+ * Works against any device whose registers can be written, e.g. the
+ * i2c-stub module:
+ *   sudo modprobe i2c-stub chip_addr=0x40
+ *   i2cdetect -l          # find the N of "SMBus stub driver"
+ *   sudo ./bin/i2c-test N 0x40 4 1000 8
+ *
+ * Usage: i2c-test <bus> [address=0x40] [threads=4] [batches=1000] [batch=8]
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "i2c_bus.h"
+
+#define NREGS 16
+#define MAX_BATCH 32
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+struct client {
+  pthread_t thread;
+  struct i2c_bus *bus;
+  uint16_t addr;
+  int id, batches, batch;
+  uint64_t done, mismatches, errors;
+};
+
+uint8_t pattern(int reg) { return 0xa5 ^ (reg * 37); }
+
+void *client_thread(void *arg) {
+  struct client *c = arg;
+  uint8_t regs[MAX_BATCH], vals[MAX_BATCH];
+  struct i2c_txn t[MAX_BATCH];
+  for (int b = 0; b < c->batches && !stopped; b++) {
+    for (int i = 0; i < c->batch; i++) {
+      regs[i] = (c->id + b + i) % NREGS;
+      t[i] = (struct i2c_txn){.addr = c->addr,
+                              .wbuf = &regs[i],
+                              .wlen = 1,
+                              .rbuf = &vals[i],
+                              .rlen = 1};
+    }
+    i2c_bus_transfer(c->bus, t, c->batch);
+    for (int i = 0; i < c->batch; i++) {
+      if (t[i].status)
+        c->errors++;
+      else if (vals[i] != pattern(regs[i]))
+        c->mismatches++;
+      c->done++;
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s <bus> [address] [threads] [batches] [batch]\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  int n = atoi(argv[1]);
+  uint16_t addr = argc > 2 ? strtol(argv[2], NULL, 0) : 0x40;
+  int nthreads = argc > 3 ? atoi(argv[3]) : 4;
+  int batches = argc > 4 ? atoi(argv[4]) : 1000;
+  int batch = argc > 5 ? atoi(argv[5]) : 8;
+  if (nthreads < 1) nthreads = 1;
+  if (batch < 1) batch = 1;
+  if (batch > MAX_BATCH) batch = MAX_BATCH;
+
+  struct i2c_bus bus;
+  if (i2c_bus_open(&bus, n)) {
+    perror("Cannot open the I2C bus. Did you run with sudo?");
+    exit(EXIT_FAILURE);
+  }
+  signal(SIGINT, int_handler);
+
+  for (int reg = 0; reg < NREGS; reg++) {
+    uint8_t buf[2] = {reg, pattern(reg)};
+    int ret = i2c_bus_write_read(&bus, addr, buf, 2, NULL, 0);
+    if (ret) {
+      fprintf(stderr, "Cannot write register %d of 0x%02x: %s\n", reg, addr,
+              strerror(-ret));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct client *clients = calloc(nthreads, sizeof(*clients));
+  uint64_t t0 = monotonic_ns();
+  for (int i = 0; i < nthreads; i++) {
+    clients[i] = (struct client){
+        .bus = &bus, .addr = addr, .id = i, .batches = batches, .batch = batch};
+    pthread_create(&clients[i].thread, NULL, client_thread, &clients[i]);
+  }
+  uint64_t done = 0, mismatches = 0, errors = 0;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(clients[i].thread, NULL);
+    done += clients[i].done;
+    mismatches += clients[i].mismatches;
+    errors += clients[i].errors;
+  }
+  double s = (monotonic_ns() - t0) / 1e9;
+
+  printf("%d threads: %llu reads in %.3f s, %.0f reads/s, %llu wrong, "
+         "%llu failed\n",
+         nthreads, (unsigned long long)done, s, done / s,
+         (unsigned long long)mismatches, (unsigned long long)errors);
+  i2c_bus_print_stats(stdout, &bus);
+
+  /* release resource section */
+  free(clients);
+  i2c_bus_close(&bus);
+  return mismatches || errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,283 @@
+/**
+ * @file
+ * I2C transport on /dev/i2c-N with combined transfers and an ordered queue
+ *
+ * A transaction is an optional write followed by an optional read on one
+ * address. i2c_bus_transfer() submits a batch of transactions as a single
+ * I2C_RDWR ioctl (repeated start between messages, one stop at the end), so
+ * "write register pointer, read value" is one bus transaction and one
+ * syscall instead of two of each.
+ *
+ * Several threads may share a bus. Each batch takes a ticket and waits for
+ * its turn, so batches reach the bus in submission order and never
+ * interleave. An ioctl interrupted by a signal (EINTR) or losing arbitration
+ * (EAGAIN) is retried. Each transaction records how long it queued and how
+ * long the transfer took.
+ *
+ * Adapters without plain I2C support, such as the i2c-stub test module, only
+ * speak SMBus. There the common shapes are mapped to SMBus transfers:
+ *   write 1                  send byte
+ *   write 2                  write byte data
+ *   write 1 + n > 2          write I2C block data
+ *   read n                   n receive bytes
+ *   write 1 + read 1 / 2     read byte / word data
+ *   write 1 + read n > 2     read I2C block data
+ * and each transaction is its own transfer. To test without hardware:
+ *   sudo modprobe i2c-stub chip_addr=0x40
+ *   sudo ./bin/i2c-test <N of the stub's /dev/i2c-N> 0x40
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// the kernel rejects more messages per I2C_RDWR (I2C_RDWR_IOCTL_MAX_MSGS)
+#define I2C_BUS_MAX_MSGS 42
+#define I2C_BUS_RETRIES 3
+
+struct i2c_txn {
+  uint16_t addr;
+  const uint8_t *wbuf;
+  uint16_t wlen;  // 0: no write
+  uint8_t *rbuf;
+  uint16_t rlen;  // 0: no read
+  int status;     // 0 or -errno, filled in by i2c_bus_transfer()
+  uint64_t queued_ns, bus_ns;
+};
+
+/** Latency summary over all transactions of a bus */
+struct i2c_bus_stats {
+  uint64_t txns, batches, errors, retries;
+  uint64_t queued_max_ns, bus_min_ns, bus_max_ns;
+  uint64_t queued_sum_ns, bus_sum_ns;
+};
+
+struct i2c_bus {
+  int fd;
+  int smbus_only;
+  pthread_mutex_t lock;
+  pthread_cond_t turn;
+  uint64_t next_ticket, serving;
+  struct i2c_bus_stats stats;  // guarded by lock
+};
+
+/**
+ * Open /dev/i2c-<n>, return 0 on success (errno set otherwise)
+ */
+int i2c_bus_open(struct i2c_bus *bus, int n) {
+  char path[32];
+  snprintf(path, sizeof(path), "/dev/i2c-%d", n);
+  memset(bus, 0, sizeof(*bus));
+  if ((bus->fd = open(path, O_RDWR | O_CLOEXEC)) < 0) return -1;
+  unsigned long funcs = 0;
+  if (ioctl(bus->fd, I2C_FUNCS, &funcs) < 0) {
+    close(bus->fd);
+    return -1;
+  }
+  bus->smbus_only = !(funcs & I2C_FUNC_I2C);
+  pthread_mutex_init(&bus->lock, NULL);
+  pthread_cond_init(&bus->turn, NULL);
+  return 0;
+}
+
+void i2c_bus_close(struct i2c_bus *bus) {
+  close(bus->fd);
+  pthread_cond_destroy(&bus->turn);
+  pthread_mutex_destroy(&bus->lock);
+}
+
+/**
+ * ioctl() that retries EINTR and, a few times, EAGAIN; return 0 or -errno
+ */
+int i2c_bus_ioctl(struct i2c_bus *bus, unsigned long req, void *arg,
+                  uint64_t *retries) {
+  int again = 0;
+  for (;;) {
+    if (ioctl(bus->fd, req, arg) >= 0) return 0;
+    if (errno == EINTR || (errno == EAGAIN && again++ < I2C_BUS_RETRIES)) {
+      (*retries)++;
+      continue;
+    }
+    return -errno;
+  }
+}
+
+int i2c_bus_smbus(struct i2c_bus *bus, uint8_t rw, uint8_t cmd, int size,
+                  union i2c_smbus_data *data, uint64_t *retries) {
+  struct i2c_smbus_ioctl_data args = {
+      .read_write = rw, .command = cmd, .size = size, .data = data};
+  return i2c_bus_ioctl(bus, I2C_SMBUS, &args, retries);
+}
+
+/**
+ * Run one transaction as SMBus transfers, return 0 or -errno
+ */
+int i2c_bus_smbus_txn(struct i2c_bus *bus, struct i2c_txn *t,
+                      uint64_t *retries) {
+  int ret = i2c_bus_ioctl(bus, I2C_SLAVE, (void *)(uintptr_t)t->addr, retries);
+  if (ret) return ret;
+  union i2c_smbus_data d;
+  if (t->wlen == 0) {  // not one transfer on the wire, but what the stub does
+    for (int i = 0; i < t->rlen; i++) {
+      ret = i2c_bus_smbus(bus, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &d, retries);
+      if (ret) return ret;
+      t->rbuf[i] = d.byte;
+    }
+    return 0;
+  }
+  if ((t->rlen && t->wlen != 1) ||
+      t->rlen > I2C_SMBUS_BLOCK_MAX || t->wlen > I2C_SMBUS_BLOCK_MAX + 1)
+    return -EOPNOTSUPP;
+  uint8_t cmd = t->wbuf[0];
+  if (t->rlen == 0) {
+    if (t->wlen == 1)
+      return i2c_bus_smbus(bus, I2C_SMBUS_WRITE, cmd, I2C_SMBUS_BYTE, NULL,
+                           retries);
+    if (t->wlen == 2) {
+      d.byte = t->wbuf[1];
+      return i2c_bus_smbus(bus, I2C_SMBUS_WRITE, cmd, I2C_SMBUS_BYTE_DATA, &d,
+                           retries);
+    }
+    d.block[0] = t->wlen - 1;
+    memcpy(d.block + 1, t->wbuf + 1, t->wlen - 1);
+    return i2c_bus_smbus(bus, I2C_SMBUS_WRITE, cmd, I2C_SMBUS_I2C_BLOCK_DATA,
+                         &d, retries);
+  }
+  if (t->rlen == 1) {
+    ret = i2c_bus_smbus(bus, I2C_SMBUS_READ, cmd, I2C_SMBUS_BYTE_DATA, &d,
+                        retries);
+    if (!ret) t->rbuf[0] = d.byte;
+  } else if (t->rlen == 2) {  // SMBus words are little endian on the wire
+    ret = i2c_bus_smbus(bus, I2C_SMBUS_READ, cmd, I2C_SMBUS_WORD_DATA, &d,
+                        retries);
+    if (!ret) {
+      t->rbuf[0] = d.word & 0xff;
+      t->rbuf[1] = d.word >> 8;
+    }
+  } else {
+    d.block[0] = t->rlen;
+    ret = i2c_bus_smbus(bus, I2C_SMBUS_READ, cmd, I2C_SMBUS_I2C_BLOCK_DATA, &d,
+                        retries);
+    if (!ret) memcpy(t->rbuf, d.block + 1, t->rlen);
+  }
+  return ret;
+}
+
+/**
+ * Run n transactions in order, as one I2C_RDWR where possible
+ *
+ * Blocks until every batch submitted earlier has finished. Return 0 if all
+ * succeeded, otherwise the first -errno; t[i].status has the per-transaction
+ * result (with I2C_RDWR a failure fails the whole ioctl, so every
+ * transaction of that ioctl gets the same status).
+ */
+int i2c_bus_transfer(struct i2c_bus *bus, struct i2c_txn *t, int n) {
+  uint64_t t_submit = monotonic_ns();
+  pthread_mutex_lock(&bus->lock);
+  uint64_t ticket = bus->next_ticket++;
+  while (bus->serving != ticket) pthread_cond_wait(&bus->turn, &bus->lock);
+  pthread_mutex_unlock(&bus->lock);
+
+  // our turn: nobody else touches the fd until serving moves on
+  uint64_t retries = 0;
+  int ret = 0;
+  uint64_t t_end;
+  if (bus->smbus_only) {
+    for (int i = 0; i < n; i++) {
+      uint64_t t0 = monotonic_ns();
+      t[i].status = i2c_bus_smbus_txn(bus, &t[i], &retries);
+      t_end = monotonic_ns();
+      t[i].queued_ns = t0 - t_submit;
+      t[i].bus_ns = t_end - t0;
+      if (t[i].status && !ret) ret = t[i].status;
+    }
+  } else {
+    for (int first = 0; first < n;) {
+      struct i2c_msg msgs[I2C_BUS_MAX_MSGS];
+      int nmsgs = 0, last = first;
+      while (last < n && nmsgs + (t[last].wlen > 0) + (t[last].rlen > 0) <=
+                             I2C_BUS_MAX_MSGS) {
+        if (t[last].wlen)
+          msgs[nmsgs++] = (struct i2c_msg){.addr = t[last].addr,
+                                           .flags = 0,
+                                           .len = t[last].wlen,
+                                           .buf = (uint8_t *)t[last].wbuf};
+        if (t[last].rlen)
+          msgs[nmsgs++] = (struct i2c_msg){.addr = t[last].addr,
+                                           .flags = I2C_M_RD,
+                                           .len = t[last].rlen,
+                                           .buf = t[last].rbuf};
+        last++;
+      }
+      uint64_t t0 = monotonic_ns();
+      struct i2c_rdwr_ioctl_data data = {.msgs = msgs, .nmsgs = nmsgs};
+      int status = i2c_bus_ioctl(bus, I2C_RDWR, &data, &retries);
+      t_end = monotonic_ns();
+      for (int i = first; i < last; i++) {
+        t[i].status = status;
+        t[i].queued_ns = t0 - t_submit;
+        t[i].bus_ns = (t_end - t0) / (last - first);
+      }
+      if (status && !ret) ret = status;
+      first = last;
+    }
+  }
+
+  pthread_mutex_lock(&bus->lock);
+  struct i2c_bus_stats *st = &bus->stats;
+  st->batches++;
+  st->retries += retries;
+  for (int i = 0; i < n; i++) {
+    if (st->txns++ == 0 || t[i].bus_ns < st->bus_min_ns)
+      st->bus_min_ns = t[i].bus_ns;
+    if (t[i].bus_ns > st->bus_max_ns) st->bus_max_ns = t[i].bus_ns;
+    if (t[i].queued_ns > st->queued_max_ns) st->queued_max_ns = t[i].queued_ns;
+    st->queued_sum_ns += t[i].queued_ns;
+    st->bus_sum_ns += t[i].bus_ns;
+    st->errors += t[i].status != 0;
+  }
+  bus->serving++;
+  pthread_cond_broadcast(&bus->turn);
+  pthread_mutex_unlock(&bus->lock);
+  return ret;
+}
+
+/**
+ * Write wlen bytes then read rlen bytes from addr in one transaction
+ */
+int i2c_bus_write_read(struct i2c_bus *bus, uint16_t addr, const uint8_t *wbuf,
+                       uint16_t wlen, uint8_t *rbuf, uint16_t rlen) {
+  struct i2c_txn t = {
+      .addr = addr, .wbuf = wbuf, .wlen = wlen, .rbuf = rbuf, .rlen = rlen};
+  return i2c_bus_transfer(bus, &t, 1);
+}
+
+void i2c_bus_print_stats(FILE *f, struct i2c_bus *bus) {
+  pthread_mutex_lock(&bus->lock);
+  struct i2c_bus_stats st = bus->stats;
+  pthread_mutex_unlock(&bus->lock);
+  double n = st.txns ? st.txns : 1;
+  fprintf(f,
+          "%llu transactions in %llu batches, %llu errors, %llu retries (%s)\n"
+          "bus time min %.1f mean %.1f max %.1f us, "
+          "queued mean %.1f max %.1f us\n",
+          (unsigned long long)st.txns, (unsigned long long)st.batches,
+          (unsigned long long)st.errors, (unsigned long long)st.retries,
+          bus->smbus_only ? "SMBus emulation" : "I2C_RDWR",
+          st.bus_min_ns / 1e3, st.bus_sum_ns / n / 1e3, st.bus_max_ns / 1e3,
+          st.queued_sum_ns / n / 1e3, st.queued_max_ns / 1e3);
+}
+
+#endif
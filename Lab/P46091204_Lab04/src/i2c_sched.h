@@ -0,0 +1,169 @@
+/**
+ * @file
+ * Interleave conversions of several I2C devices on one bus
+ *
+ * Most sensors are slow because they convert, not because of the bus: an
+ * HTU21D needs up to 50 ms for a 5-byte exchange. Instead of sleeping through
+ * each conversion, the scheduler keeps one conversion running on every device
+ * and always serves the device whose next action (start a conversion, or try
+ * to collect its result) is due first, sleeping only when nothing is due.
+ * The combined rate then approaches the sum of the rates each device reaches
+ * alone.
+ *
+ * A device is described by two callbacks:
+ *   start(ctx)    start the next conversion, return the ns to wait after it
+ *                 returned before the first collect attempt, or < 0 on error
+ *   collect(ctx)  fetch the result without waiting: 0 done, 1 not ready yet
+ *                 (try again after poll_ns), -1 failed
+ * A device that alternates several quantities (temperature, humidity)
+ * switches between them in its callbacks; every collected result counts.
+ */
+
+#ifndef I2C_SCHED_H
+#define I2C_SCHED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "util.h"
+#include "i2c_bus.h"
+
+#define I2C_SCHED_RETRY_NS 10000000  // after a failed start
+
+struct i2c_sched_dev {
+  const char *name;
+  void *ctx;
+  int64_t (*start)(void *ctx);
+  int (*collect)(void *ctx);
+  uint64_t period_ns;  // between conversion starts, 0: back to back
+  uint64_t poll_ns;    // between collect attempts while not ready
+
+  int converting;
+  uint64_t due_ns;      // time of the next action
+  uint64_t next_start;  // schedule of conversion starts when periodic
+  uint64_t t_conv;      // start of the running conversion
+  uint64_t results, errors, polls, conv_sum_ns;
+};
+
+struct i2c_sched {
+  struct i2c_sched_dev *dev;
+  int n;
+  struct i2c_bus *bus;
+  uint64_t t0, sleep_ns;
+  uint64_t bus_ns0;  // bus time already used before the scheduler started
+};
+
+void i2c_sched_init(struct i2c_sched *s, struct i2c_bus *bus,
+                    struct i2c_sched_dev *dev, int n) {
+  s->dev = dev;
+  s->n = n;
+  s->bus = bus;
+  s->t0 = monotonic_ns();
+  s->sleep_ns = 0;
+  pthread_mutex_lock(&bus->lock);
+  s->bus_ns0 = bus->stats.bus_sum_ns;
+  pthread_mutex_unlock(&bus->lock);
+  for (int i = 0; i < n; i++) {
+    struct i2c_sched_dev *d = &dev[i];
+    d->converting = 0;
+    d->due_ns = d->next_start = s->t0;
+    d->results = d->errors = d->polls = d->conv_sum_ns = 0;
+  }
+}
+
+/**
+ * Perform the action that is due first, or sleep until it is due
+ *
+ * Return 1 if an action was performed, 0 after sleeping (possibly cut short
+ * by a signal, so the caller can check its stop flag).
+ */
+int i2c_sched_step(struct i2c_sched *s) {
+  struct i2c_sched_dev *d = &s->dev[0];
+  for (int i = 1; i < s->n; i++)
+    if (s->dev[i].due_ns < d->due_ns) d = &s->dev[i];
+
+  uint64_t now = monotonic_ns();
+  if (d->due_ns > now) {
+    struct timespec ts = {.tv_sec = d->due_ns / 1000000000,
+                          .tv_nsec = d->due_ns % 1000000000};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    s->sleep_ns += monotonic_ns() - now;
+    return 0;
+  }
+
+  if (!d->converting) {
+    d->t_conv = now;
+    int64_t wait_ns = d->start(d->ctx);
+    if (wait_ns < 0) {
+      d->errors++;
+      d->due_ns = now + I2C_SCHED_RETRY_NS;
+    } else {
+      d->converting = 1;
+      d->due_ns = monotonic_ns() + wait_ns;
+    }
+    return 1;
+  }
+
+  int ret = d->collect(d->ctx);
+  now = monotonic_ns();
+  if (ret == 1) {
+    d->polls++;
+    d->due_ns = now + d->poll_ns;
+    return 1;
+  }
+  d->converting = 0;
+  if (ret == 0) {
+    d->results++;
+    d->conv_sum_ns += now - d->t_conv;
+  } else {
+    d->errors++;
+  }
+  if (d->period_ns) {
+    d->next_start += d->period_ns;
+    if (d->next_start < now) d->next_start = now;  // behind: do not burst
+    d->due_ns = d->next_start;
+  } else {
+    d->due_ns = now;
+  }
+  return 1;
+}
+
+/**
+ * Per-device rates and bus utilisation since i2c_sched_init()
+ *
+ * "alone" is the rate the device would reach back to back without sharing
+ * the bus, estimated from its mean start-to-result time.
+ */
+void i2c_sched_print_stats(FILE *f, const struct i2c_sched *s) {
+  uint64_t now = monotonic_ns();
+  double span = (now - s->t0) / 1e9;
+  pthread_mutex_lock(&s->bus->lock);
+  uint64_t bus_ns = s->bus->stats.bus_sum_ns - s->bus_ns0;
+  pthread_mutex_unlock(&s->bus->lock);
+
+  fprintf(f, "%-10s %9s %9s %9s %10s %8s %7s\n", "device", "results", "rate/s",
+          "alone/s", "conv [ms]", "polls", "errors");
+  double total = 0, alone_total = 0;
+  for (int i = 0; i < s->n; i++) {
+    const struct i2c_sched_dev *d = &s->dev[i];
+    double conv = d->results ? d->conv_sum_ns / 1e6 / d->results : 0;
+    double rate = span > 0 ? d->results / span : 0;
+    double alone = conv > 0 ? 1e3 / conv : 0;
+    if (d->period_ns && alone > 1e9 / d->period_ns) alone = 1e9 / d->period_ns;
+    total += rate;
+    alone_total += alone;
+    fprintf(f, "%-10s %9llu %9.2f %9.2f %10.2f %8.2f %7llu\n", d->name,
+            (unsigned long long)d->results, rate, alone, conv,
+            d->results ? (double)d->polls / d->results : 0,
+            (unsigned long long)d->errors);
+  }
+  fprintf(f,
+          "total %.2f results/s (%.0f%% of the sum of standalone rates), "
+          "bus busy %.2f%%, asleep %.1f%% of %.2f s\n",
+          total, alone_total > 0 ? 100 * total / alone_total : 0,
+          span > 0 ? 100 * bus_ns / 1e9 / span : 0,
+          span > 0 ? 100 * s->sleep_ns / 1e9 / span : 0, span);
+}
+
+#endif
@@ -0,0 +1,299 @@
+/**
+ * @file
+ * Line editor (line_edit.h) cost per key and bytes on the link
+ *
+ * First, CPU time per key typed into lines of growing length, for the gap
+ * buffer against the copy of the whole line per key that the old
+ * my_getline() of 4-3 did, typing at the end and at the start.
+ *
+ * Then the editor runs in a thread on the slave of a pty pair, as 4-3 runs
+ * it on the serial port, and the benchmark types on the master one key (or
+ * escape sequence) at a time, waiting for the redraw before the next key.
+ * For each workload it reports the bytes the editor sent per key, what a
+ * redraw of the whole line ("\r", prompt, line, ESC[K, cursor back) would
+ * have sent, the time that takes on the serial link at the given baud rate
+ * (10 bits per byte), and the round trip through the pty.
+ *
+ * Usage: line-edit-bench [line_length=200] [baud=115200]
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+
+#include "util.h"
+#include "line_edit.h"
+
+#define PROMPT "input> "
+#define MAX_KEYS 100000
+
+struct script {
+  const char *name;
+  const char *keys[MAX_KEYS];  // one key or escape sequence each
+  int n;
+};
+
+volatile char sink;
+
+int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * What 4-3 did per key: copy the line aside and back with the key inserted
+ */
+void copy_insert(char *line, char *tmp, int *len, int *index, char c) {
+  for (int i = 0; i < *len; i++) tmp[i] = line[i];
+  (*len)++;
+  for (int i = 0; i < *index; i++) line[i] = tmp[i];
+  line[*index] = c;
+  for (int i = *index + 1; i < *len; i++) line[i] = tmp[i - 1];
+  (*index)++;
+}
+
+/**
+ * ns per key typing lines of n keys, at the end or (at_start) the start
+ *
+ * At the start, the gap buffer time includes queueing the text after the
+ * cursor for the redraw, which the copy did not do.
+ */
+void cpu_cost(int n, int at_start, double *gap_ns, double *copy_ns) {
+  int reps = n < 100000 ? 100000 / n : 1;
+  struct line_edit le;
+  line_edit_init(&le, -1);
+  uint64_t t0 = monotonic_ns();
+  for (int r = 0; r < reps; r++) {
+    for (int i = 0; i < n; i++) {
+      line_edit_key(&le, 'a' + i % 26);
+      if (at_start) line_edit_key(&le, 0x01);  // Ctrl-A
+      le.out_len = 0;  // the screen output is not measured here
+    }
+    line_edit_key(&le, '\r');
+  }
+  uint64_t t1 = monotonic_ns();
+  line_edit_free(&le);
+
+  char *line = malloc(n + 1), *tmp = malloc(n + 1);
+  uint64_t t2 = monotonic_ns();
+  for (int r = 0; r < reps; r++) {
+    int len = 0, index = 0;
+    for (int i = 0; i < n; i++) {
+      copy_insert(line, tmp, &len, &index, 'a' + i % 26);
+      if (at_start) index = 0;
+    }
+    sink = line[n / 2];
+  }
+  uint64_t t3 = monotonic_ns();
+  free(line);
+  free(tmp);
+  *gap_ns = (double)(t1 - t0) / n / reps;
+  *copy_ns = (double)(t3 - t2) / n / reps;
+}
+
+void add(struct script *s, const char *key) {
+  if (s->n < MAX_KEYS) s->keys[s->n++] = key;
+}
+
+void type(struct script *s, const char *text) {
+  static char keys[128][2];  // each printable character as a string
+  for (; *text; text++) {
+    int c = *text & 0x7f;
+    keys[c][0] = c;
+    add(s, keys[c]);
+  }
+}
+
+/**
+ * A line of n characters of made-up words
+ */
+void words(char *out, int n, int seed) {
+  static const char *const w[] = {"set", "led", "on", "off", "temp",
+                                  "hum", "rate", "0", "1", "2"};
+  int k = 0;
+  for (int i = 0; k < n; i++) {
+    const char *s = w[(i * 7 + seed) % 10];
+    while (*s && k < n) out[k++] = *s++;
+    if (k < n) out[k++] = ' ';
+  }
+  out[n] = '\0';
+}
+
+/**
+ * Keys per line and how many bytes a whole-line redraw would send for them
+ */
+uint64_t full_redraw_bytes(const struct script *s) {
+  struct line_edit le;
+  line_edit_init(&le, -1);
+  uint64_t bytes = 0;
+  for (int i = 0; i < s->n; i++) {
+    for (const char *k = s->keys[i]; *k; k++) line_edit_key(&le, *k);
+    if (le.out_len == 0) continue;
+    if (le.done) {
+      bytes += le.out_len + strlen(PROMPT);  // the same "\r\n", the prompt
+    } else {
+      size_t len = line_edit_len(&le), back = len - le.gap;
+      bytes += 1 + strlen(PROMPT) + len + 3;
+      if (back)
+        bytes += back <= 3 ? (int)back : snprintf(NULL, 0, "\033[%zuD", back);
+    }
+    le.out_len = 0;
+  }
+  line_edit_free(&le);
+  return bytes;
+}
+
+struct line_edit editor;
+
+/**
+ * 4-3's loop on the slave: prompt, edit a line, until the pty closes
+ */
+void *edit_loop(void *arg) {
+  (void)arg;
+  char *line;
+  do {
+    line_edit_put(&editor, PROMPT, strlen(PROMPT));
+  } while (line_edit_getline(&editor, &line) >= 0);
+  return NULL;
+}
+
+/**
+ * Type a script on the master, return the median round trip in us
+ */
+double drive(int master, const struct script *s, uint64_t *p99_ns,
+             int *timeouts) {
+  static uint64_t rtt[MAX_KEYS];
+  char buf[65536];
+  int n = 0;
+  *timeouts = 0;
+  for (int i = 0; i < s->n; i++) {
+    size_t len = strlen(s->keys[i]);
+    uint64_t t = monotonic_ns();
+    if (write(master, s->keys[i], len) != (ssize_t)len) break;
+    struct pollfd p = {.fd = master, .events = POLLIN};
+    if (poll(&p, 1, 200) <= 0) {
+      (*timeouts)++;
+      continue;
+    }
+    rtt[n++] = monotonic_ns() - t;
+    // take the rest of the redraw, which may come in a few pieces, and
+    // after Enter the next prompt
+    int enter = s->keys[i][0] == '\r';
+    size_t plen = strlen(PROMPT);
+    while (poll(&p, 1, enter ? 200 : 0) > 0) {
+      ssize_t r = read(master, buf, sizeof(buf));
+      if (r <= 0) break;
+      if (enter && (size_t)r >= plen && !memcmp(buf + r - plen, PROMPT, plen))
+        break;
+    }
+  }
+  qsort(rtt, n, sizeof(*rtt), cmp_u64);
+  *p99_ns = n ? rtt[n * 99 / 100] : 0;
+  return n ? rtt[n / 2] / 1e3 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  int len = argc > 1 ? atoi(argv[1]) : 200;
+  double baud = argc > 2 ? atof(argv[2]) : 115200;
+  if (len < 20 || len > 20000) len = 200;
+
+  printf("CPU per key, ns:\n%8s %12s %12s %12s %12s\n", "length", "gap end",
+         "copy end", "gap start", "copy start");
+  for (int n = 20; n <= 20000; n *= 10) {
+    double g_end, c_end, g_start, c_start;
+    cpu_cost(n, 0, &g_end, &c_end);
+    cpu_cost(n, 1, &g_start, &c_start);
+    printf("%8d %12.1f %12.1f %12.1f %12.1f\n", n, g_end, c_end, g_start,
+           c_start);
+  }
+
+  static struct script scripts[4];
+  static char text[4][20001], hist[5][64];
+  struct script *s = &scripts[0];
+  s->name = "append";  // type a line and enter it
+  words(text[0], len, 0);
+  type(s, text[0]);
+  add(s, "\r");
+
+  s = &scripts[1];
+  s->name = "insert";  // half a line, then the other half before it
+  words(text[1], len / 2, 1);
+  type(s, text[1]);
+  add(s, "\033[H");
+  type(s, text[1]);
+  add(s, "\r");
+
+  s = &scripts[2];
+  s->name = "fix";  // a typo 10 characters back: left, delete, retype
+  words(text[2], len, 2);
+  type(s, text[2]);
+  for (int i = 0; i < 10; i++) add(s, "\033[D");
+  for (int i = 0; i < 5; i++) add(s, "\x7f");
+  type(s, "fixed");
+  add(s, "\033[F");
+  add(s, "\r");
+
+  s = &scripts[3];
+  s->name = "history";  // five similar commands, then back through them
+  for (int i = 0; i < 5; i++) {
+    snprintf(hist[i], sizeof(hist[i]), "set led %d on rate=%d", i, 10 * i);
+    type(s, hist[i]);
+    add(s, "\r");
+  }
+  for (int i = 0; i < 5; i++) add(s, "\033[A");
+  for (int i = 0; i < 4; i++) add(s, "\033[B");
+  add(s, "\r");
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    perror("posix_openpt");
+    exit(EXIT_FAILURE);
+  }
+  int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  struct termios t;
+  if (slave < 0 || tcgetattr(slave, &t)) {
+    perror("pty slave");
+    exit(EXIT_FAILURE);
+  }
+  cfmakeraw(&t);  // no echo: the editor draws
+  tcsetattr(slave, TCSANOW, &t);
+  line_edit_init(&editor, slave);
+  pthread_t thread;
+  pthread_create(&thread, NULL, edit_loop, NULL);
+  struct pollfd p = {.fd = master, .events = POLLIN};
+  char buf[256];
+  if (poll(&p, 1, 1000) > 0 && read(master, buf, sizeof(buf)) < 0) {
+    perror("read");  // the first prompt
+  }
+
+  printf("\nline length %d, %.0f baud, through a pty:\n", len, baud);
+  printf("%-8s %6s %12s %12s %10s %12s %10s %10s\n", "", "keys", "bytes/key",
+         "full redraw", "link [us]", "full [us]", "p50 [us]", "p99 [us]");
+  for (int i = 0; i < 4; i++) {
+    s = &scripts[i];
+    uint64_t bytes0 = editor.bytes_out, p99;
+    int timeouts;
+    double p50 = drive(master, s, &p99, &timeouts);
+    double bytes = editor.bytes_out - bytes0;
+    double full = full_redraw_bytes(s);
+    double us_per_byte = 10e6 / baud;
+    printf("%-8s %6d %12.2f %12.2f %10.1f %12.1f %10.1f %10.1f%s\n", s->name,
+           s->n, bytes / s->n, full / s->n, bytes / s->n * us_per_byte,
+           full / s->n * us_per_byte, p50, p99 / 1e3,
+           timeouts ? "  (no redraw for some keys)" : "");
+  }
+  printf("%llu keys, %llu bytes in %llu writes\n",
+         (unsigned long long)editor.keys, (unsigned long long)editor.bytes_out,
+         (unsigned long long)editor.writes);
+
+  /* release resource section */
+  close(master);
+  pthread_join(thread, NULL);
+  close(slave);
+  line_edit_free(&editor);
+}
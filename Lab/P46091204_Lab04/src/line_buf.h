@@ -0,0 +1,90 @@
+/**
+ * @file
+ * Non-blocking line assembler on a fixed buffer
+ *
+ * Bytes are fed in whatever pieces read() returns; every complete line is
+ * handed to a callback as a NUL-terminated string without its terminator.
+ * A line ends at '\n', '\r' or "\r\n" (one line, not an empty one after it),
+ * so it works on a raw tty as well as in canonical mode. A line longer than
+ * the buffer is dropped up to its end and counted, instead of growing the
+ * buffer or splitting it into bogus commands.
+ */
+
+#ifndef LINE_BUF_H
+#define LINE_BUF_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINE_BUF_SIZE 256
+
+typedef void (*line_buf_fn)(void *ctx, char *line, size_t len);
+
+struct line_buf {
+  char buf[LINE_BUF_SIZE];
+  size_t len;
+  int discarding;  // dropping the rest of an overlong line
+  int after_cr;    // a '\n' next belongs to the "\r\n" just ended
+  uint64_t lines, overflows;
+};
+
+void line_buf_init(struct line_buf *lb) { memset(lb, 0, sizeof(*lb)); }
+
+/**
+ * Append n bytes and call fn(ctx, line, len) for every line they complete
+ */
+void line_buf_feed(struct line_buf *lb, const char *data, size_t n,
+                   line_buf_fn fn, void *ctx) {
+  const char *end = data + n;
+  while (data < end) {
+    if (lb->after_cr) {
+      lb->after_cr = 0;
+      if (*data == '\n' && ++data == end) break;
+    }
+    const char *eol = data;
+    while (eol < end && *eol != '\n' && *eol != '\r') eol++;
+    size_t chunk = eol - data;
+    if (!lb->discarding) {
+      if (lb->len + chunk < LINE_BUF_SIZE) {
+        memcpy(lb->buf + lb->len, data, chunk);
+        lb->len += chunk;
+      } else {
+        lb->discarding = 1;
+        lb->overflows++;
+      }
+    }
+    if (eol == end) break;
+    lb->after_cr = *eol == '\r';
+    if (!lb->discarding) {
+      lb->buf[lb->len] = '\0';
+      lb->lines++;
+      fn(ctx, lb->buf, lb->len);
+    }
+    lb->len = 0;
+    lb->discarding = 0;
+    data = eol + 1;
+  }
+}
+
+/**
+ * Read everything available on the non-blocking fd into lb
+ *
+ * Return 0 once the fd would block, -1 on end of file or error.
+ */
+int line_buf_read(struct line_buf *lb, int fd, line_buf_fn fn, void *ctx) {
+  char chunk[512];
+  for (;;) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n > 0) {
+      line_buf_feed(lb, chunk, n, fn, ctx);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,398 @@
+/**
+ * @file
+ * Line editor for a raw terminal on a gap buffer
+ *
+ * The line is kept in one buffer with a gap at the cursor:
+ *   buf[0, gap)          text before the cursor
+ *   buf[gap, gap_end)    free space
+ *   buf[gap_end, cap)    text after the cursor
+ * so typing or deleting at the cursor is O(1) (the buffer doubles when the
+ * gap is used up, amortised O(1) too), moving the cursor by one is one byte
+ * copied, and a line has no length limit.
+ *
+ * Keys: printable ASCII inserts; Backspace/DEL and Ctrl-H delete before the
+ * cursor, Delete (ESC[3~) and Ctrl-D at it; Left/Right; Home (ESC[H, ESC[1~,
+ * ESC[7~, ESCOH, Ctrl-A) and End (ESC[F, ESC[4~, ESC[8~, ESCOF, Ctrl-E);
+ * Up/Down walk a ring of the last LINE_EDIT_HISTORY lines; Ctrl-U clears the
+ * line; '\r', '\n' or "\r\n" enter it.
+ *
+ * The terminal must not echo (the editor does). After each edit it redraws
+ * only from the first column that changed: typing at the end sends the
+ * character alone, typing in the middle that character and the text after
+ * it, and a line recalled from the history only the part that differs from
+ * the line shown. Cursor moves take '\b' or the text already on screen when
+ * that is shorter than ESC[nD / ESC[nC. Output is collected and written
+ * once per read(), so what is queued after a line was entered (a reply,
+ * the next prompt: line_edit_put()) goes out together with its "\r\n".
+ * The line is assumed to fit on one terminal row.
+ *
+ * line-edit-bench measures it through a pty pair.
+ */
+
+#ifndef LINE_EDIT_H
+#define LINE_EDIT_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINE_EDIT_HISTORY 32
+#define LINE_EDIT_INITIAL 64  // first buffer size, doubled as needed
+
+struct line_edit {
+  int fd;  // read keys from and draw on
+  char *buf;
+  size_t cap, gap, gap_end;  // the cursor is at gap
+  size_t col;  // column of the terminal cursor from the start of the line
+  int esc;     // escape sequence state: 0 none, 1 ESC, 2 ESC[, 3 ESC O
+  int esc_arg;
+  int after_cr;  // a '\n' next belongs to the "\r\n" just entered
+  int done;      // a line was entered, start afresh at the next key
+  char *hist[LINE_EDIT_HISTORY];
+  int hist_first, hist_n;
+  int hist_pos;  // line shown: hist_n is the one being typed
+  char *typed;   // the line being typed, kept while the history is shown
+  char *out;
+  size_t out_len, out_cap;
+  char in[256];
+  size_t in_pos, in_len;
+  uint64_t keys, bytes_out, writes;
+};
+
+/**
+ * Return 0 on success, -1 if out of memory
+ */
+int line_edit_init(struct line_edit *le, int fd) {
+  memset(le, 0, sizeof(*le));
+  le->fd = fd;
+  le->cap = le->gap_end = LINE_EDIT_INITIAL;
+  le->buf = malloc(le->cap);
+  return le->buf ? 0 : -1;
+}
+
+void line_edit_free(struct line_edit *le) {
+  for (int i = 0; i < le->hist_n; i++)
+    free(le->hist[(le->hist_first + i) % LINE_EDIT_HISTORY]);
+  free(le->typed);
+  free(le->buf);
+  free(le->out);
+}
+
+size_t line_edit_len(const struct line_edit *le) {
+  return le->gap + le->cap - le->gap_end;
+}
+
+char line_edit_at(const struct line_edit *le, size_t i) {
+  return i < le->gap ? le->buf[i] : le->buf[i + le->gap_end - le->gap];
+}
+
+void line_edit_put(struct line_edit *le, const char *s, size_t n) {
+  if (le->out_len + n > le->out_cap) {
+    size_t cap = le->out_cap ? le->out_cap : 256;
+    while (cap < le->out_len + n) cap *= 2;
+    char *out = realloc(le->out, cap);
+    if (!out) return;  // the screen is off until the next full line
+    le->out = out;
+    le->out_cap = cap;
+  }
+  memcpy(le->out + le->out_len, s, n);
+  le->out_len += n;
+}
+
+/**
+ * Draw the text from the terminal column up to column to
+ */
+void line_edit_put_text(struct line_edit *le, size_t to) {
+  size_t from = le->col;
+  if (from < le->gap)
+    line_edit_put(le, le->buf + from, (to < le->gap ? to : le->gap) - from);
+  if (to > le->gap) {
+    size_t skip = le->gap_end - le->gap;
+    size_t start = from > le->gap ? from : le->gap;
+    line_edit_put(le, le->buf + start + skip, to - start);
+  }
+  le->col = to;
+}
+
+/**
+ * Move the terminal cursor to column to, with the fewest bytes
+ */
+void line_edit_move(struct line_edit *le, size_t to) {
+  // ESC[nD and ESC[nC take at least 4 bytes
+  char seq[24];
+  if (to + 3 < le->col) {
+    int n = snprintf(seq, sizeof(seq), "\033[%zuD", le->col - to);
+    line_edit_put(le, seq, n);
+  } else if (to < le->col) {
+    line_edit_put(le, "\b\b\b", le->col - to);
+  } else if (to > le->col + 3) {
+    int n = snprintf(seq, sizeof(seq), "\033[%zuC", to - le->col);
+    line_edit_put(le, seq, n);
+  } else if (to > le->col) {
+    line_edit_put_text(le, to);  // rewriting is shorter
+  }
+  le->col = to;
+}
+
+/**
+ * Redraw after an edit that changed the text from column from on
+ *
+ * old_len is the length of the line on screen before the edit.
+ */
+void line_edit_refresh(struct line_edit *le, size_t from, size_t old_len) {
+  size_t len = line_edit_len(le);
+  line_edit_move(le, from);
+  if (len > from) line_edit_put_text(le, len);
+  if (len < old_len) line_edit_put(le, "\033[K", 3);
+  line_edit_move(le, le->gap);
+}
+
+/**
+ * Move the gap to position pos of the text
+ */
+void line_edit_gap_to(struct line_edit *le, size_t pos) {
+  if (pos < le->gap) {
+    size_t n = le->gap - pos;
+    memmove(le->buf + le->gap_end - n, le->buf + pos, n);
+    le->gap = pos;
+    le->gap_end -= n;
+  } else if (pos > le->gap) {
+    size_t n = pos - le->gap;
+    memmove(le->buf + le->gap, le->buf + le->gap_end, n);
+    le->gap = pos;
+    le->gap_end += n;
+  }
+}
+
+/**
+ * Make room for n more characters, return 0 on success, -1 if out of memory
+ */
+int line_edit_reserve(struct line_edit *le, size_t n) {
+  if (le->gap_end - le->gap >= n) return 0;
+  size_t cap = le->cap * 2, tail = le->cap - le->gap_end;
+  while (cap - line_edit_len(le) < n) cap *= 2;
+  char *buf = realloc(le->buf, cap);
+  if (!buf) return -1;
+  memmove(buf + cap - tail, buf + le->gap_end, tail);
+  le->buf = buf;
+  le->gap_end = cap - tail;
+  le->cap = cap;
+  return 0;
+}
+
+/**
+ * Replace the whole line with s, cursor at the end (history)
+ */
+void line_edit_set(struct line_edit *le, const char *s) {
+  size_t old_len = line_edit_len(le), n = strlen(s), same = 0;
+  while (same < n && same < old_len && line_edit_at(le, same) == s[same])
+    same++;
+  le->gap = 0;
+  le->gap_end = le->cap;
+  if (line_edit_reserve(le, n + 1)) n = 0;
+  memcpy(le->buf, s, n);
+  le->gap = n;
+  line_edit_refresh(le, same < n ? same : n, old_len);
+}
+
+/**
+ * Move the gap to the end and return the line as a string
+ */
+char *line_edit_text(struct line_edit *le) {
+  line_edit_gap_to(le, line_edit_len(le));
+  le->buf[le->gap] = '\0';  // the gap is never empty between keys
+  return le->buf;
+}
+
+char **line_edit_hist(struct line_edit *le, int i) {
+  return &le->hist[(le->hist_first + i) % LINE_EDIT_HISTORY];
+}
+
+/**
+ * Show the history line dir (-1 older, +1 newer) from the one shown
+ */
+void line_edit_history(struct line_edit *le, int dir) {
+  int pos = le->hist_pos + dir;
+  if (pos < 0 || pos > le->hist_n) {
+    line_edit_put(le, "\a", 1);
+    return;
+  }
+  if (le->hist_pos == le->hist_n) {
+    free(le->typed);
+    le->typed = strdup(line_edit_text(le));
+  }
+  le->hist_pos = pos;
+  line_edit_set(le, pos < le->hist_n ? *line_edit_hist(le, pos)
+                : le->typed               ? le->typed
+                                          : "");
+}
+
+/**
+ * Add the line just entered to the history, unless empty or a repeat
+ */
+void line_edit_remember(struct line_edit *le, const char *line) {
+  if (!line[0] || (le->hist_n && !strcmp(*line_edit_hist(le, le->hist_n - 1),
+                                         line)))
+    return;
+  char *copy = strdup(line);
+  if (!copy) return;
+  if (le->hist_n == LINE_EDIT_HISTORY) {
+    free(le->hist[le->hist_first]);
+    le->hist_first = (le->hist_first + 1) % LINE_EDIT_HISTORY;
+    le->hist_n--;
+  }
+  *line_edit_hist(le, le->hist_n++) = copy;
+}
+
+void line_edit_insert(struct line_edit *le, char c) {
+  if (line_edit_reserve(le, 2)) {  // one for c, one for the final NUL
+    line_edit_put(le, "\a", 1);
+    return;
+  }
+  size_t old_len = line_edit_len(le);
+  le->buf[le->gap++] = c;
+  line_edit_refresh(le, le->gap - 1, old_len);
+}
+
+void line_edit_delete(struct line_edit *le, int before) {
+  size_t old_len = line_edit_len(le);
+  if (before && le->gap > 0) {
+    le->gap--;
+  } else if (!before && le->gap_end < le->cap) {
+    le->gap_end++;
+  } else {
+    return;
+  }
+  line_edit_refresh(le, le->gap, old_len);
+}
+
+void line_edit_cursor(struct line_edit *le, size_t pos) {
+  size_t len = line_edit_len(le);
+  line_edit_gap_to(le, pos > len ? len : pos);
+  line_edit_move(le, le->gap);
+}
+
+/**
+ * The end of ESC [ arg c or ESC O c
+ */
+void line_edit_escape(struct line_edit *le, char c) {
+  switch (c) {
+    case 'A': line_edit_history(le, -1); break;
+    case 'B': line_edit_history(le, +1); break;
+    case 'C': line_edit_cursor(le, le->gap + 1); break;
+    case 'D':
+      if (le->gap) line_edit_cursor(le, le->gap - 1);
+      break;
+    case 'H': line_edit_cursor(le, 0); break;
+    case 'F': line_edit_cursor(le, line_edit_len(le)); break;
+    case '~':
+      if (le->esc_arg == 1 || le->esc_arg == 7) line_edit_cursor(le, 0);
+      if (le->esc_arg == 4 || le->esc_arg == 8)
+        line_edit_cursor(le, line_edit_len(le));
+      if (le->esc_arg == 3) line_edit_delete(le, 0);
+      break;
+  }
+}
+
+/**
+ * Handle one input byte, return 1 if it entered a line
+ *
+ * The line is then line_edit_text() until the next key. Output is
+ * collected until line_edit_flush().
+ */
+int line_edit_key(struct line_edit *le, char c) {
+  le->keys++;
+  if (le->done) {
+    le->done = 0;
+    le->gap = 0;
+    le->gap_end = le->cap;
+    le->col = 0;
+    le->hist_pos = le->hist_n;
+  }
+  if (le->after_cr) {
+    le->after_cr = 0;
+    if (c == '\n') return 0;
+  }
+  if (le->esc == 1) {
+    le->esc = c == '[' ? 2 : c == 'O' ? 3 : 0;
+    le->esc_arg = 0;
+    return 0;
+  }
+  if (le->esc == 2 && ((c >= '0' && c <= '9') || c == ';')) {
+    // modifiers (ESC[1;5C) are ignored
+    le->esc_arg = c == ';' ? 0 : le->esc_arg * 10 + c - '0';
+    return 0;
+  }
+  if (le->esc) {
+    le->esc = 0;
+    line_edit_escape(le, c);
+    return 0;
+  }
+  switch (c) {
+    case '\033': le->esc = 1; break;
+    case '\r':
+    case '\n':
+      le->after_cr = c == '\r';
+      le->done = 1;
+      line_edit_put(le, "\r\n", 2);
+      line_edit_remember(le, line_edit_text(le));
+      return 1;
+    case 0x7f:
+    case '\b': line_edit_delete(le, 1); break;
+    case 0x04: line_edit_delete(le, 0); break;  // Ctrl-D
+    case 0x01: line_edit_cursor(le, 0); break;  // Ctrl-A
+    case 0x05: line_edit_cursor(le, line_edit_len(le)); break;  // Ctrl-E
+    case 0x15: line_edit_set(le, ""); break;  // Ctrl-U
+    default:
+      if (c >= 32 && c <= 126) line_edit_insert(le, c);
+  }
+  return 0;
+}
+
+/**
+ * Write the collected output, return 0 on success, -1 on error
+ */
+int line_edit_flush(struct line_edit *le) {
+  size_t off = 0;
+  while (off < le->out_len) {
+    ssize_t n = write(le->fd, le->out + off, le->out_len - off);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    off += n;
+  }
+  le->bytes_out += off;
+  le->writes += le->out_len > 0;
+  int ret = off == le->out_len ? 0 : -1;
+  le->out_len = 0;
+  return ret;
+}
+
+/**
+ * Edit one line read from the (blocking) fd
+ *
+ * Keys typed ahead of the Enter are kept for the next call. The output is
+ * written before waiting for keys; after the last line, line_edit_flush()
+ * sends the rest. Return the length of the line and set *line to it (valid
+ * until the next call), or return -1 on end of file or error.
+ */
+ssize_t line_edit_getline(struct line_edit *le, char **line) {
+  for (;;) {
+    while (le->in_pos < le->in_len) {
+      if (line_edit_key(le, le->in[le->in_pos++])) {
+        *line = line_edit_text(le);
+        return le->gap;
+      }
+    }
+    if (line_edit_flush(le)) return -1;
+    ssize_t n = read(le->fd, le->in, sizeof(le->in));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    le->in_pos = 0;
+    le->in_len = n;
+  }
+}
+
+#endif
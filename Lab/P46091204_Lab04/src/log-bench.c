@@ -0,0 +1,205 @@
+/**
+ * @file
+ * Append rate, compression and retention of the sensor log
+ *
+ * Simulates days of temperature, humidity and ADC readings at a fixed rate,
+ * quantised like the real converters (HTU21D 14 / 12 bit, MCP3201 12 bit)
+ * with a daily cycle and noise, appends them to a fresh log file and
+ * reports:
+ *   - appends per second and ns per append
+ *   - bits per reading and compression against 12 bytes (int64 ms + float)
+ *   - how much time each series still covers in the fixed-size ring
+ *   - decode rate when reading everything back
+ * Then a child process appends until it is killed with SIGKILL, and the log
+ * is reopened to check that every committed reading survived.
+ *
+ * Noise is what costs bits: a reading equal to the previous one takes 1 bit,
+ * one that differs typically 10-20. noise scales the simulated sensor noise
+ * (0: the quantised signal only). Timestamps jitter by up to jitter_ms;
+ * loggers that use their schedule (deadline) as the timestamp have none and
+ * pay 1 bit per timestamp.
+ *
+ * Usage: log-bench [file=/tmp/log-bench.slog] [size_mb=16] [days=30]
+ *                  [rate_hz=10] [noise=1] [jitter_ms=0]
+ */
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "sensor_log.h"
+
+#define NSERIES 3
+#define DAY_MS 86400000ll
+
+double gauss(unsigned short xs[3]) {
+  double u = erand48(xs), v = erand48(xs);
+  return sqrt(-2 * log(u + 1e-300)) * cos(2 * M_PI * v);
+}
+
+/**
+ * Reading of series at t, quantised like the converter that produces it
+ */
+float simulate(int series, int64_t t, double noise, unsigned short xs[3]) {
+  double day = 2 * M_PI * (t % DAY_MS) / DAY_MS;
+  switch (series) {
+    case SLOG_TEMPERATURE: {  // HTU21D 14 bit
+      double c = 24 + 3 * sin(day) + 0.02 * noise * gauss(xs);
+      long raw = lround((c + 46.85) / 175.72 * 65536) & ~3l;
+      return -46.85 + 175.72 * raw / 65536;
+    }
+    case SLOG_HUMIDITY: {  // HTU21D 12 bit
+      double rh = 55 - 10 * sin(day) + 0.05 * noise * gauss(xs);
+      long raw = lround((rh + 6) / 125 * 65536) & ~15l;
+      return -6 + 125.0 * raw / 65536;
+    }
+    default: {  // MCP3201 12 bit, a slow 1 minute swing
+      double code = 2048 + 500 * sin(2 * M_PI * (t % 60000) / 60000) +
+                    noise * gauss(xs);
+      return code < 0 ? 0 : code > 4095 ? 4095 : lround(code);
+    }
+  }
+}
+
+int64_t jittered(int64_t t, int jitter_ms, unsigned short xs[3]) {
+  return jitter_ms ? t + (int64_t)(erand48(xs) * (2 * jitter_ms + 1)) -
+                         jitter_ms
+                   : t;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : "/tmp/log-bench.slog";
+  double size_mb = argc > 2 ? atof(argv[2]) : 16;
+  double days = argc > 3 ? atof(argv[3]) : 30;
+  double rate = argc > 4 ? atof(argv[4]) : 10;
+  double noise = argc > 5 ? atof(argv[5]) : 1;
+  int jitter_ms = argc > 6 ? atoi(argv[6]) : 0;
+
+  unlink(path);
+  struct slog log;
+  uint32_t nblocks = size_mb * 1048576 / SLOG_BLOCK_SIZE;
+  if (slog_open(&log, path, nblocks, 1)) {
+    perror("Cannot create the log");
+    exit(EXIT_FAILURE);
+  }
+
+  int64_t step = 1000 / rate, t0 = slog_now_ms() - days * DAY_MS;
+  uint64_t ticks = days * DAY_MS / step;
+  unsigned short xs[3] = {1, 2, 3};
+  float *values = malloc(ticks * NSERIES * sizeof(*values));
+  if (!values) {
+    fprintf(stderr, "Not enough memory for %llu readings\n",
+            (unsigned long long)ticks * NSERIES);
+    exit(EXIT_FAILURE);
+  }
+  int64_t *times = malloc(ticks * sizeof(*times));
+  for (uint64_t i = 0; i < ticks; i++) {
+    times[i] = jittered(t0 + i * step, jitter_ms, xs);
+    if (i && times[i] < times[i - 1]) times[i] = times[i - 1];
+    for (int s = 0; s < NSERIES; s++)
+      values[i * NSERIES + s] = simulate(s, times[i], noise, xs);
+  }
+
+  uint64_t start = monotonic_ns();
+  for (uint64_t i = 0; i < ticks; i++)
+    for (int s = 0; s < NSERIES; s++)
+      slog_append(&log, s, times[i], values[i * NSERIES + s]);
+  double append_s = (monotonic_ns() - start) / 1e9;
+  uint64_t n = ticks * NSERIES;
+  printf("%llu readings (%.0f days x %g Hz x %d series) into %.1f MB:\n"
+         "  append %.1f M/s, %.1f ns each\n",
+         (unsigned long long)n, days, rate, NSERIES,
+         log.map_len / 1048576.0, n / append_s / 1e6, append_s * 1e9 / n);
+
+  uint64_t kept = 0, blocks = 0;
+  printf("%-12s %10s %10s %9s %11s %10s\n", "series", "kept", "bits/read",
+         "ratio", "covers [d]", "decode M/s");
+  for (int s = 0; s < NSERIES; s++) {
+    uint64_t bits = 0, count = 0;
+    int64_t first = INT64_MAX, last = INT64_MIN;
+    for (uint32_t i = 0; i < log.nblocks; i++) {
+      struct slog_block *b = slog_block_at(&log, i);
+      if (b->magic != SLOG_BLOCK_MAGIC || b->series != s ||
+          b->state == SLOG_FREE)
+        continue;
+      uint64_t commit = slog_block_commit(b);
+      count += commit >> 32;
+      bits += commit & 0xffffffff;
+      blocks++;
+      if (b->t_first < first) first = b->t_first;
+      if (b->t_last > last) last = b->t_last;
+    }
+    struct slog_iter it;
+    slog_iter_init(&it, &log, s, INT64_MIN, INT64_MAX);
+    int64_t t, prev = INT64_MIN;
+    float v;
+    uint64_t decoded = 0, bad = 0;
+    start = monotonic_ns();
+    while (slog_iter_next(&it, &t, &v)) {
+      bad += t < prev;
+      prev = t;
+      decoded++;
+    }
+    double decode_s = (monotonic_ns() - start) / 1e9;
+    kept += count;
+    double bpr = count ? (double)bits / count : 0;
+    printf("%-12s %10llu %10.2f %8.1fx %11.2f %10.1f%s\n",
+           slog_series_names[s], (unsigned long long)count, bpr,
+           bpr > 0 ? 96 / bpr : 0, count ? (last - first) / (double)DAY_MS : 0,
+           decoded / decode_s / 1e6,
+           decoded != count || bad ? "  MISMATCH" : "");
+  }
+  // with block headers and the unused tail of every block
+  double bytes = kept ? (double)blocks * SLOG_BLOCK_SIZE / kept : 0;
+  printf("%.2f bytes per reading in the file: %.1f MB hold %.1f days of "
+         "%d series at %g Hz\n",
+         bytes, log.map_len / 1048576.0,
+         bytes > 0 ? log.map_len / bytes / (rate * NSERIES * 86400) : 0,
+         NSERIES, rate);
+  slog_close(&log);
+
+  // crash test: append in a child, SIGKILL it, recover
+  unlink(path);
+  pid_t pid = fork();
+  if (pid == 0) {
+    struct slog w;
+    if (slog_open(&w, path, 64, 1)) _exit(1);
+    for (uint64_t i = 0;; i++)
+      slog_append(&w, i % NSERIES, t0 + i / NSERIES * step,
+                  values[i % (ticks * NSERIES)]);
+  }
+  delay_ms(200);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  struct slog r;
+  if (slog_open(&r, path, 0, 1)) {
+    perror("Cannot reopen the log after the crash");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t recovered = 0, bad = 0;
+  for (int s = 0; s < NSERIES; s++) {
+    struct slog_iter it;
+    slog_iter_init(&it, &r, s, INT64_MIN, INT64_MAX);
+    int64_t t, prev = INT64_MIN;
+    float v;
+    while (slog_iter_next(&it, &t, &v)) {
+      bad += t < prev;
+      prev = t;
+      recovered++;
+    }
+    // the writer can continue where the killed one stopped
+    if (slog_append(&r, s, prev + step, 0)) bad++;
+  }
+  printf("crash test: killed a writer, %llu readings recovered, %s\n",
+         (unsigned long long)recovered, bad ? "CORRUPT" : "consistent");
+  slog_close(&r);
+  unlink(path);
+
+  /* release resource section */
+  free(times);
+  free(values);
+  return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
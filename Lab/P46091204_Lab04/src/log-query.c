@@ -0,0 +1,154 @@
+/**
+ * @file
+ * Range and aggregate queries on a sensor log
+ *
+ * With a step of a minute or more the answer comes from the coarsest rollup
+ * tier whose width divides the step (<log>.rollup, kept up to date by
+ * log-rollup, or brought up to date here when it is writable and no
+ * log-rollup holds it; otherwise it is only read). Shorter steps and raw
+ * readings are read from the log itself, starting at the first block of the
+ * range found through the block index.
+ *
+ * Times are "now", an offset from now such as -7d, -90m, -30s, or seconds
+ * since the epoch. Steps are 0 (the raw readings) or a duration like 10s, 15m,
+ * 1h, 1d. For example, the hourly min / max / avg humidity of the last week:
+ *   log-query sensors.slog humidity -7d now 1h
+ *
+ * The query latency and how many buckets or readings it read go to stderr.
+ *
+ * Usage: log-query <log_file> <series> <from> <to> [step=0]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "sensor_log.h"
+#include "sensor_rollup.h"
+
+#define MAX_STEPS 100000
+
+/**
+ * Duration such as 15m in ms, -1 if malformed
+ */
+int64_t parse_duration(const char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  int64_t unit = 1000;
+  switch (*end) {
+    case 'd': unit *= 24;  // fall through
+    case 'h': unit *= 60;  // fall through
+    case 'm': unit *= 60;  // fall through
+    case 's': end++;       // fall through
+    case '\0': break;
+    default: return -1;
+  }
+  return *end || end == s ? -1 : v * unit;
+}
+
+int64_t parse_time(const char *s, int64_t now) {
+  if (!strcmp(s, "now")) return now;
+  if (*s == '-') {
+    int64_t d = parse_duration(s + 1);
+    return d < 0 ? -1 : now - d;
+  }
+  return atoll(s) * 1000;
+}
+
+void print_time(int64_t t_ms) {
+  time_t t = t_ms / 1000;
+  struct tm tm;
+  char buf[32];
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+  printf("%s.%03d", buf, (int)(t_ms % 1000));
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 5) {
+    fprintf(stderr, "Usage: %s <log_file> <series> <from> <to> [step]\n",
+            argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  int series = -1;
+  for (int s = 0; s < SLOG_MAX_SERIES; s++)
+    if (slog_series_names[s] && !strcmp(argv[2], slog_series_names[s]))
+      series = s;
+  if (series < 0) series = atoi(argv[2]);
+  int64_t now = slog_now_ms();
+  int64_t from = parse_time(argv[3], now), to = parse_time(argv[4], now);
+  int64_t step = argc > 5 ? parse_duration(argv[5]) : 0;
+  if (from < 0 || to < 0 || step < 0 || series >= SLOG_MAX_SERIES) {
+    fprintf(stderr, "Bad series, time or step\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct slog log;
+  if (slog_open(&log, argv[1], 0, 0)) {
+    perror("Cannot open the sensor log");
+    exit(EXIT_FAILURE);
+  }
+  int tier = series < ROLLUP_MAX_SERIES ? rollup_pick_tier(step) : -1;
+  struct rollup r;
+  if (tier >= 0) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.rollup", argv[1]);
+    if (rollup_open(&r, path, 1) == 0) {
+      uint64_t t0 = monotonic_ns();
+      uint64_t n = rollup_update(&r, &log);
+      if (n)
+        fprintf(stderr, "rolled up %llu readings in %.2f ms\n",
+                (unsigned long long)n, (monotonic_ns() - t0) / 1e6);
+    } else if (rollup_open(&r, path, 0)) {
+      tier = -1;  // no rollups: aggregate the raw readings
+    }
+  }
+
+  uint64_t t0 = monotonic_ns(), read = 0;
+  if (step == 0) {
+    struct slog_index idx = {0};
+    slog_index_build(&idx, &log, series);
+    struct slog_iter it;
+    slog_iter_init(&it, &log, series, from, to);
+    slog_iter_seek(&it, &idx);
+    int64_t t;
+    float v;
+    while (slog_iter_next(&it, &t, &v)) {
+      print_time(t);
+      printf("\t%.3f\n", v);
+      read++;
+    }
+    fprintf(stderr, "%llu readings in %.1f us from the raw log\n",
+            (unsigned long long)read, (monotonic_ns() - t0) / 1e3);
+    slog_index_free(&idx);
+  } else {
+    struct rollup_bucket *out = malloc(MAX_STEPS * sizeof(*out));
+    size_t n;
+    if (tier >= 0) {
+      n = rollup_query(&r, series, tier, from, to, step, out, MAX_STEPS, &read);
+    } else {
+      struct slog_index idx = {0};
+      slog_index_build(&idx, &log, series);
+      n = rollup_query_raw(&log, &idx, series, from, to, step, out, MAX_STEPS,
+                           &read);
+      slog_index_free(&idx);
+    }
+    double us = (monotonic_ns() - t0) / 1e3;
+    printf("%-23s %8s %10s %10s %10s\n", "start", "count", "min", "max",
+           "avg");
+    for (size_t i = 0; i < n; i++) {
+      print_time(out[i].t);
+      printf(" %8u %10.3f %10.3f %10.3f\n", out[i].count, out[i].min,
+             out[i].max, out[i].sum / out[i].count);
+    }
+    fprintf(stderr, "%zu steps in %.1f us from %s (%llu %s read)\n", n, us,
+            tier >= 0 ? rollup_tier_names[tier] : "raw log",
+            (unsigned long long)read, tier >= 0 ? "buckets" : "readings");
+    free(out);
+  }
+
+  /* release resource section */
+  if (tier >= 0) rollup_close(&r);
+  slog_close(&log);
+}
@@ -0,0 +1,76 @@
+/**
+ * @file
+ * Keep the minute / hour / day rollups of a sensor log up to date
+ *
+ * Runs next to the program that writes the log (e.g. serial -o): maps the
+ * log read-only and folds the new readings into <log>.rollup every period.
+ * It can be stopped and restarted at any time, a killed run is repaired
+ * when the rollup file is opened again (see sensor_rollup.h). It keeps the
+ * rollup file locked while it runs, so only one log-rollup can run per log
+ * and log-query only reads the rollups meanwhile. At start it waits up to
+ * a second for a log-query that is updating them.
+ *
+ * Usage: log-rollup <log_file> [period_ms=1000]
+ */
+
+#include <signal.h>
+
+#include "util.h"
+#include "sensor_log.h"
+#include "sensor_rollup.h"
+
+#define LOCK_TRIES 100
+#define LOCK_RETRY_MS 10
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <log_file> [period_ms]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  double period_ms = argc > 2 ? atof(argv[2]) : 1000;
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.rollup", argv[1]);
+
+  struct slog log;
+  struct rollup r;
+  if (slog_open(&log, argv[1], 0, 0)) {
+    perror("Cannot open the sensor log");
+    exit(EXIT_FAILURE);
+  }
+  // a log-query bringing the rollups up to date has them for a moment
+  for (int tries = 1; rollup_open(&r, path, 1); tries++) {
+    if (errno != EWOULDBLOCK || tries == LOCK_TRIES) {
+      perror(errno == EWOULDBLOCK ? "The rollup file is in use"
+                                  : "Cannot open the rollup file");
+      exit(EXIT_FAILURE);
+    }
+    delay_ms(LOCK_RETRY_MS);
+  }
+
+  signal(SIGINT, int_handler);
+  signal(SIGTERM, int_handler);
+
+  uint64_t total = 0;
+  while (!stopped) {
+    slog_refresh(&log);
+    uint64_t t0 = monotonic_ns();
+    uint64_t n = rollup_update(&r, &log);
+    if (n)
+      printf("rolled up %llu readings in %.2f ms\n", (unsigned long long)n,
+             (monotonic_ns() - t0) / 1e6);
+    total += n;
+    delay_ms(period_ms);
+  }
+  printf("%llu readings rolled up\n", (unsigned long long)total);
+
+  /* release resource section */
+  rollup_close(&r);
+  slog_close(&log);
+}
@@ -0,0 +1,206 @@
+/**
+ * @file
+ * Sample several I2C sensors on one bus with interleaved conversions
+ *
+ * Every listed device keeps converting; while one waits for its conversion
+ * the scheduler (i2c_sched.h) serves the others. The latest values are
+ * printed every second and the per-device rates and bus utilisation on exit.
+ *
+ * Devices are given as name[@address][/rate], rate in conversions per
+ * second (default: as fast as the device converts):
+ *   htu21d   temperature / humidity, always at 0x40
+ *   bh1750   light, 0x23 by default
+ *   bmp180   temperature / pressure, 0x77 by default
+ *
+ * Usage: multi-sensor <i2c_dev> [seconds=10] [device ...]
+ *   sudo ./bin/multi-sensor 1 10 htu21d bh1750@0x5c bmp180/20
+ */
+
+#include <signal.h>
+#include <string.h>
+
+#include "util.h"
+#include "i2c_bus.h"
+#include "i2c_sched.h"
+#include "htu21d.h"
+#include "bh1750.h"
+#include "bmp180.h"
+
+#define MAX_DEVICES 8
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+struct htu21d_node {
+  struct htu21d dev;
+  enum htu21d_kind kind;
+  double temp, hum;
+};
+
+int64_t htu21d_node_start(void *ctx) {
+  struct htu21d_node *n = ctx;
+  if (htu21d_start(&n->dev, n->kind)) return -1;
+  return n->dev.typ_us[n->kind] * 1000ll;
+}
+
+int htu21d_node_collect(void *ctx) {
+  struct htu21d_node *n = ctx;
+  uint16_t raw;
+  int ret = htu21d_try_collect(&n->dev, &raw);
+  if (ret == 0) {
+    if (n->kind == HTU21D_TEMP)
+      n->temp = htu21d_temperature(raw);
+    else
+      n->hum = htu21d_humidity(raw);
+  }
+  if (ret <= 0) n->kind = n->kind == HTU21D_TEMP ? HTU21D_HUM : HTU21D_TEMP;
+  return ret;
+}
+
+struct bh1750_node {
+  struct bh1750 dev;
+  double lux;
+};
+
+int64_t bh1750_node_start(void *ctx) {
+  struct bh1750_node *n = ctx;
+  return bh1750_start(&n->dev) ? -1 : BH1750_MAX_US * 1000ll;
+}
+
+int bh1750_node_collect(void *ctx) {
+  struct bh1750_node *n = ctx;
+  uint16_t raw;
+  int ret = bh1750_try_collect(&n->dev, &raw);
+  if (ret == 0) n->lux = bh1750_lux(raw);
+  return ret;
+}
+
+struct bmp180_node {
+  struct bmp180 dev;
+  enum bmp180_kind kind;
+  double temp, pres;
+};
+
+int64_t bmp180_node_start(void *ctx) {
+  struct bmp180_node *n = ctx;
+  if (bmp180_start(&n->dev, n->kind)) return -1;
+  return bmp180_conversion_us(&n->dev, n->kind) * 1000ll;
+}
+
+int bmp180_node_collect(void *ctx) {
+  struct bmp180_node *n = ctx;
+  int32_t raw;
+  int ret = bmp180_try_collect(&n->dev, &raw);
+  if (ret == 0) {
+    if (n->kind == BMP180_TEMP) {
+      n->temp = bmp180_temperature(&n->dev, raw) / 10.0;
+    } else {
+      n->pres = bmp180_pressure(&n->dev, raw) / 100.0;
+    }
+  }
+  // pressure needs a temperature first: retry the temperature until it works
+  if (ret == 0 || n->kind == BMP180_PRES)
+    n->kind = n->kind == BMP180_TEMP ? BMP180_PRES : BMP180_TEMP;
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <i2c_dev> [seconds] [device ...]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  int bus_nr = atoi(argv[1]);
+  double seconds = argc > 2 ? atof(argv[2]) : 10;
+  const char *defaults[] = {"htu21d", "bh1750", "bmp180"};
+  const char **names = argc > 3 ? (const char **)argv + 3 : defaults;
+  int ndev = argc > 3 ? argc - 3 : 3;
+  if (ndev > MAX_DEVICES) ndev = MAX_DEVICES;
+
+  struct i2c_bus bus;
+  if (i2c_bus_open(&bus, bus_nr)) {
+    fprintf(stderr, "Cannot open /dev/i2c-%d. Did you run with sudo?\n",
+            bus_nr);
+    exit(EXIT_FAILURE);
+  }
+
+  struct i2c_sched_dev devs[MAX_DEVICES];
+  struct htu21d_node *htu = NULL;
+  struct bh1750_node *light = NULL;
+  struct bmp180_node *baro = NULL;
+  for (int i = 0; i < ndev; i++) {
+    char name[16];
+    long addr = -1;
+    double rate = 0;
+    const char *spec = names[i];
+    size_t len = strcspn(spec, "@/");
+    snprintf(name, sizeof(name), "%.*s", (int)len, spec);
+    const char *p = spec + len;
+    if (*p == '@') addr = strtol(p + 1, (char **)&p, 0);
+    if (*p == '/') rate = atof(p + 1);
+
+    struct i2c_sched_dev *d = &devs[i];
+    memset(d, 0, sizeof(*d));
+    d->period_ns = rate > 0 ? 1e9 / rate : 0;
+    int ret;
+    if (!strcmp(name, "htu21d") && !htu) {
+      htu = calloc(1, sizeof(*htu));
+      ret = htu21d_init_bus(&htu->dev, &bus);
+      d->name = "htu21d";
+      d->ctx = htu;
+      d->start = htu21d_node_start;
+      d->collect = htu21d_node_collect;
+      d->poll_ns = 1000000;
+    } else if (!strcmp(name, "bh1750") && !light) {
+      light = calloc(1, sizeof(*light));
+      ret = bh1750_init(&light->dev, &bus, addr < 0 ? BH1750_ADDRESS : addr);
+      d->name = "bh1750";
+      d->ctx = light;
+      d->start = bh1750_node_start;
+      d->collect = bh1750_node_collect;
+      d->poll_ns = 1000000;
+    } else if (!strcmp(name, "bmp180") && !baro) {
+      baro = calloc(1, sizeof(*baro));
+      ret = bmp180_init(&baro->dev, &bus, addr < 0 ? BMP180_ADDRESS : addr, 0);
+      d->name = "bmp180";
+      d->ctx = baro;
+      d->start = bmp180_node_start;
+      d->collect = bmp180_node_collect;
+      d->poll_ns = 500000;
+    } else {
+      fprintf(stderr, "Unknown or repeated device %s\n", spec);
+      exit(EXIT_FAILURE);
+    }
+    if (ret) {
+      fprintf(stderr, "Cannot initalize %s\n", spec);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  signal(SIGINT, int_handler);
+
+  struct i2c_sched sched;
+  i2c_sched_init(&sched, &bus, devs, ndev);
+  uint64_t end = sched.t0 + seconds * 1e9, next_print = sched.t0 + 1000000000;
+  while (!stopped && monotonic_ns() < end) {
+    i2c_sched_step(&sched);
+    if (monotonic_ns() < next_print) continue;
+    next_print += 1000000000;
+    if (htu) printf("TEMP: %.2f C\tHUM: %.2f %%\t", htu->temp, htu->hum);
+    if (light) printf("LIGHT: %.1f lx\t", light->lux);
+    if (baro) printf("PRES: %.2f hPa (%.1f C)", baro->pres, baro->temp);
+    printf("\n");
+  }
+
+  i2c_sched_print_stats(stdout, &sched);
+  i2c_bus_print_stats(stdout, &bus);
+
+  /* release resource section */
+  free(htu);
+  free(light);
+  free(baro);
+  i2c_bus_close(&bus);
+}
@@ -0,0 +1,160 @@
+/**
+ * @file
+ * Single-threaded epoll event loop with timerfd / signalfd helpers
+ *
+ * Every event source is a file descriptor registered with a handler:
+ *   - serial ports, sockets and ptys are readable / writable fds
+ *   - timers are timerfds (reactor_timer_open(), reactor_timer_arm())
+ *   - signals are a signalfd (reactor_signals_open()), so they arrive as
+ *     ordinary events instead of interrupting a handler
+ * reactor_run() sleeps in epoll_wait() until one of them is ready and calls
+ * the handlers of the ready ones; nothing polls. Handlers must not block:
+ * the time a handler takes is the latency every other source sees.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define REACTOR_MAX_EVENTS 64
+
+struct reactor_handler {
+  int fd;
+  void (*fn)(struct reactor_handler *h, uint32_t events);
+  void *ctx;
+};
+
+struct reactor {
+  int epfd;
+  int running;
+  uint64_t wakeups, events;
+  uint64_t busy_max_ns;  // longest time spent in the handlers of one wakeup
+};
+
+/**
+ * Create the epoll set, return 0 on success
+ */
+int reactor_init(struct reactor *r) {
+  memset(r, 0, sizeof(*r));
+  r->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epfd < 0) return -1;
+  r->running = 1;
+  return 0;
+}
+
+/**
+ * Watch h->fd for events (EPOLLIN, EPOLLOUT, ...), return 0 on success
+ */
+int reactor_add(struct reactor *r, struct reactor_handler *h,
+                uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.ptr = h};
+  return epoll_ctl(r->epfd, EPOLL_CTL_ADD, h->fd, &ev);
+}
+
+/**
+ * Change the events watched on h->fd, return 0 on success
+ */
+int reactor_mod(struct reactor *r, struct reactor_handler *h,
+                uint32_t events) {
+  struct epoll_event ev = {.events = events, .data.ptr = h};
+  return epoll_ctl(r->epfd, EPOLL_CTL_MOD, h->fd, &ev);
+}
+
+int reactor_del(struct reactor *r, struct reactor_handler *h) {
+  return epoll_ctl(r->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+}
+
+/**
+ * Wait up to timeout_ms (-1: forever) and dispatch the ready handlers
+ *
+ * Return the number of handlers called, -1 on error.
+ */
+int reactor_run_once(struct reactor *r, int timeout_ms) {
+  struct epoll_event ev[REACTOR_MAX_EVENTS];
+  int n = epoll_wait(r->epfd, ev, REACTOR_MAX_EVENTS, timeout_ms);
+  if (n < 0) return errno == EINTR ? 0 : -1;
+  uint64_t t0 = monotonic_ns();
+  r->wakeups++;
+  r->events += n;
+  for (int i = 0; i < n; i++) {
+    struct reactor_handler *h = ev[i].data.ptr;
+    h->fn(h, ev[i].events);
+  }
+  uint64_t busy = monotonic_ns() - t0;
+  if (busy > r->busy_max_ns) r->busy_max_ns = busy;
+  return n;
+}
+
+/**
+ * Dispatch events until reactor_stop(), return 0 or -1 on error
+ */
+int reactor_run(struct reactor *r) {
+  while (r->running)
+    if (reactor_run_once(r, -1) < 0) return -1;
+  return 0;
+}
+
+void reactor_stop(struct reactor *r) { r->running = 0; }
+
+void reactor_close(struct reactor *r) { close(r->epfd); }
+
+/**
+ * Non-blocking CLOCK_MONOTONIC timerfd, disarmed; -1 on error
+ */
+int reactor_timer_open(void) {
+  return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+/**
+ * Fire at monotonic_ns() time at_ns, then every period_ns (0: once)
+ *
+ * at_ns 0 disarms the timer. A time already past fires at once.
+ */
+int reactor_timer_arm(int fd, uint64_t at_ns, uint64_t period_ns) {
+  struct itimerspec its = {
+      .it_value = {at_ns / 1000000000, at_ns % 1000000000},
+      .it_interval = {period_ns / 1000000000, period_ns % 1000000000},
+  };
+  return timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * Expirations since the last call (more than 1: ticks were missed)
+ */
+uint64_t reactor_timer_read(int fd) {
+  uint64_t n;
+  return read(fd, &n, sizeof(n)) == sizeof(n) ? n : 0;
+}
+
+/**
+ * Block the n signals in sigs and return a signalfd receiving them
+ *
+ * Call before starting any thread so that no thread has them unblocked.
+ */
+int reactor_signals_open(const int *sigs, int n) {
+  sigset_t set;
+  sigemptyset(&set);
+  for (int i = 0; i < n; i++) sigaddset(&set, sigs[i]);
+  if (sigprocmask(SIG_BLOCK, &set, NULL)) return -1;
+  return signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/**
+ * Next pending signal number from a signalfd, 0 if none
+ */
+int reactor_signal_read(int fd) {
+  struct signalfd_siginfo si;
+  return read(fd, &si, sizeof(si)) == sizeof(si) ? (int)si.ssi_signo : 0;
+}
+
+#endif
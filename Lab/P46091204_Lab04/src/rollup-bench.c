@@ -0,0 +1,188 @@
+/**
+ * @file
+ * Query latency of the rollup tiers against the raw log over a year of data
+ *
+ * Appends a simulated year of 10 Hz humidity readings to a fresh log,
+ * rolling them up every simulated hour like log-rollup would, then times
+ * typical dashboard queries, each answered from a rollup tier and, where the
+ * raw ring still holds the range, from the raw readings:
+ *   - hourly min / max / avg of the last week
+ *   - daily min / max / avg of the last year
+ *   - per-minute min / max / avg of the last day
+ *   - the raw readings of the last 10 s, with and without the block index
+ * Each latency is the median of repeated runs. The hourly tier answer is
+ * checked against the one computed from the raw readings.
+ *
+ * Usage: rollup-bench [days=365] [rate_hz=10] [log_mb=64] [dir=/tmp]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "sensor_log.h"
+#include "sensor_rollup.h"
+
+#define DAY_MS 86400000ll
+#define REPEAT 21
+#define MAX_STEPS 100000
+
+int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * HTU21D-like 12 bit humidity with a daily cycle and noise
+ */
+float humidity(int64_t t, unsigned short xs[3]) {
+  double day = 2 * M_PI * (t % DAY_MS) / DAY_MS;
+  double u = erand48(xs), v = erand48(xs);
+  double rh = 55 - 10 * sin(day) +
+              0.05 * sqrt(-2 * log(u + 1e-300)) * cos(2 * M_PI * v);
+  long raw = lround((rh + 6) / 125 * 65536) & ~15l;
+  return -6 + 125.0 * raw / 65536;
+}
+
+struct bucket_query {
+  const struct rollup *r;
+  const struct slog *log;
+  const struct slog_index *idx;
+  int tier;  // -1: raw
+  int64_t from, to, step;
+  struct rollup_bucket *out;
+  size_t n;
+  uint64_t read;
+};
+
+void run_query(struct bucket_query *q) {
+  q->read = 0;
+  if (q->tier >= 0)
+    q->n = rollup_query(q->r, SLOG_HUMIDITY, q->tier, q->from, q->to, q->step,
+                        q->out, MAX_STEPS, &q->read);
+  else
+    q->n = rollup_query_raw(q->log, q->idx, SLOG_HUMIDITY, q->from, q->to,
+                            q->step, q->out, MAX_STEPS, &q->read);
+}
+
+/**
+ * Median latency of REPEAT runs in microseconds
+ */
+double time_query(struct bucket_query *q) {
+  uint64_t ns[REPEAT];
+  for (int i = 0; i < REPEAT; i++) {
+    uint64_t t0 = monotonic_ns();
+    run_query(q);
+    ns[i] = monotonic_ns() - t0;
+  }
+  qsort(ns, REPEAT, sizeof(ns[0]), cmp_u64);
+  return ns[REPEAT / 2] / 1e3;
+}
+
+void report(const char *what, struct bucket_query *q) {
+  double us = time_query(q);
+  printf("%-34s %-7s %10.1f us %6zu steps %10llu %s read\n", what,
+         q->tier >= 0 ? rollup_tier_names[q->tier] : "raw", us, q->n,
+         (unsigned long long)q->read, q->tier >= 0 ? "buckets" : "readings");
+}
+
+int main(int argc, char *argv[]) {
+  double days = argc > 1 ? atof(argv[1]) : 365;
+  double rate = argc > 2 ? atof(argv[2]) : 10;
+  double log_mb = argc > 3 ? atof(argv[3]) : 64;
+  const char *dir = argc > 4 ? argv[4] : "/tmp";
+  char log_path[4096], rollup_path[4200];
+  snprintf(log_path, sizeof(log_path), "%s/rollup-bench.slog", dir);
+  snprintf(rollup_path, sizeof(rollup_path), "%s.rollup", log_path);
+  unlink(log_path);
+  unlink(rollup_path);
+
+  struct slog log;
+  struct rollup r;
+  if (slog_open(&log, log_path, log_mb * 1048576 / SLOG_BLOCK_SIZE, 1) ||
+      rollup_open(&r, rollup_path, 1)) {
+    perror("Cannot create the log files");
+    exit(EXIT_FAILURE);
+  }
+
+  int64_t step = 1000 / rate, now = slog_now_ms();
+  int64_t t = rollup_floor(now - days * DAY_MS, step);
+  uint64_t per_hour = 3600000 / step, n = 0;
+  uint64_t append_ns = 0, rollup_ns = 0;
+  unsigned short xs[3] = {4, 5, 6};
+  while (t < now) {
+    uint64_t t0 = monotonic_ns();
+    for (uint64_t i = 0; i < per_hour && t < now; i++, t += step, n++)
+      slog_append(&log, SLOG_HUMIDITY, t, humidity(t, xs));
+    uint64_t t1 = monotonic_ns();
+    rollup_update(&r, &log);
+    rollup_ns += monotonic_ns() - t1;
+    append_ns += t1 - t0;
+  }
+  printf("%llu readings over %.0f days: append %.1f s (incl. simulation), "
+         "rollup %.1f s, %.1f ns per reading\n",
+         (unsigned long long)n, days, append_ns / 1e9, rollup_ns / 1e9,
+         (double)rollup_ns / n);
+
+  struct slog_index idx = {0};
+  uint64_t t0 = monotonic_ns();
+  slog_index_build(&idx, &log, SLOG_HUMIDITY);
+  printf("raw log keeps the last %.1f days in %u blocks, index built in "
+         "%.1f us\n\n",
+         idx.n ? (idx.t_last[idx.n - 1] - idx.t_first[0]) / (double)DAY_MS : 0,
+         idx.n, (monotonic_ns() - t0) / 1e3);
+
+  struct rollup_bucket *out = malloc(MAX_STEPS * sizeof(*out));
+  struct rollup_bucket *check = malloc(MAX_STEPS * sizeof(*check));
+  struct bucket_query q = {.r = &r, .log = &log, .idx = &idx, .out = out};
+
+  // whole steps, so the raw answer covers the same intervals as the tier's
+  q.to = now;
+  q.step = 3600000;
+  q.from = rollup_floor(now - 7 * DAY_MS, q.step);
+  q.tier = ROLLUP_HOUR;
+  report("hourly, last week", &q);
+  size_t tier_n = q.n;
+  memcpy(check, out, tier_n * sizeof(*out));
+  q.tier = -1;
+  report("hourly, last week", &q);
+  int mismatch = tier_n != q.n;
+  for (size_t i = 0; !mismatch && i < q.n; i++)
+    mismatch = check[i].t != out[i].t || check[i].count != out[i].count ||
+               check[i].min != out[i].min || check[i].max != out[i].max ||
+               fabs(check[i].sum - out[i].sum) > 1e-6 * fabs(out[i].sum);
+
+  q.step = DAY_MS;
+  q.from = rollup_floor(now - 365 * DAY_MS, q.step);
+  q.tier = ROLLUP_DAY;
+  report("daily, last year", &q);
+  q.tier = ROLLUP_HOUR;
+  report("daily, last year", &q);
+
+  q.step = 60000;
+  q.from = rollup_floor(now - DAY_MS, q.step);
+  q.tier = ROLLUP_MINUTE;
+  report("per minute, last day", &q);
+  q.tier = -1;
+  report("per minute, last day", &q);
+
+  q.step = 1000;
+  q.from = rollup_floor(now - 10000, q.step);
+  report("per second, last 10 s (index)", &q);
+  q.idx = NULL;
+  report("per second, last 10 s (no index)", &q);
+
+  printf("\nhourly tier %s the raw readings\n",
+         mismatch ? "DIFFERS from" : "matches");
+
+  /* release resource section */
+  free(out);
+  free(check);
+  slog_index_free(&idx);
+  rollup_close(&r);
+  slog_close(&log);
+  unlink(log_path);
+  unlink(rollup_path);
+  return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file
+ * Receive ring: read() straight into a power-of-two ring, lines parsed in
+ * place
+ *
+ * rx_ring_fill() reads into all the free space of the ring with one readv()
+ * (the part up to the end of the buffer and the part from its start), and
+ * rx_ring_next() hands out complete lines where they lie: the terminator is
+ * overwritten with a NUL and the caller gets a pointer into the ring, valid
+ * until the next fill. Only a line that wraps around the end of the buffer
+ * is copied, into a scratch buffer (counted in wrapped). Indexes run freely
+ * and are masked, so nothing is ever moved to make room; once all is taken
+ * they start over at 0, so that the next read() does not wrap either.
+ *
+ * Lines end like in line_buf.h at '\n', '\r' or "\r\n", and a line that
+ * does not fit in the ring is dropped up to its end and counted. With erase
+ * set, Backspace and DEL remove the character before them, for a terminal
+ * in raw mode where the line discipline no longer does.
+ */
+
+#ifndef RX_RING_H
+#define RX_RING_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct rx_ring {
+  char *buf, *scratch;
+  size_t size, mask;
+  size_t head;  // bytes read so far
+  size_t scan;  // bytes looked at for a terminator
+  size_t tail;  // bytes handed out or dropped
+  int discarding;  // dropping the rest of an overlong line
+  int after_cr;    // a '\n' next belongs to the "\r\n" just ended
+  int erase;
+  uint64_t bytes, reads, lines, wrapped, overflows;
+};
+
+typedef void (*rx_ring_fn)(void *ctx, char *line, size_t len);
+
+/**
+ * A ring of 2^size_log2 bytes, return 0 on success, -1 if out of memory
+ */
+int rx_ring_init(struct rx_ring *r, int size_log2) {
+  memset(r, 0, sizeof(*r));
+  r->size = (size_t)1 << size_log2;
+  r->mask = r->size - 1;
+  r->buf = malloc(2 * r->size);
+  r->scratch = r->buf + r->size;
+  return r->buf ? 0 : -1;
+}
+
+void rx_ring_free(struct rx_ring *r) { free(r->buf); }
+
+/**
+ * Forget what is buffered, keep the statistics
+ */
+void rx_ring_reset(struct rx_ring *r) {
+  r->tail = r->scan = r->head;
+  r->discarding = r->after_cr = 0;
+}
+
+/**
+ * One read() into the free space, return its result (0: end of file)
+ *
+ * readv() only when the free space wraps around the end of the buffer.
+ */
+ssize_t rx_ring_fill(struct rx_ring *r, int fd) {
+  size_t free_bytes = r->size - (r->head - r->tail);
+  if (!free_bytes) {  // rx_ring_next() has not dropped an overlong line yet
+    errno = ENOBUFS;
+    return -1;
+  }
+  size_t at = r->head & r->mask;
+  size_t first = r->size - at < free_bytes ? r->size - at : free_bytes;
+  struct iovec iov[2] = {{r->buf + at, first}, {r->buf, free_bytes - first}};
+  ssize_t n = free_bytes > first ? readv(fd, iov, 2)
+                                 : read(fd, iov[0].iov_base, first);
+  if (n > 0) {
+    r->head += n;
+    r->bytes += n;
+    r->reads++;
+  }
+  return n;
+}
+
+/**
+ * Remove the Backspace at scan and the character before it, if any
+ */
+void rx_ring_erase(struct rx_ring *r) {
+  size_t drop = r->scan > r->tail ? 2 : 1;
+  for (size_t from = r->scan + 1; from != r->head; from++)
+    r->buf[(from - drop) & r->mask] = r->buf[from & r->mask];
+  r->head -= drop;
+  r->scan -= drop - 1;
+}
+
+/**
+ * Take the next complete line, return 1 if there is one, else 0
+ *
+ * *line is NUL-terminated, without its terminator.
+ */
+int rx_ring_next(struct rx_ring *r, char **line, size_t *len) {
+  while (r->scan != r->head) {
+    char c = r->buf[r->scan & r->mask];
+    if (r->after_cr) {
+      r->after_cr = 0;
+      if (c == '\n' && r->scan == r->tail) {
+        r->tail = ++r->scan;
+        continue;
+      }
+    }
+    // the next special byte in the contiguous part from scan on
+    size_t at = r->scan & r->mask;
+    size_t n = r->head - r->scan < r->size - at ? r->head - r->scan
+                                                : r->size - at;
+    const char *p = r->buf + at, *end = p + n;
+    if (r->erase) {
+      while (p < end && *p != '\n' && *p != '\r' && *p != '\b' && *p != 0x7f)
+        p++;
+    } else {
+      while (p < end && *p != '\n' && *p != '\r') p++;
+    }
+    r->scan += p - (r->buf + at);
+    if (p == end) continue;
+    c = *p;
+    if (c == '\b' || c == 0x7f) {
+      rx_ring_erase(r);
+      continue;
+    }
+    size_t start = r->tail;
+    n = r->scan - start;
+    r->after_cr = c == '\r';
+    r->tail = ++r->scan;
+    if (r->discarding) {
+      r->discarding = 0;
+      continue;
+    }
+    at = start & r->mask;
+    if (at + n < r->size) {
+      *line = r->buf + at;  // in place, over the terminator
+    } else {
+      size_t first = r->size - at;
+      memcpy(r->scratch, r->buf + at, first);
+      memcpy(r->scratch + first, r->buf, n - first);
+      *line = r->scratch;
+      r->wrapped++;
+    }
+    (*line)[n] = '\0';
+    *len = n;
+    r->lines++;
+    return 1;
+  }
+  if (r->head - r->tail == r->size) {  // full and no end of line
+    r->tail = r->head;
+    r->discarding = 1;
+    r->overflows++;
+  }
+  if (r->tail == r->head) r->head = r->scan = r->tail = 0;  // read unwrapped
+  return 0;
+}
+
+/**
+ * Call fn(ctx, line, len) for every complete line buffered
+ */
+void rx_ring_parse(struct rx_ring *r, rx_ring_fn fn, void *ctx) {
+  char *line;
+  size_t len;
+  while (rx_ring_next(r, &line, &len)) fn(ctx, line, len);
+}
+
+/**
+ * Read everything available on the non-blocking fd and parse it
+ *
+ * Return 0 once the fd would block, -1 on end of file or error.
+ */
+int rx_ring_read(struct rx_ring *r, int fd, rx_ring_fn fn, void *ctx) {
+  for (;;) {
+    ssize_t n = rx_ring_fill(r, fd);
+    if (n > 0) {
+      rx_ring_parse(r, fn, ctx);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+  }
+}
+
+/**
+ * Next line from a blocking fd, read as needed
+ *
+ * Return its length and set *line (valid until the next call), or return
+ * -1 on end of file or error.
+ */
+ssize_t rx_ring_getline(struct rx_ring *r, int fd, char **line) {
+  size_t len;
+  while (!rx_ring_next(r, line, &len)) {
+    ssize_t n = rx_ring_fill(r, fd);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+  }
+  return len;
+}
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * @file
+ * Benchmark the HTU21D sampling profiles
+ *
+ * For each profile (see htu21d.h) program the user register, then measure
+ * temperature + humidity pairs back to back, pipelined, for a fixed time and
+ * print the pairs per second and the spread of the readings. The original
+ * user register is restored at the end.
+ *
+ * Usage: sensor-bench [seconds per profile, default 3]
+ */
+
+#include <math.h>
+#include <signal.h>
+
+#include "mraa.h"
+#include "util.h"
+#include "htu21d.h"
+
+#define I2C_BUS 0
+
+volatile sig_atomic_t stopped = 0;
+
+void int_handler(int sig) {
+  printf("Received signal %d\n", sig);
+  stopped = 1;
+}
+
+/** Welford running mean / variance */
+struct spread {
+  uint64_t n;
+  double mean, m2;
+};
+
+void spread_add(struct spread *s, double x) {
+  double delta = x - s->mean;
+  s->mean += delta / ++s->n;
+  s->m2 += delta * (x - s->mean);
+}
+
+double spread_sd(const struct spread *s) {
+  return s->n > 1 ? sqrt(s->m2 / (s->n - 1)) : 0;
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 3;
+
+  struct htu21d dev;
+  if (htu21d_init(&dev, I2C_BUS)) {
+    fprintf(stderr, "Cannot initalize HTU21D on I2C bus %d\n", I2C_BUS);
+    printf("Did you run with sudo?\n");
+    exit(EXIT_FAILURE);
+  }
+  uint8_t original = dev.user_reg;
+
+  signal(SIGINT, int_handler);
+
+  printf("%-9s %10s %10s %12s %12s %8s\n", "profile", "pairs/s", "limit",
+         "temp sd [C]", "hum sd [%]", "errors");
+  for (int p = 0; p < HTU21D_PROFILES && !stopped; p++) {
+    if (htu21d_set_profile(&dev, p)) {
+      fprintf(stderr, "Cannot select the %s profile\n", htu21d_profile_names[p]);
+      continue;
+    }
+    struct spread temp = {0}, hum = {0};
+    uint64_t errors = 0;
+    uint64_t t0 = monotonic_ns();
+    uint64_t end = t0 + seconds * 1e9;
+    htu21d_start(&dev, HTU21D_TEMP);
+    while (!stopped && monotonic_ns() < end) {
+      uint16_t t_raw, h_raw;
+      int ok = !htu21d_collect(&dev, &t_raw);
+      htu21d_start(&dev, HTU21D_HUM);
+      ok &= !htu21d_collect(&dev, &h_raw);
+      htu21d_start(&dev, HTU21D_TEMP);
+      if (!ok) {
+        errors++;
+        continue;
+      }
+      spread_add(&temp, htu21d_temperature(t_raw));
+      spread_add(&hum, htu21d_humidity(h_raw));
+    }
+    uint16_t discard;
+    htu21d_collect(&dev, &discard);  // leave the sensor idle
+    double s = (monotonic_ns() - t0) / 1e9;
+    printf("%-9s %10.1f %10.1f %12.4f %12.4f %8llu\n", htu21d_profile_names[p],
+           temp.n / s, 1e6 / htu21d_profile_pair_us(p), spread_sd(&temp),
+           spread_sd(&hum), (unsigned long long)errors);
+  }
+
+  /* release resource section */
+  uint8_t restore[2] = {HTU21D_WRITE_USER_REG, original};
+  if (htu21d_write(&dev, restore, 2))
+    fprintf(stderr, "Cannot restore the user register\n");
+  htu21d_close(&dev);
+}
@@ -0,0 +1,160 @@
+/**
+ * @file
+ * Load generator for the serial-sensor command server
+ *
+ * For each client count, opens that many connections to the Unix socket of
+ * serial-sensor -s and keeps one query in flight on each (closed loop):
+ * send temp? or hum?, wait for the answer line, send the next. Reports
+ * queries per second and latency percentiles, and counts answers that are
+ * not a reading. The generator is single-threaded like the server, so at
+ * high client counts both compete for the CPU.
+ *
+ * Usage: sensor-load <socket> [seconds=5] [clients=1,10,100]
+ *   ./bin/serial-sensor -d none -s /tmp/sensor.sock &
+ *   ./bin/sensor-load /tmp/sensor.sock 5 1,10,100
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "util.h"
+#include "reactor.h"
+#include "line_buf.h"
+
+#define MAX_CLIENTS 1000
+
+struct load_client {
+  struct reactor_handler h;
+  struct line_buf in;
+  uint64_t t_sent;
+  int kind;  // 0: temp?, 1: hum?
+};
+
+struct reactor reactor;
+uint32_t *latency_ns;
+size_t nlat, cap;
+uint64_t bad, deadline;
+
+int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Send the next query, return 0 on success
+ */
+int send_query(struct load_client *c) {
+  static const char *const q[] = {"temp?\n", "hum?\n"};
+  c->kind ^= 1;
+  c->t_sent = monotonic_ns();
+  ssize_t n = strlen(q[c->kind]);
+  return write(c->h.fd, q[c->kind], n) == n ? 0 : -1;
+}
+
+void on_answer(void *ctx, char *line, size_t len) {
+  (void)len;
+  struct load_client *c = ctx;
+  uint64_t now = monotonic_ns();
+  if (nlat == cap) {
+    cap = cap ? 2 * cap : 1 << 16;
+    latency_ns = realloc(latency_ns, cap * sizeof(*latency_ns));
+  }
+  latency_ns[nlat++] = now - c->t_sent;
+  const char *want = c->kind ? "Humidity: " : "Temperature: ";
+  if (strncmp(line, want, strlen(want))) bad++;
+  if (now < deadline && send_query(c)) bad++;
+}
+
+void on_readable(struct reactor_handler *h, uint32_t events) {
+  (void)events;
+  struct load_client *c = h->ctx;
+  if (line_buf_read(&c->in, h->fd, on_answer, c)) {
+    fprintf(stderr, "Server closed a connection\n");
+    reactor_del(&reactor, h);
+  }
+}
+
+int connect_unix(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+/**
+ * Run n closed-loop clients for seconds and print one result line
+ */
+int run(const char *path, int n, double seconds) {
+  struct load_client *c = calloc(n, sizeof(*c));
+  for (int i = 0; i < n; i++) {
+    c[i].h = (struct reactor_handler){connect_unix(path), on_readable, &c[i]};
+    line_buf_init(&c[i].in);
+    if (c[i].h.fd < 0 || reactor_add(&reactor, &c[i].h, EPOLLIN)) {
+      perror("Cannot connect to the server");
+      return -1;
+    }
+  }
+  nlat = 0;
+  bad = 0;
+  uint64_t t0 = monotonic_ns();
+  deadline = t0 + seconds * 1e9;
+  for (int i = 0; i < n; i++) send_query(&c[i]);
+  // let the queries in flight at the deadline come back
+  while (monotonic_ns() < deadline + 200000000ull)
+    reactor_run_once(&reactor, 10);
+  double elapsed = (deadline - t0) / 1e9;
+
+  qsort(latency_ns, nlat, sizeof(*latency_ns), cmp_u32);
+  double p50 = nlat ? latency_ns[nlat / 2] / 1e3 : 0;
+  double p99 = nlat ? latency_ns[nlat * 99 / 100] / 1e3 : 0;
+  double max = nlat ? latency_ns[nlat - 1] / 1e3 : 0;
+  printf("%7d %12.0f %10.1f %10.1f %10.1f %8llu\n", n, nlat / elapsed, p50,
+         p99, max, (unsigned long long)bad);
+  fflush(stdout);
+
+  for (int i = 0; i < n; i++) {
+    reactor_del(&reactor, &c[i].h);
+    close(c[i].h.fd);
+  }
+  free(c);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <socket> [seconds] [clients,...]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  double seconds = argc > 2 ? atof(argv[2]) : 5;
+  char *counts = strdup(argc > 3 ? argv[3] : "1,10,100");
+  if (reactor_init(&reactor)) {
+    perror("epoll_create1");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%7s %12s %10s %10s %10s %8s\n", "clients", "queries/s", "p50 [us]",
+         "p99 [us]", "max [us]", "bad");
+  int ret = 0;
+  for (char *tok = strtok(counts, ","); tok && !ret; tok = strtok(NULL, ",")) {
+    int n = atoi(tok);
+    if (n < 1 || n > MAX_CLIENTS) continue;
+    ret = run(argv[1], n, seconds);
+  }
+
+  /* release resource section */
+  reactor_close(&reactor);
+  free(latency_ns);
+  free(counts);
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
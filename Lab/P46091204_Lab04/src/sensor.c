@@ -4,6 +4,15 @@
  * 
  * Print every line received from the serial port
  * Might need to use a serial client (e.g., PuTTY)
+ *
+ * The port runs in raw mode (serial_port.h): lines are assembled in a
+ * receive ring (rx_ring.h) that read() fills directly, and the text typed
+ * is echoed here, Backspace included. The latency profile returns each
+ * read() at the first byte; the throughput profile waits for SERIAL_BATCH
+ * bytes or a 0.1 s pause, fewer reads for pasted text at the cost of a
+ * slower echo.
+ *
+ * Usage: sensor [baud, default 115200] [latency|throughput, default latency]
  */
 
 #include <errno.h>
@@ -14,67 +23,97 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "tx_queue.h"
+#include "rx_ring.h"
+#include "serial_port.h"
+
 #define SERIAL_DEVICE "/dev/ttyS0"
 
 /**
- * Set up the TTY with file descriptor fd
- * Save the previous settings into old_term
+ * Queue the echo of the bytes of the ring from index from to index to
+ *
+ * *col counts the characters on the line so far, for Backspace.
  */
-void setup_terminal(int fd, struct termios *old_term) {
-  if (tcgetattr(fd, old_term) != 0) {
-    perror("tcgetattr");
-    exit(EXIT_FAILURE);
-  }
-  struct termios new_term = *old_term;
-  new_term.c_lflag |= ECHO | ECHOE | ICANON | ICRNL;
-  cfsetspeed(&new_term, B115200);  // set baud rate to 115200
-  if (tcsetattr(fd, TCSANOW, &new_term) != 0) {
-    perror("tcsetattr");
-    exit(EXIT_FAILURE);
+void echo(struct tx_queue *tx, const struct rx_ring *r, size_t from,
+          size_t to, int *col) {
+  static int after_cr;  // a '\n' next ends the same line
+  for (size_t i = from; i != to; i++) {
+    char c = r->buf[i & r->mask];
+    int cr = after_cr;
+    after_cr = c == '\r';
+    if (c == '\b' || c == 0x7f) {
+      if (*col > 0) {
+        (*col)--;
+        tx_queue_put_const(tx, "\b \b");
+      }
+    } else if (c == '\r' || c == '\n') {
+      *col = 0;
+      if (c == '\r' || !cr) tx_queue_put_const(tx, "\n");
+    } else {
+      (*col)++;
+      tx_queue_put(tx, &c, 1);
+    }
   }
 }
 
-/**
- * Restore the TTY with file descriptor fd with saved settings from old_term
- */
-void restore_terminal(int fd, struct termios *old_term) {
-  if (tcsetattr(fd, TCSANOW, old_term) != 0) {
-    perror("tcsetattr");
+int main(int argc, char *argv[]) {
+  long baud = argc > 1 ? atol(argv[1]) : 115200;
+  int mode = argc > 2 ? serial_mode_parse(argv[2]) : SERIAL_LATENCY;
+  if (!serial_speed(baud) || mode < 0) {
+    fprintf(stderr, "Usage: %s [baud] [latency|throughput]\n", argv[0]);
     exit(EXIT_FAILURE);
   }
-}
-
-int main() {
-  int fd = open(SERIAL_DEVICE, O_RDWR | O_NOCTTY);
+  struct termios old_term;
+  int fd = serial_open(SERIAL_DEVICE, baud, mode, &old_term);
   if (fd == -1) {
     perror("open_port: Unable to open " SERIAL_DEVICE " - ");
+    exit(EXIT_FAILURE);
   }
-  FILE *file = fdopen(fd, "r+");
-  if (!file) {
-    perror("fdopen");
+  struct rx_ring rx;
+  if (rx_ring_init(&rx, 10)) {
+    perror("rx_ring_init");
+    exit(EXIT_FAILURE);
   }
+  rx.erase = 1;
 
-  dprintf(fd, "Please input something. Server will show the same string.\n");
-  dprintf(fd, "Enter quit to quit\n\n");
-  struct termios old_term;
-  setup_terminal(fd, &old_term);
-  char *line = NULL;
+  // the greeting goes out with the first prompt, in one writev()
+  struct tx_queue tx;
+  tx_queue_init(&tx, fd, baud);
+  tx_queue_put_const(&tx, "Please input something. Server will show the same string.\n");
+  tx_queue_put_const(&tx, "Enter quit to quit\n\n");
+  int col = 0;
   while (1) {
-    dprintf(fd, "input> ");
-    ssize_t length = getline(&line, &(size_t){0}, file);
-    if (length == -1) {
-      if (!errno) break;
-      perror("getline");
-      exit(EXIT_FAILURE);
+    tx_queue_put_const(&tx, "input> ");
+    tx_queue_flush(&tx);
+    char *line;
+    size_t length;
+    ssize_t n = 1;
+    while (!rx_ring_next(&rx, &line, &length)) {
+      size_t from = rx.head;
+      n = rx_ring_fill(&rx, fd);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      echo(&tx, &rx, from, rx.head, &col);
+      tx_queue_flush(&tx);
     }
-    if (length >= 1 && line[length - 1] == '\n') {
-      line[length - 1] = '\0';
+    if (n < 0) {
+      perror("read");
+      exit(EXIT_FAILURE);
     }
+    if (n == 0) break;  // end of file
     if (!strcmp("quit", line)) break;
-    printf("Client says: %s (length=%ld)\n", line, strlen(line));
+    printf("Client says: %s (length=%zu)\n", line, length);
   }
-  dprintf(fd, "bye\n");
-  free(line);
-  restore_terminal(fd, &old_term);
+  tx_queue_put_const(&tx, "bye\n");
+  tx_queue_flush(&tx);
+  tx_queue_report(&tx, stdout);
+  printf("rx: %llu bytes in %llu reads (%.1f bytes/read), %llu lines\n",
+         (unsigned long long)rx.bytes, (unsigned long long)rx.reads,
+         rx.reads ? (double)rx.bytes / rx.reads : 0,
+         (unsigned long long)rx.lines);
+
+  /* release resource section */
+  rx_ring_free(&rx);
+  tcsetattr(fd, TCSANOW, &old_term);
   close(fd);
 }
@@ -0,0 +1,182 @@
+/**
+ * @file
+ * Background HTU21D sampler with a lock-free latest-value cache
+ *
+ * A thread measures temperature and humidity every period and publishes the
+ * raw values with their timestamps in a seqlock-protected snapshot. Readers
+ * copy the snapshot without taking a lock and retry only if a publish
+ * happened during the copy, so a query costs well under a microsecond
+ * instead of a 20-50 ms conversion.
+ *
+ * A reader that needs fresher data than max_age_ns measures itself; the bus
+ * mutex serialises that with the sampler, and the fresh value is published
+ * for everyone else too.
+ */
+
+#ifndef SENSOR_CACHE_H
+#define SENSOR_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "htu21d.h"
+
+struct sensor_cache {
+  struct htu21d *dev;
+  uint64_t period_ns;
+  pthread_t thread;
+  atomic_int running;
+  pthread_mutex_t bus;  // held for every conversion and every publish
+
+  // seqlock: odd while a publish is in progress
+  _Atomic uint32_t seq;
+  _Atomic uint16_t raw[2];  // indexed by htu21d_kind
+  _Atomic uint64_t t_ns[2];  // 0 until the first reading
+
+  _Atomic uint64_t hits, forced, errors;
+};
+
+/**
+ * Publish one raw reading (call with the bus mutex held)
+ */
+void sensor_cache_publish(struct sensor_cache *c, enum htu21d_kind kind,
+                          uint16_t raw, uint64_t t_ns) {
+  uint32_t s = atomic_load_explicit(&c->seq, memory_order_relaxed);
+  atomic_store_explicit(&c->seq, s + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&c->raw[kind], raw, memory_order_relaxed);
+  atomic_store_explicit(&c->t_ns[kind], t_ns, memory_order_relaxed);
+  atomic_store_explicit(&c->seq, s + 2, memory_order_release);
+}
+
+/**
+ * Measure kind and publish it, return 0 on success
+ */
+int sensor_cache_refresh(struct sensor_cache *c, enum htu21d_kind kind) {
+  pthread_mutex_lock(&c->bus);
+  uint16_t raw;
+  int ret = htu21d_measure(c->dev, kind, &raw);
+  if (ret == 0)
+    sensor_cache_publish(c, kind, raw, monotonic_ns());
+  else
+    atomic_fetch_add_explicit(&c->errors, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&c->bus);
+  return ret;
+}
+
+/**
+ * Consistent copy of one reading, return 0 if there is one yet
+ */
+int sensor_cache_load(struct sensor_cache *c, enum htu21d_kind kind,
+                      uint16_t *raw, uint64_t *t_ns) {
+  uint32_t s1, s2;
+  do {
+    s1 = atomic_load_explicit(&c->seq, memory_order_acquire);
+    *raw = atomic_load_explicit(&c->raw[kind], memory_order_relaxed);
+    *t_ns = atomic_load_explicit(&c->t_ns[kind], memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    s2 = atomic_load_explicit(&c->seq, memory_order_relaxed);
+  } while ((s1 & 1) || s1 != s2);
+  return *t_ns ? 0 : -1;
+}
+
+/**
+ * Latest reading no older than max_age_ns, measuring if the cache is older
+ *
+ * age_ns (may be NULL) receives the age of the returned value. Return 0 on
+ * success, -1 if no reading could be obtained.
+ */
+int sensor_cache_get(struct sensor_cache *c, enum htu21d_kind kind,
+                     uint64_t max_age_ns, uint16_t *raw, uint64_t *age_ns) {
+  uint64_t t;
+  int ret = sensor_cache_load(c, kind, raw, &t);
+  if (ret || monotonic_ns() - t > max_age_ns) {
+    pthread_mutex_lock(&c->bus);
+    // the sampler may have published while we waited for the bus
+    ret = sensor_cache_load(c, kind, raw, &t);
+    if (ret || monotonic_ns() - t > max_age_ns) {
+      atomic_fetch_add_explicit(&c->forced, 1, memory_order_relaxed);
+      uint16_t fresh;
+      if (htu21d_measure(c->dev, kind, &fresh) == 0) {
+        sensor_cache_publish(c, kind, fresh, monotonic_ns());
+        ret = sensor_cache_load(c, kind, raw, &t);
+      } else {
+        // keep whatever is cached, stale or not
+        atomic_fetch_add_explicit(&c->errors, 1, memory_order_relaxed);
+      }
+    }
+    pthread_mutex_unlock(&c->bus);
+    if (ret) return -1;
+  } else {
+    atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+  }
+  uint64_t now = monotonic_ns();
+  if (age_ns) *age_ns = now > t ? now - t : 0;
+  return 0;
+}
+
+void *sensor_cache_thread(void *arg) {
+  struct sensor_cache *c = arg;
+  uint64_t deadline = monotonic_ns();
+  while (atomic_load_explicit(&c->running, memory_order_relaxed)) {
+    sensor_cache_refresh(c, HTU21D_TEMP);
+    sensor_cache_refresh(c, HTU21D_HUM);
+    deadline += c->period_ns;
+    uint64_t now = monotonic_ns();
+    if (now < deadline)
+      delay_ns(deadline - now);
+    else
+      deadline = now;  // a forced read held the bus: do not burst
+  }
+  return NULL;
+}
+
+/**
+ * Set up an empty cache for dev without starting the sampling thread
+ *
+ * For callers that sample on their own schedule and publish from a single
+ * thread; sensor_cache_start() does this and starts the thread.
+ */
+void sensor_cache_init(struct sensor_cache *c, struct htu21d *dev,
+                       double period_ms) {
+  c->dev = dev;
+  c->period_ns = period_ms * 1e6;
+  atomic_init(&c->seq, 0);
+  for (int k = 0; k < 2; k++) {
+    atomic_init(&c->raw[k], 0);
+    atomic_init(&c->t_ns[k], 0);
+  }
+  atomic_init(&c->hits, 0);
+  atomic_init(&c->forced, 0);
+  atomic_init(&c->errors, 0);
+  atomic_init(&c->running, 0);
+  pthread_mutex_init(&c->bus, NULL);
+}
+
+void sensor_cache_destroy(struct sensor_cache *c) {
+  pthread_mutex_destroy(&c->bus);
+}
+
+/**
+ * Start sampling dev every period_ms, return 0 on success
+ */
+int sensor_cache_start(struct sensor_cache *c, struct htu21d *dev,
+                       double period_ms) {
+  sensor_cache_init(c, dev, period_ms);
+  atomic_store(&c->running, 1);
+  if (pthread_create(&c->thread, NULL, sensor_cache_thread, c)) {
+    sensor_cache_destroy(c);
+    return -1;
+  }
+  return 0;
+}
+
+void sensor_cache_stop(struct sensor_cache *c) {
+  atomic_store(&c->running, 0);
+  pthread_join(c->thread, NULL);
+  sensor_cache_destroy(c);
+}
+
+#endif
@@ -0,0 +1,642 @@
+/**
+ * @file
+ * Fixed-size on-disk ring of compressed sensor readings
+ *
+ * The file is a header followed by nblocks blocks of SLOG_BLOCK_SIZE bytes,
+ * mapped into memory. Each block holds the readings of one series
+ * (temperature, humidity, ADC, ...) compressed the way Facebook's Gorilla
+ * does it:
+ *   timestamps  delta of delta in ms: '0' when the spacing did not change,
+ *               otherwise a 2-4 bit prefix and 7, 9, 12 or 32 bits
+ *   values      32-bit float XORed with the previous value: '0' when equal,
+ *               '10' + the meaningful bits when they fit the previous
+ *               leading / trailing zero window, otherwise '11' + 5 bits
+ *               leading zeros + 5 bits length + the meaningful bits
+ * A steady 10 Hz reading that did not change costs 2 bits.
+ *
+ * Blocks are allocated round robin, so when the ring is full the oldest block
+ * is reused, whatever series it held. Each block header has a sequence
+ * number, the covered time range and the value range.
+ *
+ * Crash safety: a reading is first encoded past the committed end of its
+ * block, then committed by one aligned 64-bit store of (count, bit length).
+ * A crash leaves either the old or the new commit, never a torn one, and
+ * slog_open() discards any bits past it. A full block is sealed with a CRC
+ * and msync()ed; a sealed block whose CRC does not match (a torn page after a
+ * power loss) is freed when a writer opens the file, and skipped by readers,
+ * which check each sealed block once per open before they decode or index
+ * it (slog_block_ok()). A reader may map the file read-only while a writer
+ * appends: it only decodes committed readings, and slog_refresh() picks up
+ * the blocks allocated since.
+ *
+ * The blocks of a series are in time order along the ring, so a slog_index
+ * (the block time ranges of one series) finds the first block of a time
+ * range with a binary search instead of decoding from the oldest reading.
+ */
+
+#ifndef SENSOR_LOG_H
+#define SENSOR_LOG_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLOG_FILE_MAGIC "SLOGRING"
+#define SLOG_VERSION 1
+#define SLOG_BLOCK_MAGIC 0x4b4c4253  // "SBLK"
+#define SLOG_BLOCK_SIZE 4096
+#define SLOG_MAX_SERIES 16
+#define SLOG_MAX_SAMPLE_BITS 80  // '1111' + 32 + '11' + 5 + 5 + 32
+
+enum slog_series { SLOG_TEMPERATURE, SLOG_HUMIDITY, SLOG_ADC };
+static const char *const slog_series_names[SLOG_MAX_SERIES] = {
+    "temperature", "humidity", "adc"};
+
+enum slog_state { SLOG_FREE, SLOG_OPEN, SLOG_SEALED };
+
+struct slog_file_header {
+  char magic[8];
+  uint32_t version, block_size, nblocks;
+};
+
+struct slog_block {
+  uint32_t magic;
+  uint16_t series;
+  uint8_t state;
+  uint8_t reserved;
+  uint64_t seq;     // allocation order, 0 never used
+  uint64_t commit;  // count << 32 | bits, stored atomically
+  int64_t t_first, t_last;
+  float v_min, v_max;
+  uint32_t crc;  // of the whole block with crc = 0, once sealed
+  uint32_t pad[3];
+  uint8_t payload[];
+};
+
+#define SLOG_PAYLOAD_BYTES (SLOG_BLOCK_SIZE - sizeof(struct slog_block))
+#define SLOG_PAYLOAD_BITS (SLOG_PAYLOAD_BYTES * 8)
+
+/** Encoder / decoder state of one block */
+struct slog_codec {
+  uint32_t pos, count;  // bits and readings so far
+  int64_t t, d;         // last timestamp and delta
+  uint32_t v;           // last value bits
+  int lead, trail;      // current XOR window, lead < 0: none yet
+};
+
+struct slog {
+  int fd;
+  int writable;
+  uint32_t nblocks;
+  uint8_t *map;
+  size_t map_len;
+  uint32_t next;  // block allocated next (the oldest)
+  uint64_t seq;   // highest sequence number in use
+  int block[SLOG_MAX_SERIES];  // open block of each series, -1 if none
+  struct slog_codec enc[SLOG_MAX_SERIES];
+  uint64_t appended, sealed;
+  uint64_t *checked;  // by block: seq << 1 | CRC mismatch, 0: not checked
+};
+
+/**
+ * Current CLOCK_REALTIME in milliseconds, the timestamps of the log
+ */
+int64_t slog_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t slog_crc32(const uint8_t *p, size_t n, uint32_t crc) {
+  static uint32_t table[256];
+  if (!table[1]) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+  crc = ~crc;
+  while (n--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+struct slog_block *slog_block_at(const struct slog *log, uint32_t i) {
+  return (struct slog_block *)(log->map + (size_t)(i + 1) * SLOG_BLOCK_SIZE);
+}
+
+uint32_t slog_block_crc(const struct slog_block *b) {
+  struct slog_block h = *b;
+  h.crc = 0;
+  uint32_t crc = slog_crc32((const uint8_t *)&h, sizeof(h), 0);
+  return slog_crc32(b->payload, SLOG_PAYLOAD_BYTES, crc);
+}
+
+/**
+ * Whether block i may be decoded: a sealed block must match its CRC
+ *
+ * The result is remembered until the block is reused (a new seq).
+ */
+int slog_block_ok(const struct slog *log, uint32_t i) {
+  const struct slog_block *b = slog_block_at(log, i);
+  if (b->state != SLOG_SEALED) return 1;
+  uint64_t seq = b->seq, *c = &log->checked[i];
+  if (*c >> 1 != seq) *c = seq << 1 | (b->crc != slog_block_crc(b));
+  return !(*c & 1);
+}
+
+uint64_t slog_block_commit(const struct slog_block *b) {
+  return __atomic_load_n(&b->commit, __ATOMIC_ACQUIRE);
+}
+
+/** Append n (<= 64) bits of v, MSB first, to a zeroed bit stream */
+static inline void slog_put(uint8_t *p, uint32_t *pos, uint64_t v, int n) {
+  while (n > 0) {
+    int off = *pos & 7, room = 8 - off, take = n < room ? n : room;
+    uint8_t bits = (v >> (n - take)) & ((1u << take) - 1);
+    p[*pos >> 3] |= bits << (room - take);
+    *pos += take;
+    n -= take;
+  }
+}
+
+/** Read n (<= 64) bits, return -1 if that would pass end */
+static inline int slog_get(const uint8_t *p, uint32_t *pos, uint32_t end,
+                           int n, uint64_t *v) {
+  if (*pos + n > end) return -1;
+  uint64_t r = 0;
+  while (n > 0) {
+    int off = *pos & 7, room = 8 - off, take = n < room ? n : room;
+    r = r << take | ((p[*pos >> 3] >> (room - take)) & ((1u << take) - 1));
+    *pos += take;
+    n -= take;
+  }
+  *v = r;
+  return 0;
+}
+
+uint32_t slog_float_bits(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+float slog_bits_float(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+/**
+ * Encode one reading after c; the block must have SLOG_MAX_SAMPLE_BITS room
+ */
+void slog_encode(struct slog_codec *c, uint8_t *p, int64_t t, float value) {
+  uint32_t v = slog_float_bits(value);
+  if (c->count++ == 0) {
+    slog_put(p, &c->pos, v, 32);  // the timestamp is t_first in the header
+    c->t = t;
+    c->d = 0;
+    c->v = v;
+    c->lead = -1;
+    return;
+  }
+  int64_t d = t - c->t, dod = d - c->d;
+  if (dod == 0) {
+    slog_put(p, &c->pos, 0, 1);
+  } else if (dod >= -63 && dod <= 64) {
+    slog_put(p, &c->pos, 0x2, 2);
+    slog_put(p, &c->pos, dod + 63, 7);
+  } else if (dod >= -255 && dod <= 256) {
+    slog_put(p, &c->pos, 0x6, 3);
+    slog_put(p, &c->pos, dod + 255, 9);
+  } else if (dod >= -2047 && dod <= 2048) {
+    slog_put(p, &c->pos, 0xe, 4);
+    slog_put(p, &c->pos, dod + 2047, 12);
+  } else {
+    slog_put(p, &c->pos, 0xf, 4);
+    slog_put(p, &c->pos, (uint32_t)dod, 32);
+  }
+  c->t = t;
+  c->d = d;
+
+  uint32_t x = v ^ c->v;
+  c->v = v;
+  if (x == 0) {
+    slog_put(p, &c->pos, 0, 1);
+    return;
+  }
+  int lead = __builtin_clz(x), trail = __builtin_ctz(x);
+  if (c->lead >= 0 && lead >= c->lead && trail >= c->trail) {
+    slog_put(p, &c->pos, 0x2, 2);
+    slog_put(p, &c->pos, x >> c->trail, 32 - c->lead - c->trail);
+  } else {
+    int len = 32 - lead - trail;
+    slog_put(p, &c->pos, 0x3, 2);
+    slog_put(p, &c->pos, lead, 5);
+    slog_put(p, &c->pos, len - 1, 5);
+    slog_put(p, &c->pos, x >> trail, len);
+    c->lead = lead;
+    c->trail = trail;
+  }
+}
+
+/**
+ * Decode the reading after c from a stream of end bits, return 0 on success
+ */
+int slog_decode(struct slog_codec *c, const uint8_t *p, uint32_t end,
+                int64_t t_first, int64_t *t, float *value) {
+  uint64_t b;
+  if (c->count == 0) {
+    if (slog_get(p, &c->pos, end, 32, &b)) return -1;
+    c->t = t_first;
+    c->d = 0;
+    c->v = b;
+    c->lead = -1;
+  } else {
+    int prefix = 0, n;
+    while (prefix < 4) {  // count leading ones, at most four
+      if (slog_get(p, &c->pos, end, 1, &b)) return -1;
+      if (!b) break;
+      prefix++;
+    }
+    static const int widths[5] = {0, 7, 9, 12, 32};
+    static const int64_t bias[5] = {0, 63, 255, 2047, 0};
+    int64_t dod = 0;
+    if ((n = widths[prefix])) {
+      if (slog_get(p, &c->pos, end, n, &b)) return -1;
+      dod = prefix == 4 ? (int64_t)(int32_t)b : (int64_t)b - bias[prefix];
+    }
+    c->d += dod;
+    c->t += c->d;
+
+    if (slog_get(p, &c->pos, end, 1, &b)) return -1;
+    if (b) {
+      if (slog_get(p, &c->pos, end, 1, &b)) return -1;
+      if (b) {
+        uint64_t lead, len;
+        if (slog_get(p, &c->pos, end, 5, &lead) ||
+            slog_get(p, &c->pos, end, 5, &len))
+          return -1;
+        c->lead = lead;
+        c->trail = 32 - lead - (len + 1);
+        if (c->trail < 0) return -1;
+      } else if (c->lead < 0) {
+        return -1;
+      }
+      if (slog_get(p, &c->pos, end, 32 - c->lead - c->trail, &b)) return -1;
+      c->v ^= (uint32_t)b << c->trail;
+    }
+  }
+  c->count++;
+  *t = c->t;
+  *value = slog_bits_float(c->v);
+  return 0;
+}
+
+/**
+ * Decode the committed readings of an open block into c and repair it
+ *
+ * Keeps the longest prefix that decodes, rebuilds t_last / v_min / v_max
+ * and clears everything past the commit.
+ */
+void slog_recover_block(struct slog_block *b, struct slog_codec *c) {
+  uint64_t commit = b->commit;
+  uint32_t count = commit >> 32, bits = commit & 0xffffffff;
+  if (bits > SLOG_PAYLOAD_BITS) bits = SLOG_PAYLOAD_BITS;
+  memset(c, 0, sizeof(*c));
+  struct slog_codec next = *c;
+  int64_t t;
+  float v;
+  while (next.count < count &&
+         slog_decode(&next, b->payload, bits, b->t_first, &t, &v) == 0) {
+    *c = next;
+    if (c->count == 1 || v < b->v_min) b->v_min = v;
+    if (c->count == 1 || v > b->v_max) b->v_max = v;
+    b->t_last = t;
+  }
+  size_t used = (c->pos + 7) / 8;
+  if (c->pos & 7) b->payload[c->pos / 8] &= 0xff00 >> (c->pos & 7);
+  memset(b->payload + used, 0, SLOG_PAYLOAD_BYTES - used);
+  b->commit = (uint64_t)c->count << 32 | c->pos;
+}
+
+/**
+ * Find where allocation continues: after the block with the newest sequence
+ *
+ * A reader calls it again to see blocks a writer allocated since.
+ */
+void slog_refresh(struct slog *log) {
+  uint32_t newest = log->nblocks - 1;
+  log->seq = 0;
+  for (uint32_t i = 0; i < log->nblocks; i++) {
+    const struct slog_block *b = slog_block_at(log, i);
+    if (b->magic != SLOG_BLOCK_MAGIC || b->state == SLOG_FREE) continue;
+    if (b->seq > log->seq) {
+      log->seq = b->seq;
+      newest = i;
+    }
+  }
+  log->next = (newest + 1) % log->nblocks;
+}
+
+/**
+ * Open or create a log of nblocks blocks, return 0 on success
+ *
+ * An existing file keeps its own size (nblocks is only used to create one).
+ * Read-only opens need no write permission and change nothing.
+ */
+int slog_open(struct slog *log, const char *path, uint32_t nblocks,
+              int writable) {
+  memset(log, 0, sizeof(*log));
+  log->writable = writable;
+  for (int s = 0; s < SLOG_MAX_SERIES; s++) log->block[s] = -1;
+  log->fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC
+                                : O_RDONLY | O_CLOEXEC, 0644);
+  if (log->fd < 0) return -1;
+
+  struct slog_file_header h;
+  struct stat st;
+  if (fstat(log->fd, &st)) goto fail;
+  if (st.st_size == 0 && writable) {
+    if (nblocks < 2) {
+      errno = EINVAL;
+      goto fail;
+    }
+    memcpy(h.magic, SLOG_FILE_MAGIC, 8);
+    h.version = SLOG_VERSION;
+    h.block_size = SLOG_BLOCK_SIZE;
+    h.nblocks = nblocks;
+    if (ftruncate(log->fd, (off_t)(nblocks + 1) * SLOG_BLOCK_SIZE) ||
+        pwrite(log->fd, &h, sizeof(h), 0) != sizeof(h))
+      goto fail;
+  } else if (pread(log->fd, &h, sizeof(h), 0) != sizeof(h) ||
+             memcmp(h.magic, SLOG_FILE_MAGIC, 8) ||
+             h.version != SLOG_VERSION || h.block_size != SLOG_BLOCK_SIZE ||
+             h.nblocks < 2 ||
+             st.st_size < ((off_t)h.nblocks + 1) * SLOG_BLOCK_SIZE) {
+    errno = EINVAL;
+    goto fail;
+  }
+  log->nblocks = h.nblocks;
+  log->map_len = (size_t)(h.nblocks + 1) * SLOG_BLOCK_SIZE;
+  log->map = mmap(NULL, log->map_len, PROT_READ | (writable ? PROT_WRITE : 0),
+                  MAP_SHARED, log->fd, 0);
+  if (log->map == MAP_FAILED) goto fail;
+  log->checked = calloc(log->nblocks, sizeof(*log->checked));
+  if (!log->checked) {
+    munmap(log->map, log->map_len);
+    goto fail;
+  }
+
+  slog_refresh(log);
+  if (!writable) return 0;
+
+  for (uint32_t i = 0; i < log->nblocks; i++) {
+    struct slog_block *b = slog_block_at(log, i);
+    if (b->magic != SLOG_BLOCK_MAGIC || b->series >= SLOG_MAX_SERIES) continue;
+    if (b->state == SLOG_SEALED && b->crc != slog_block_crc(b)) {
+      b->state = SLOG_FREE;  // torn by a power loss
+    } else if (b->state == SLOG_OPEN) {
+      int s = b->series;
+      struct slog_codec c;
+      slog_recover_block(b, &c);
+      if (log->block[s] < 0 || b->seq > slog_block_at(log, log->block[s])->seq) {
+        log->block[s] = i;
+        log->enc[s] = c;
+      }
+    }
+  }
+  return 0;
+
+fail:
+  close(log->fd);
+  return -1;
+}
+
+/**
+ * Seal the open block of series with its CRC and start writing it out
+ */
+void slog_seal(struct slog *log, int series) {
+  if (log->block[series] < 0) return;
+  struct slog_block *b = slog_block_at(log, log->block[series]);
+  b->state = SLOG_SEALED;
+  b->crc = slog_block_crc(b);
+  msync(b, SLOG_BLOCK_SIZE, MS_ASYNC);
+  log->block[series] = -1;
+  log->sealed++;
+}
+
+/**
+ * Take the oldest block for series, overwriting whatever it held
+ */
+struct slog_block *slog_new_block(struct slog *log, int series, int64_t t) {
+  uint32_t i = log->next;
+  log->next = (i + 1) % log->nblocks;
+  for (int s = 0; s < SLOG_MAX_SERIES; s++)
+    if (log->block[s] == (int)i) log->block[s] = -1;  // its data is the oldest
+
+  struct slog_block *b = slog_block_at(log, i);
+  b->state = SLOG_FREE;  // invalid until fully initialised
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memset(b->payload, 0, SLOG_PAYLOAD_BYTES);
+  b->magic = SLOG_BLOCK_MAGIC;
+  b->series = series;
+  b->seq = ++log->seq;
+  b->commit = 0;
+  b->t_first = b->t_last = t;
+  b->v_min = b->v_max = 0;
+  b->crc = 0;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  b->state = SLOG_OPEN;
+  log->block[series] = i;
+  memset(&log->enc[series], 0, sizeof(log->enc[series]));
+  return b;
+}
+
+/**
+ * Append one reading of series at t_ms, return 0 on success
+ *
+ * Timestamps of a series must not go backwards (EINVAL).
+ */
+int slog_append(struct slog *log, int series, int64_t t_ms, float value) {
+  if (!log->writable || series < 0 || series >= SLOG_MAX_SERIES) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct slog_codec *c = &log->enc[series];
+  struct slog_block *b = NULL;
+  if (log->block[series] >= 0) {
+    b = slog_block_at(log, log->block[series]);
+    if (t_ms < c->t) {
+      errno = EINVAL;
+      return -1;
+    }
+    // a delta of delta must fit in 32 bits
+    if (c->pos + SLOG_MAX_SAMPLE_BITS > SLOG_PAYLOAD_BITS ||
+        t_ms - c->t > INT32_MAX / 2) {
+      slog_seal(log, series);
+      b = NULL;
+    }
+  }
+  if (!b) b = slog_new_block(log, series, t_ms);
+
+  slog_encode(c, b->payload, t_ms, value);
+  if (c->count == 1 || value < b->v_min) b->v_min = value;
+  if (c->count == 1 || value > b->v_max) b->v_max = value;
+  b->t_last = t_ms;
+  __atomic_store_n(&b->commit, (uint64_t)c->count << 32 | c->pos,
+                   __ATOMIC_RELEASE);
+  log->appended++;
+  return 0;
+}
+
+/**
+ * Write everything appended so far to the disk (blocking)
+ */
+int slog_sync(struct slog *log) {
+  return msync(log->map, log->map_len, MS_SYNC);
+}
+
+void slog_close(struct slog *log) {
+  free(log->checked);
+  munmap(log->map, log->map_len);
+  close(log->fd);
+}
+
+/** Readings of one series in time order */
+struct slog_iter {
+  const struct slog *log;
+  int series;
+  int64_t from, to;
+  uint32_t visited;  // blocks looked at, in allocation order from the oldest
+  const struct slog_block *b;
+  struct slog_codec c;
+  uint32_t end, count;  // commit of the current block
+};
+
+void slog_iter_init(struct slog_iter *it, const struct slog *log, int series,
+                    int64_t from_ms, int64_t to_ms) {
+  memset(it, 0, sizeof(*it));
+  it->log = log;
+  it->series = series;
+  it->from = from_ms;
+  it->to = to_ms;
+}
+
+/**
+ * Next reading with from <= t <= to, return 1 if there is one
+ *
+ * Blocks that fail their CRC or fail to decode are skipped.
+ */
+int slog_iter_next(struct slog_iter *it, int64_t *t, float *value) {
+  const struct slog *log = it->log;
+  for (;;) {
+    while (it->b && it->c.count < it->count) {
+      if (slog_decode(&it->c, it->b->payload, it->end, it->b->t_first, t,
+                      value))
+        break;
+      if (*t > it->to) {
+        it->b = NULL;
+        break;
+      }
+      if (*t >= it->from) return 1;
+    }
+    it->b = NULL;
+    if (it->visited == log->nblocks) return 0;
+    uint32_t i = (log->next + it->visited++) % log->nblocks;
+    const struct slog_block *b = slog_block_at(log, i);
+    if (b->magic != SLOG_BLOCK_MAGIC || b->series != it->series ||
+        b->state == SLOG_FREE || b->t_last < it->from ||
+        !slog_block_ok(log, i))
+      continue;
+    if (b->t_first > it->to) {  // later blocks of the series are later still
+      it->visited = log->nblocks;
+      return 0;
+    }
+    uint64_t commit = slog_block_commit(b);
+    it->b = b;
+    it->count = commit >> 32;
+    it->end = commit & 0xffffffff;
+    if (it->end > SLOG_PAYLOAD_BITS) it->end = SLOG_PAYLOAD_BITS;
+    memset(&it->c, 0, sizeof(it->c));
+  }
+}
+
+/** Time ranges of the blocks of one series, oldest first */
+struct slog_index {
+  uint32_t n, cap;
+  uint32_t *pos;  // ring offset from the oldest block, as slog_iter counts
+  int64_t *t_first, *t_last;
+};
+
+/**
+ * (Re)build idx for series from the block headers, return 0 on success
+ */
+int slog_index_build(struct slog_index *idx, const struct slog *log,
+                     int series) {
+  if (idx->cap < log->nblocks) {
+    free(idx->pos);
+    free(idx->t_first);
+    free(idx->t_last);
+    idx->cap = log->nblocks;
+    idx->pos = malloc(idx->cap * sizeof(*idx->pos));
+    idx->t_first = malloc(idx->cap * sizeof(*idx->t_first));
+    idx->t_last = malloc(idx->cap * sizeof(*idx->t_last));
+    if (!idx->pos || !idx->t_first || !idx->t_last) {
+      idx->cap = 0;
+      return -1;
+    }
+  }
+  idx->n = 0;
+  for (uint32_t k = 0; k < log->nblocks; k++) {
+    uint32_t i = (log->next + k) % log->nblocks;
+    const struct slog_block *b = slog_block_at(log, i);
+    if (b->magic != SLOG_BLOCK_MAGIC || b->series != series ||
+        b->state == SLOG_FREE || !slog_block_ok(log, i))
+      continue;
+    idx->pos[idx->n] = k;
+    idx->t_first[idx->n] = b->t_first;
+    idx->t_last[idx->n] = b->t_last;
+    idx->n++;
+  }
+  return 0;
+}
+
+/**
+ * Index of the first block that may hold a reading at or after t
+ */
+uint32_t slog_index_find(const struct slog_index *idx, int64_t t) {
+  uint32_t lo = 0, hi = idx->n;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (idx->t_last[mid] < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Let it start at the first block of its range instead of the oldest block
+ */
+void slog_iter_seek(struct slog_iter *it, const struct slog_index *idx) {
+  uint32_t i = slog_index_find(idx, it->from);
+  it->b = NULL;
+  it->visited = i < idx->n ? idx->pos[i] : it->log->nblocks;
+}
+
+void slog_index_free(struct slog_index *idx) {
+  free(idx->pos);
+  free(idx->t_first);
+  free(idx->t_last);
+  memset(idx, 0, sizeof(*idx));
+}
+
+#endif
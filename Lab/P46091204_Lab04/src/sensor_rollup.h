@@ -0,0 +1,311 @@
+/**
+ * @file
+ * Minute, hour and day aggregates of a sensor log
+ *
+ * A rollup file next to the raw log (<log>.rollup) holds, for every series,
+ * one ring of buckets per tier. A bucket is count / min / max / sum of the
+ * readings in its interval and lives in slot (start / width) % slots, so a
+ * time maps to its bucket without searching; a slot still holding an older
+ * interval counts as empty.
+ *
+ *   tier     width   slots   covers
+ *   minute   1 min   20160   14 days
+ *   hour     1 h     17568   2 years
+ *   day      1 d      3660   10 years
+ *
+ * rollup_update() folds the readings appended to the log since the last
+ * call into all three tiers. A query then reads at most a few thousand
+ * buckets from the coarsest tier whose width divides the requested step,
+ * instead of decoding every reading in the range.
+ *
+ * Crash safety: the persisted progress of a series is the start of the
+ * minute being filled; everything before it is complete. After a crash that
+ * minute is cleared, its hour and day are recomputed from the finer tier and
+ * the minute is rolled up again from the raw log.
+ *
+ * One writer at a time: a writable open takes an exclusive flock() on the
+ * file for as long as it stays open, and fails with EWOULDBLOCK while
+ * another process holds it. Two writers would each fold the new readings in
+ * from their own progress and count them twice.
+ */
+
+#ifndef SENSOR_ROLLUP_H
+#define SENSOR_ROLLUP_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sensor_log.h"
+
+#define ROLLUP_MAGIC "SLOGROLL"
+#define ROLLUP_VERSION 1
+#define ROLLUP_TIERS 3
+#define ROLLUP_MAX_SERIES 4
+#define ROLLUP_HEADER_SIZE 4096
+
+enum rollup_tier { ROLLUP_MINUTE, ROLLUP_HOUR, ROLLUP_DAY };
+static const char *const rollup_tier_names[ROLLUP_TIERS] = {"minute", "hour",
+                                                            "day"};
+static const int64_t rollup_width_ms[ROLLUP_TIERS] = {60000, 3600000,
+                                                      86400000};
+static const uint32_t rollup_slots[ROLLUP_TIERS] = {20160, 17568, 3660};
+
+struct rollup_bucket {
+  int64_t t;  // start of the interval
+  uint32_t count;  // 0: empty
+  float min, max;
+  uint32_t pad;
+  double sum;
+};
+
+struct rollup_header {
+  char magic[8];
+  uint32_t version, nseries;
+  uint32_t slots[ROLLUP_TIERS];
+  int64_t done[ROLLUP_MAX_SERIES];  // readings before this are rolled up
+};
+
+struct rollup {
+  int fd;
+  uint8_t *map;
+  size_t map_len;
+  struct rollup_header *h;
+  struct rollup_bucket *tier[ROLLUP_MAX_SERIES][ROLLUP_TIERS];
+  int64_t last[ROLLUP_MAX_SERIES];  // newest reading rolled up so far
+  struct slog_index idx;
+  uint64_t rolled;
+};
+
+int64_t rollup_floor(int64_t t, int64_t width) {
+  int64_t r = t % width;
+  return t - (r < 0 ? r + width : r);
+}
+
+struct rollup_bucket *rollup_slot(const struct rollup *r, int series, int tier,
+                                  int64_t t) {
+  int64_t n = rollup_floor(t, rollup_width_ms[tier]) / rollup_width_ms[tier];
+  int64_t slot = n % rollup_slots[tier];
+  return &r->tier[series][tier][slot < 0 ? slot + rollup_slots[tier] : slot];
+}
+
+/**
+ * Bucket of tier holding t, or NULL if its slot holds another interval
+ */
+const struct rollup_bucket *rollup_get(const struct rollup *r, int series,
+                                       int tier, int64_t t) {
+  const struct rollup_bucket *b = rollup_slot(r, series, tier, t);
+  return b->count && b->t == rollup_floor(t, rollup_width_ms[tier]) ? b : NULL;
+}
+
+void rollup_merge(struct rollup_bucket *into, const struct rollup_bucket *b) {
+  if (!b || !b->count) return;
+  if (!into->count || b->min < into->min) into->min = b->min;
+  if (!into->count || b->max > into->max) into->max = b->max;
+  into->count += b->count;
+  into->sum += b->sum;
+}
+
+/**
+ * Recompute the bucket of tier (hour or day) holding t from the tier below
+ */
+void rollup_recompute(struct rollup *r, int series, int tier, int64_t t) {
+  int64_t start = rollup_floor(t, rollup_width_ms[tier]);
+  struct rollup_bucket sum = {.t = start};
+  for (int64_t u = start; u < start + rollup_width_ms[tier];
+       u += rollup_width_ms[tier - 1])
+    rollup_merge(&sum, rollup_get(r, series, tier - 1, u));
+  *rollup_slot(r, series, tier, t) = sum;
+}
+
+/**
+ * Undo a crash: clear the minute in progress and re-derive its hour and day
+ */
+void rollup_recover(struct rollup *r, int series) {
+  int64_t done = r->h->done[series];
+  if (!done) return;
+  memset(rollup_slot(r, series, ROLLUP_MINUTE, done), 0,
+         sizeof(struct rollup_bucket));
+  rollup_recompute(r, series, ROLLUP_HOUR, done);
+  rollup_recompute(r, series, ROLLUP_DAY, done);
+}
+
+/**
+ * Open or create the rollup file at path, return 0 on success
+ *
+ * A writable open fails with EWOULDBLOCK if another writer has the file.
+ */
+int rollup_open(struct rollup *r, const char *path, int writable) {
+  memset(r, 0, sizeof(*r));
+  r->map_len = ROLLUP_HEADER_SIZE;
+  for (int t = 0; t < ROLLUP_TIERS; t++)
+    r->map_len += (size_t)ROLLUP_MAX_SERIES * rollup_slots[t] *
+                  sizeof(struct rollup_bucket);
+  r->fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC
+                              : O_RDONLY | O_CLOEXEC, 0644);
+  if (r->fd < 0) return -1;
+  if (writable && flock(r->fd, LOCK_EX | LOCK_NB)) goto fail;
+  struct stat st;
+  if (fstat(r->fd, &st)) goto fail;
+  int fresh = st.st_size == 0;
+  if (fresh && (!writable || ftruncate(r->fd, r->map_len))) goto fail;
+  if (!fresh && st.st_size < (off_t)r->map_len) {
+    errno = EINVAL;
+    goto fail;
+  }
+  r->map = mmap(NULL, r->map_len, PROT_READ | (writable ? PROT_WRITE : 0),
+                MAP_SHARED, r->fd, 0);
+  if (r->map == MAP_FAILED) goto fail;
+  r->h = (struct rollup_header *)r->map;
+  if (fresh) {
+    memcpy(r->h->magic, ROLLUP_MAGIC, 8);
+    r->h->version = ROLLUP_VERSION;
+    r->h->nseries = ROLLUP_MAX_SERIES;
+    for (int t = 0; t < ROLLUP_TIERS; t++) r->h->slots[t] = rollup_slots[t];
+  } else if (memcmp(r->h->magic, ROLLUP_MAGIC, 8) ||
+             r->h->version != ROLLUP_VERSION ||
+             r->h->nseries != ROLLUP_MAX_SERIES ||
+             memcmp(r->h->slots, rollup_slots, sizeof(rollup_slots))) {
+    munmap(r->map, r->map_len);
+    errno = EINVAL;
+    goto fail;
+  }
+  uint8_t *p = r->map + ROLLUP_HEADER_SIZE;
+  for (int s = 0; s < ROLLUP_MAX_SERIES; s++) {
+    for (int t = 0; t < ROLLUP_TIERS; t++) {
+      r->tier[s][t] = (struct rollup_bucket *)p;
+      p += rollup_slots[t] * sizeof(struct rollup_bucket);
+    }
+    if (writable) rollup_recover(r, s);
+    r->last[s] = r->h->done[s] - 1;
+  }
+  return 0;
+
+fail:
+  close(r->fd);
+  return -1;
+}
+
+/**
+ * Fold one reading into the three tiers
+ */
+void rollup_add(struct rollup *r, int series, int64_t t, float v) {
+  int64_t minute = rollup_floor(t, rollup_width_ms[ROLLUP_MINUTE]);
+  if (minute != r->h->done[series]) {
+    // every reading before this minute is in: persist the progress first
+    __atomic_store_n(&r->h->done[series], minute, __ATOMIC_RELEASE);
+  }
+  for (int tier = 0; tier < ROLLUP_TIERS; tier++) {
+    struct rollup_bucket *b = rollup_slot(r, series, tier, t);
+    int64_t start = rollup_floor(t, rollup_width_ms[tier]);
+    if (b->t != start || !b->count) {
+      *b = (struct rollup_bucket){.t = start, .count = 1, .min = v, .max = v,
+                                  .sum = v};
+      continue;
+    }
+    b->count++;
+    if (v < b->min) b->min = v;
+    if (v > b->max) b->max = v;
+    b->sum += v;
+  }
+  r->last[series] = t;
+  r->rolled++;
+}
+
+/**
+ * Roll up everything appended to log since the last call
+ *
+ * Return the number of readings added. Readings must arrive in time order;
+ * one with the timestamp of the previous reading is not counted again.
+ */
+uint64_t rollup_update(struct rollup *r, const struct slog *log) {
+  uint64_t before = r->rolled;
+  for (int s = 0; s < ROLLUP_MAX_SERIES; s++) {
+    if (slog_index_build(&r->idx, log, s) || r->idx.n == 0) continue;
+    struct slog_iter it;
+    slog_iter_init(&it, log, s, r->last[s] + 1, INT64_MAX);
+    slog_iter_seek(&it, &r->idx);
+    int64_t t;
+    float v;
+    while (slog_iter_next(&it, &t, &v)) rollup_add(r, s, t, v);
+  }
+  return r->rolled - before;
+}
+
+/**
+ * Coarsest tier whose width divides step_ms, -1 if none (step < 1 min)
+ */
+int rollup_pick_tier(int64_t step_ms) {
+  for (int tier = ROLLUP_TIERS - 1; tier >= 0; tier--)
+    if (step_ms >= rollup_width_ms[tier] && step_ms % rollup_width_ms[tier] == 0)
+      return tier;
+  return -1;
+}
+
+/**
+ * Aggregate [from, to) in steps of step_ms from tier into out
+ *
+ * step_ms must be a multiple of the tier width. Steps without readings are
+ * left out. Return the number of steps written to out (at most max) and
+ * count the buckets read in *read (may be NULL).
+ */
+size_t rollup_query(const struct rollup *r, int series, int tier, int64_t from,
+                    int64_t to, int64_t step_ms, struct rollup_bucket *out,
+                    size_t max, uint64_t *read) {
+  size_t n = 0;
+  int64_t width = rollup_width_ms[tier];
+  for (int64_t t = rollup_floor(from, step_ms); t < to && n < max;
+       t += step_ms) {
+    struct rollup_bucket acc = {.t = t};
+    for (int64_t u = t; u < t + step_ms; u += width) {
+      rollup_merge(&acc, rollup_get(r, series, tier, u));
+      if (read) (*read)++;
+    }
+    if (acc.count) out[n++] = acc;
+  }
+  return n;
+}
+
+/**
+ * Aggregate [from, to) in steps of step_ms straight from the raw log
+ *
+ * With an index the scan starts at the first block of the range. Same
+ * result format as rollup_query(); *read counts decoded readings.
+ */
+size_t rollup_query_raw(const struct slog *log, const struct slog_index *idx,
+                        int series, int64_t from, int64_t to, int64_t step_ms,
+                        struct rollup_bucket *out, size_t max,
+                        uint64_t *read) {
+  struct slog_iter it;
+  slog_iter_init(&it, log, series, from, to - 1);
+  if (idx) slog_iter_seek(&it, idx);
+  size_t n = 0;
+  int64_t t;
+  float v;
+  while (slog_iter_next(&it, &t, &v)) {
+    if (read) (*read)++;
+    int64_t start = rollup_floor(t, step_ms);
+    if (n == 0 || out[n - 1].t != start) {
+      if (n == max) break;
+      out[n++] = (struct rollup_bucket){.t = start};
+    }
+    struct rollup_bucket one = {.t = start, .count = 1, .min = v, .max = v,
+                                .sum = v};
+    rollup_merge(&out[n - 1], &one);
+  }
+  return n;
+}
+
+void rollup_close(struct rollup *r) {
+  slog_index_free(&r->idx);
+  munmap(r->map, r->map_len);
+  close(r->fd);
+}
+
+#endif
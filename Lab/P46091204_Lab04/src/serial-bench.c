@@ -0,0 +1,257 @@
+/**
+ * @file
+ * Serial receive path through a pty loopback: latency and throughput
+ *
+ * The slave side of a pty pair stands for the serial port and is read by a
+ * thread as the serial programs read theirs; the benchmark plays the other
+ * end of the link on the master side. The slave is set up three ways:
+ *   canonical   ICANON like the old setup_terminal() (without echo, so
+ *               that only the replies come back): one read() per line
+ *   latency     raw, SERIAL_LATENCY (serial_port.h): VMIN 1, VTIME 0
+ *   throughput  raw, SERIAL_THROUGHPUT: VMIN SERIAL_BATCH, VTIME 1
+ *
+ * Latency: "temp?" is sent and the reader answers with a reading; the
+ * round trip is timed, for rounds queries or 2 s, whichever ends first.
+ *
+ * Throughput: lines of readings arrive as a UART at the given baud rate
+ * would hand them over, UART_FIFO bytes per interrupt (10 bits per byte,
+ * 0: as fast as the pty takes them), and the reader parses them with the
+ * receive ring (rx_ring.h, lines parsed where read() put them) or with
+ * line_buf.h (read() into a buffer, each line copied out). Reported: the
+ * rate, the reads and bytes per read, reader CPU time per line, and how
+ * long after the last byte the reader had the last line.
+ *
+ * Usage: serial-bench [baud=921600] [lines=5000] [rounds=2000]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+
+#include "util.h"
+#include "line_buf.h"
+#include "rx_ring.h"
+#include "serial_port.h"
+
+#define UART_FIFO 16
+#define REPLY "Temperature: 24.69 C\n"
+#define MAX_ROUNDS 100000
+#define ROUNDS_NS 2000000000ull
+
+enum setup { CANONICAL, LATENCY, THROUGHPUT };
+const char *const setup_names[] = {"canonical", "latency", "throughput"};
+
+struct reader {
+  int fd;
+  int copy;  // parse with line_buf.h instead of the receive ring
+  int reply;  // answer every line
+  uint64_t lines, bytes, reads, cpu_ns, end_ns;
+};
+
+int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+int set_up(int fd, enum setup setup) {
+  if (setup != CANONICAL)
+    return serial_setup(fd, 0, setup == LATENCY ? SERIAL_LATENCY
+                                                : SERIAL_THROUGHPUT, NULL);
+  struct termios t;
+  if (tcgetattr(fd, &t)) return -1;
+  cfmakeraw(&t);
+  t.c_lflag |= ICANON;
+  t.c_iflag |= ICRNL;
+  t.c_oflag |= OPOST | ONLCR;
+  return tcsetattr(fd, TCSANOW, &t);
+}
+
+/**
+ * Count a line, answer it if asked; "end" ends the run
+ */
+int on_line(struct reader *r, const char *line, size_t len) {
+  if (!len) return 0;  // canonical: ICRNL made "\r\n" two line ends
+  r->lines++;
+  if (r->reply && write(r->fd, REPLY, strlen(REPLY)) < 0) return -1;
+  return len == 3 && !memcmp(line, "end", 3) ? -1 : 0;
+}
+
+struct reader *copy_reader;
+int copy_done;
+
+void on_copied_line(void *ctx, char *line, size_t len) {
+  (void)ctx;
+  if (!copy_done && on_line(copy_reader, line, len)) copy_done = 1;
+}
+
+/**
+ * Read lines on the slave until "end" or end of file
+ */
+void *read_loop(void *arg) {
+  struct reader *r = arg;
+  uint64_t cpu0 = thread_cpu_ns();
+  if (r->copy) {
+    static char buf[4096];
+    static struct line_buf lb;
+    line_buf_init(&lb);
+    copy_reader = r;
+    copy_done = 0;
+    while (!copy_done) {
+      ssize_t n = read(r->fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      r->reads++;
+      r->bytes += n;
+      line_buf_feed(&lb, buf, n, on_copied_line, NULL);
+    }
+  } else {
+    struct rx_ring ring;
+    rx_ring_init(&ring, 12);
+    char *line;
+    ssize_t len;
+    while ((len = rx_ring_getline(&ring, r->fd, &line)) >= 0)
+      if (on_line(r, line, len)) break;
+    r->reads = ring.reads;
+    r->bytes = ring.bytes;
+    rx_ring_free(&ring);
+  }
+  r->end_ns = monotonic_ns();
+  r->cpu_ns = thread_cpu_ns() - cpu0;
+  return NULL;
+}
+
+/**
+ * Wait for a reply line on the master
+ */
+int await_reply(int master) {
+  char buf[256];
+  for (;;) {
+    ssize_t n = read(master, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    if (buf[n - 1] == '\n') return 0;
+  }
+}
+
+void latency(int master, int slave, enum setup setup, int rounds) {
+  static uint64_t rtt[MAX_ROUNDS];
+  set_up(slave, setup);
+  struct reader r = {.fd = slave, .reply = 1};
+  pthread_t thread;
+  pthread_create(&thread, NULL, read_loop, &r);
+  int n = 0;
+  uint64_t start = monotonic_ns();
+  while (n < rounds && monotonic_ns() - start < ROUNDS_NS) {
+    uint64_t t = monotonic_ns();
+    if (write(master, "temp?\r", 6) != 6 || await_reply(master)) break;
+    rtt[n++] = monotonic_ns() - t;
+  }
+  if (write(master, "end\r", 4) == 4) await_reply(master);
+  pthread_join(thread, NULL);
+  qsort(rtt, n, sizeof(*rtt), cmp_u64);
+  printf("%-11s %8d %10.1f %10.1f %10.1f %10.2f\n", setup_names[setup], n,
+         n ? rtt[n / 2] / 1e3 : 0, n ? rtt[n * 99 / 100] / 1e3 : 0,
+         n ? rtt[n - 1] / 1e3 : 0, r.lines ? (double)r.reads / r.lines : 0);
+}
+
+/**
+ * Send text as a UART at baud would deliver it: every UART_FIFO bytes once
+ * the line has carried them, all that is due in one write()
+ */
+void send_paced(int master, const char *text, size_t len, long baud) {
+  uint64_t ns_per_fifo = baud ? UART_FIFO * 10000000000ull / baud : 0;
+  uint64_t t0 = monotonic_ns();
+  for (size_t sent = 0; sent < len;) {
+    size_t due = len - sent;
+    if (ns_per_fifo) {
+      uint64_t now = monotonic_ns();
+      due = (now - t0) / ns_per_fifo * UART_FIFO;
+      due = due > len ? len - sent : due - sent;
+      if (!due) {
+        delay_ns(t0 + (sent / UART_FIFO + 1) * ns_per_fifo - now);
+        continue;
+      }
+    }
+    ssize_t w = write(master, text + sent, due);
+    if (w < 0 && errno == EINTR) continue;
+    if (w < 0) break;
+    sent += w;
+  }
+}
+
+void throughput(int master, int slave, enum setup setup, int copy,
+                const char *text, size_t len, long baud) {
+  set_up(slave, setup);
+  tcflush(slave, TCIOFLUSH);
+  struct reader r = {.fd = slave, .copy = copy};
+  pthread_t thread;
+  pthread_create(&thread, NULL, read_loop, &r);
+  uint64_t t0 = monotonic_ns();
+  send_paced(master, text, len, baud);
+  uint64_t sent = monotonic_ns();
+  pthread_join(thread, NULL);
+  double s = (r.end_ns - t0) / 1e9;
+  printf("%-11s %-5s %8.2f %10.0f %8llu %10.1f %10.0f %10.3f\n",
+         setup_names[setup], copy ? "copy" : "ring", r.bytes / s / 1e6,
+         r.lines / s, (unsigned long long)r.reads,
+         r.reads ? (double)r.bytes / r.reads : 0,
+         r.lines ? (double)r.cpu_ns / r.lines : 0,
+         r.end_ns > sent ? (r.end_ns - sent) / 1e6 : 0);
+}
+
+int main(int argc, char *argv[]) {
+  long baud = argc > 1 ? atol(argv[1]) : 921600;
+  int lines = argc > 2 ? atoi(argv[2]) : 5000;
+  int rounds = argc > 3 ? atoi(argv[3]) : 2000;
+  if (lines < 1) lines = 5000;
+  if (rounds < 1 || rounds > MAX_ROUNDS) rounds = 2000;
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master)) {
+    perror("posix_openpt");
+    exit(EXIT_FAILURE);
+  }
+  int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave < 0) {
+    perror("pty slave");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("round trip \"temp?\" -> reading, us:\n%-11s %8s %10s %10s %10s "
+         "%10s\n", "", "rounds", "p50", "p99", "max", "reads/line");
+  for (int s = CANONICAL; s <= THROUGHPUT; s++)
+    latency(master, slave, s, rounds);
+
+  // the readings of serial's text output
+  size_t cap = (size_t)lines * 40 + 8, len = 0;
+  char *text = malloc(cap);
+  for (int i = 0; i < lines; i++)
+    len += snprintf(text + len, cap - len, "TEMP: %.2f C\tHUM: %.2f %%\r\n",
+                    20 + i % 1000 / 100.0, 40 + i % 700 / 100.0);
+  len += snprintf(text + len, cap - len, "end\r");
+
+  printf("\n%d lines (%zu bytes) at %ld baud%s, %d bytes per interrupt:\n",
+         lines, len, baud, baud ? "" : " (unpaced)", UART_FIFO);
+  printf("%-11s %-5s %8s %10s %8s %10s %10s %10s\n", "", "parse", "MB/s",
+         "lines/s", "reads", "bytes/read", "cpu/line", "drain [ms]");
+  for (int s = CANONICAL; s <= THROUGHPUT; s++)
+    for (int copy = 1; copy >= 0; copy--)
+      throughput(master, slave, s, copy, text, len, baud);
+
+  /* release resource section */
+  free(text);
+  close(slave);
+  close(master);
+}
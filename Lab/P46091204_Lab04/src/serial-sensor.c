@@ -1,126 +1,881 @@
 /**
  * @file
  * Basic serial communication and sensors
- * 
+ *
  * Receive commands over the serial port
  * Print sensor measurements back to the serial port
  * Command summary:
  *   'temp?': Temperature
  *   'hum?' : Relative humidity
  *   'quit' : End the program
+ *   'sub temp|hum|all <rate_hz>': push readings at rate_hz
+ *   'unsub [temp|hum|all]': stop pushing them (all by default)
  * Might need to use a serial client (e.g., PuTTY)
+ *
+ * One thread runs an epoll event loop (see reactor.h) over
+ *   - the clients, read without blocking into a receive ring each
+ *     (rx_ring.h), whose lines are parsed where they were read
+ *   - a timerfd that starts a temperature + humidity cycle every period_ms
+ *   - a timerfd that fires when the running conversion should be ready
+ *   - a signalfd for SIGINT / SIGTERM / SIGHUP, which end the program cleanly
+ * and sleeps until one of them has work. A conversion never blocks the loop:
+ * it is started, and collected when its timer fires.
+ *
+ * Commands answer from the latest reading (see sensor_cache.h), shared by
+ * all clients. When that is older than max_staleness_ms the query waits for
+ * the next conversion of its kind, started at once if the sensor is idle;
+ * later commands of the same client are answered in order behind it.
+ *
+ * Server mode serves more clients with the same commands:
+ *   -s path   a Unix domain socket; each connection is a client without
+ *             greeting or prompt, 'quit' closes the connection
+ *   -p n      n extra pseudo terminals, their names are printed at start;
+ *             'quit' ends the session, the terminal stays open
+ *   -d path   the serial port (default SERIAL_DEVICE), "none" for no port;
+ *             'quit' there ends the program as before
+ *   -b baud   its baud rate (default SERIAL_BAUD), up to 4000000
+ * sensor-load measures the query rate and latency through the socket.
+ *
+ * Subscriptions push the latest readings without a query. Pushes are
+ * scheduled on multiples of their period in monotonic time, so channels of
+ * the same or related rates fall on the same tick and go out together, as
+ * one line ("Temperature: 24.69 C\tHumidity: 32.34 %") or one frame. The
+ * sensor is sampled at least as fast as the fastest subscription.
+ *
+ * Back-pressure: replies and pushes go into a per-client output queue of
+ * CLIENT_OUT_SIZE bytes that is written out as the fd accepts it (EPOLLOUT),
+ * never waited for. A message that does not fit is dropped whole: a slow
+ * client or a slow baud rate loses pushes (counted as skipped) but never
+ * delays sampling or the other clients, and frames are never cut.
+ * Queues are written after each round of handlers, so all that a round
+ * produced for a client (the answers to a burst of queries, a prompt after
+ * them) goes out with one write().
+ *
+ * 'bin' switches a client to binary replies: every answer is then a frame
+ * (frame.h) holding the reading with the time it was taken, without prompts,
+ * and output post-processing is turned off on the serial port so that the
+ * frames pass unchanged. 'bin' itself is answered with a lone frame
+ * delimiter, which ends any text the client's decoder has buffered. 'ascii'
+ * switches back. A pushed frame holds the due channels with the time of the
+ * newest reading in it.
+ *
+ * The serial port runs in raw mode (serial_port.h) with VMIN 1, VTIME 0:
+ * the loop sees each byte as it arrives instead of each line the line
+ * discipline assembled, and echoes the text typed there and its Backspaces
+ * itself (not in binary mode, where an echo would corrupt the frames).
+ *
+ * Usage: serial-sensor [-d device] [-b baud] [-s socket] [-p ptys]
+ *                      [period_ms, default 1000] [max_staleness_ms, 2000]
+ *   ./bin/serial-sensor -d none -s /tmp/sensor.sock -p 2
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <termios.h>
 #include <unistd.h>
 
 #include "mraa.h"
 #include "util.h"
+#include "htu21d.h"
+#include "sensor_cache.h"
+#include "reactor.h"
+#include "rx_ring.h"
+#include "serial_port.h"
+#include "frame.h"
 
 #define SERIAL_DEVICE "/dev/ttyS0"
+#define SERIAL_BAUD 115200
 #define I2C_BUS 0
+// queries waiting for a fresh reading; more are answered from the cache
+#define MAX_WAITING 16
+// re-poll a conversion that is not ready at its typical time this often
+#define CONVERSION_POLL_NS 500000
+#define CLIENT_IN_LOG2 9  // 512-byte receive ring
+#define CLIENT_OUT_SIZE 4096
+#define MAX_SUB_RATE 100  // pushes per second and channel
+// longest wait for the output queues to drain on exit
+#define EXIT_FLUSH_MS 100
+#define MAX_PTYS 16
 
-mraa_i2c_context i2c;
+enum client_type { CLIENT_SERIAL, CLIENT_PTY, CLIENT_SOCKET };
+
+struct client {
+  struct reactor_handler h;
+  enum client_type type;
+  int slave;  // CLIENT_PTY: our own fd of the slave side, keeps it open
+  struct rx_ring in;
+  int echo_col, echo_cr;  // CLIENT_SERIAL: characters echoed on the line,
+                          // last one echoed was '\r'
+  int waiting[MAX_WAITING];  // kinds of the queries waiting, oldest first;
+                             // -1: a prompt owed to some other line
+  int head, n;
+  int quit, dead, closing;  // closing: free once the output queue is empty
+  int binary;
+  struct frame_writer frames;
+  char out[CLIENT_OUT_SIZE];  // ring of bytes not yet accepted by the fd
+  size_t out_head, out_len;
+  int want_out;  // watching EPOLLOUT
+  uint64_t sub_period_ns[2], sub_due_ns[2];  // by htu21d_kind, 0: none
+  struct client *next;
+  int dirty;  // on the dirty list: queued output since the last flush
+  struct client *dirty_next;
+};
+
+struct htu21d sensor;
+struct sensor_cache cache;
+uint64_t max_staleness_ns;
+struct reactor reactor;
+struct client *clients;
+struct client *dirty;  // clients to flush_clients()
+uint64_t accepted, queries, dropped, pushed, skipped;
+uint64_t tx_bytes, tx_writes;
+size_t tx_max_queue;
+struct reactor_handler stream;  // timerfd of the next push
 
 /**
- * Set up the TTY with file descriptor fd
- * Save the previous settings into old_term
+ * Conversion sequencer driven by the two timerfds
  */
-void setup_terminal(int fd, struct termios *old_term) {
-  if (tcgetattr(fd, old_term) != 0) {
-    perror("tcgetattr");
-    exit(EXIT_FAILURE);
+struct sampler {
+  struct reactor_handler tick, conv;
+  int todo;  // bit (1 << kind) for each kind still to convert
+  uint64_t period_ns;
+  uint64_t cycles, missed_ticks;
+} sampler;
+
+/**
+ * Write as much of the output queue as the fd takes without blocking
+ *
+ * EPOLLOUT is watched while something is left. A client whose fd fails is
+ * marked dead and freed by its handler.
+ */
+void client_send(struct client *c) {
+  while (c->out_len && !c->dead) {
+    size_t n = c->out_len;
+    if (c->out_head + n > CLIENT_OUT_SIZE) n = CLIENT_OUT_SIZE - c->out_head;
+    ssize_t w = write(c->h.fd, c->out + c->out_head, n);
+    if (w > 0) {
+      tx_writes++;
+      tx_bytes += w;
+      c->out_head = (c->out_head + w) % CLIENT_OUT_SIZE;
+      c->out_len -= w;
+    } else if (w < 0 && errno == EAGAIN) {
+      break;
+    } else if (!(w < 0 && errno == EINTR)) {
+      c->dead = 1;
+    }
   }
-  struct termios new_term = *old_term;
-  new_term.c_lflag |= ECHO | ECHOE | ICANON | ICRNL;
-  cfsetspeed(&new_term, B115200);  // set baud rate to 115200
-  if (tcsetattr(fd, TCSANOW, &new_term) != 0) {
-    perror("tcsetattr");
-    exit(EXIT_FAILURE);
+  int want = c->out_len && !c->dead;
+  if (want != c->want_out &&
+      reactor_mod(&reactor, &c->h, want ? EPOLLIN | EPOLLOUT : EPOLLIN) == 0)
+    c->want_out = want;
+}
+
+/**
+ * Queue n bytes for a client, sent by flush_clients() after this round
+ *
+ * A message that does not fit in the queue is dropped whole. Return 0 if
+ * it was queued, -1 if dropped.
+ */
+int client_write(struct client *c, const void *buf, size_t n) {
+  if (c->dead || n > CLIENT_OUT_SIZE - c->out_len) return -1;
+  size_t tail = (c->out_head + c->out_len) % CLIENT_OUT_SIZE;
+  size_t first = n < CLIENT_OUT_SIZE - tail ? n : CLIENT_OUT_SIZE - tail;
+  memcpy(c->out + tail, buf, first);
+  memcpy(c->out, (const char *)buf + first, n - first);
+  c->out_len += n;
+  if (c->out_len > tx_max_queue) tx_max_queue = c->out_len;
+  if (!c->dirty) {
+    c->dirty = 1;
+    c->dirty_next = dirty;
+    dirty = c;
   }
+  return 0;
+}
+
+int client_printf(struct client *c, const char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  return client_write(c, buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
 }
 
 /**
- * Restore the TTY with file descriptor fd with saved settings from old_term
+ * Wait up to timeout_ms for the output queue to drain (on exit only)
  */
-void restore_terminal(int fd, struct termios *old_term) {
-  if (tcsetattr(fd, TCSANOW, old_term) != 0) {
-    perror("tcsetattr");
-    exit(EXIT_FAILURE);
+void client_linger(struct client *c, int timeout_ms) {
+  uint64_t end = monotonic_ns() + timeout_ms * 1000000ull;
+  for (client_send(c); c->out_len && !c->dead; client_send(c)) {
+    uint64_t now = monotonic_ns();
+    struct pollfd p = {.fd = c->h.fd, .events = POLLOUT};
+    if (now >= end || poll(&p, 1, (end - now) / 1000000 + 1) <= 0) return;
+  }
+}
+
+const char *prompt(const struct client *c) {
+  return c->type == CLIENT_SOCKET || c->binary ? "" : "> ";
+}
+
+void greet(struct client *c) {
+  if (c->type == CLIENT_SOCKET) return;
+  client_printf(c, "Enter 'temp?' for temperature, 'hum?' for humidity\r\n");
+  client_printf(c, "Enter quit to quit\n\n> ");
+}
+
+/**
+ * Latest reading of kind in C or % and when it was taken (monotonic_ns()),
+ * NAN if the sensor never answered
+ */
+double cached_value(enum htu21d_kind kind, uint64_t *t_ns) {
+  uint16_t raw;
+  if (sensor_cache_load(&cache, kind, &raw, t_ns)) return NAN;
+  return kind == HTU21D_TEMP ? htu21d_temperature(raw) : htu21d_humidity(raw);
+}
+
+int is_fresh(enum htu21d_kind kind) {
+  uint64_t t;
+  return !isnan(cached_value(kind, &t)) &&
+         monotonic_ns() - t <= max_staleness_ns;
+}
+
+void answer(struct client *c, enum htu21d_kind kind) {
+  uint64_t t = 0;
+  double v = cached_value(kind, &t);
+  int ret;
+  queries++;
+  if (c->binary) {
+    uint8_t out[FRAME_MAX_ENCODED];
+    frame_begin(&c->frames, t / 1000000);
+    frame_add(&c->frames, kind == HTU21D_TEMP ? FRAME_CH_TEMPERATURE
+                                              : FRAME_CH_HUMIDITY, v);
+    ret = client_write(c, out, frame_finish(&c->frames, out));
+  } else if (kind == HTU21D_TEMP) {
+    ret = client_printf(c, "Temperature: %.2f C\r\n%s", v, prompt(c));
+  } else {
+    ret = client_printf(c, "Humidity: %.2f %%\r\n%s", v, prompt(c));
+  }
+  if (ret) dropped++;
+}
+
+/**
+ * Push the latest readings of the kinds in mask (bit 1 << kind) as one
+ * line or frame
+ */
+void push(struct client *c, int mask) {
+  char line[128];
+  uint8_t out[FRAME_MAX_ENCODED];
+  size_t n = 0;
+  uint64_t t, newest = 0;
+  double v[2];
+  for (int k = 0; k < 2; k++) {
+    if (!(mask & 1 << k)) continue;
+    v[k] = cached_value(k, &t);
+    if (t > newest) newest = t;
+  }
+  if (c->binary) {
+    frame_begin(&c->frames, newest / 1000000);
+    if (mask & 1 << HTU21D_TEMP)
+      frame_add(&c->frames, FRAME_CH_TEMPERATURE, v[HTU21D_TEMP]);
+    if (mask & 1 << HTU21D_HUM)
+      frame_add(&c->frames, FRAME_CH_HUMIDITY, v[HTU21D_HUM]);
+    n = frame_finish(&c->frames, out);
+  } else {
+    if (mask & 1 << HTU21D_TEMP)
+      n += snprintf(line + n, sizeof(line) - n, "Temperature: %.2f C",
+                    v[HTU21D_TEMP]);
+    if (mask & 1 << HTU21D_HUM)
+      n += snprintf(line + n, sizeof(line) - n, "%sHumidity: %.2f %%",
+                    n ? "\t" : "", v[HTU21D_HUM]);
+    n += snprintf(line + n, sizeof(line) - n, "\r\n");
+  }
+  if (client_write(c, c->binary ? (const void *)out : line, n))
+    skipped++;
+  else
+    pushed++;
+}
+
+/**
+ * Switch a client between text and binary replies
+ */
+void set_binary(struct client *c, int binary) {
+  if (c->type == CLIENT_SERIAL) {
+    struct termios t;
+    if (tcgetattr(c->h.fd, &t) == 0) {
+      if (binary)
+        t.c_oflag &= ~OPOST;  // no \n -> \r\n inside frames
+      else
+        t.c_oflag |= OPOST;
+      tcsetattr(c->h.fd, TCSANOW, &t);  // queued output is not waited for
+    }
+  }
+  c->binary = binary;
+  if (binary)
+    client_write(c, "", 1);
+  else
+    client_printf(c, "%s", prompt(c));
+}
+
+/**
+ * Answer the waiting queries, oldest first, while their reading is fresh
+ *
+ * done is the kind just converted or failed (-1: none); its queries are
+ * answered with whatever is cached even if max_staleness_ms is tiny.
+ */
+void client_drain(struct client *c, int done) {
+  while (c->n) {
+    int kind = c->waiting[c->head];
+    if (kind >= 0 && kind != done && !is_fresh(kind)) break;
+    if (kind >= 0)
+      answer(c, kind);
+    else
+      client_printf(c, "%s", prompt(c));
+    c->head = (c->head + 1) % MAX_WAITING;
+    c->n--;
+  }
+}
+
+/**
+ * Answer everything still waiting with what is cached
+ */
+void client_flush(struct client *c) {
+  while (c->n) client_drain(c, c->waiting[c->head]);
+}
+
+void drain_all(int done) {
+  for (struct client *c = clients; c; c = c->next) client_drain(c, done);
+}
+
+void sampler_next(void);
+
+/**
+ * Make sure kind is converted soon; start it now if the sensor is idle
+ */
+void sampler_want(enum htu21d_kind kind) {
+  sampler.todo |= 1 << kind;
+  if (sensor.pending < 0) sampler_next();
+}
+
+/**
+ * Start the next conversion of the cycle and arm the conversion timer
+ */
+void sampler_next(void) {
+  while (sampler.todo) {
+    enum htu21d_kind kind =
+        sampler.todo & (1 << HTU21D_TEMP) ? HTU21D_TEMP : HTU21D_HUM;
+    if (htu21d_start(&sensor, kind) == 0) {
+      reactor_timer_arm(sampler.conv.fd,
+                        sensor.t_start + sensor.typ_us[kind] * 1000ull, 0);
+      return;
+    }
+    atomic_fetch_add(&cache.errors, 1);
+    sampler.todo &= ~(1 << kind);
+    drain_all(kind);
+  }
+}
+
+void on_tick(struct reactor_handler *h, uint32_t events) {
+  (void)events;
+  uint64_t n = reactor_timer_read(h->fd);
+  if (n > 1) sampler.missed_ticks += n - 1;
+  sampler.cycles++;
+  sampler_want(HTU21D_TEMP);
+  sampler_want(HTU21D_HUM);
+}
+
+void on_conversion(struct reactor_handler *h, uint32_t events) {
+  (void)events;
+  reactor_timer_read(h->fd);
+  int kind = sensor.pending;
+  if (kind < 0) return;
+  uint16_t raw;
+  int ret = htu21d_try_collect(&sensor, &raw);
+  if (ret == 1) {
+    reactor_timer_arm(h->fd, monotonic_ns() + CONVERSION_POLL_NS, 0);
+    return;
+  }
+  if (ret == 0)
+    sensor_cache_publish(&cache, kind, raw, monotonic_ns());
+  else
+    atomic_fetch_add(&cache.errors, 1);
+  sampler.todo &= ~(1 << kind);
+  drain_all(kind);
+  sampler_next();
+}
+
+/**
+ * Sample at least as often as the fastest subscription pushes
+ */
+void sampler_adapt(void) {
+  uint64_t period = cache.period_ns;
+  for (struct client *c = clients; c; c = c->next)
+    for (int k = 0; k < 2; k++)
+      if (c->sub_period_ns[k] && c->sub_period_ns[k] < period)
+        period = c->sub_period_ns[k];
+  if (period == sampler.period_ns) return;
+  sampler.period_ns = period;
+  reactor_timer_arm(sampler.tick.fd, monotonic_ns(), period);
+}
+
+/**
+ * Arm the stream timer for the earliest push due, disarm it if none
+ */
+void stream_arm(void) {
+  uint64_t next = 0;
+  for (struct client *c = clients; c; c = c->next)
+    for (int k = 0; k < 2; k++)
+      if (c->sub_period_ns[k] && (!next || c->sub_due_ns[k] < next))
+        next = c->sub_due_ns[k];
+  reactor_timer_arm(stream.fd, next, 0);
+}
+
+/**
+ * Next multiple of period after now
+ */
+uint64_t next_multiple(uint64_t now, uint64_t period) {
+  return (now / period + 1) * period;
+}
+
+void on_stream(struct reactor_handler *h, uint32_t events) {
+  (void)events;
+  reactor_timer_read(h->fd);
+  uint64_t now = monotonic_ns();
+  for (struct client *c = clients; c; c = c->next) {
+    int mask = 0;
+    for (int k = 0; k < 2; k++) {
+      if (!c->sub_period_ns[k] || c->sub_due_ns[k] > now) continue;
+      mask |= 1 << k;
+      // a late tick is not repeated: pushes never burst to catch up
+      c->sub_due_ns[k] = next_multiple(now, c->sub_period_ns[k]);
+    }
+    if (mask && !c->closing) push(c, mask);
   }
+  stream_arm();
 }
 
-double read_temperature(mraa_i2c_context i2c) {
-  uint8_t buf[2];
+/**
+ * Handle sub / unsub
+ *
+ * Return 1 if line is neither, 0 if it was applied, -1 if malformed.
+ */
+int subscribe(struct client *c, const char *line) {
+  char cmd[8], what[8] = "all";
+  double rate = 0;
+  int n = sscanf(line, "%7s %7s %lf", cmd, what, &rate);
+  int sub = n >= 1 && !strcmp(cmd, "sub");
+  if (!sub && !(n >= 1 && !strcmp(cmd, "unsub"))) return 1;
+  int mask = !strcmp(what, "temp") ? 1 << HTU21D_TEMP
+             : !strcmp(what, "hum") ? 1 << HTU21D_HUM
+             : !strcmp(what, "all") ? 3
+                                    : 0;
+  if (!mask || (sub && (n != 3 || !(rate > 0) || rate > MAX_SUB_RATE)) ||
+      (!sub && n > 2))
+    return -1;
+  uint64_t period = sub ? 1e9 / rate : 0, now = monotonic_ns();
+  for (int k = 0; k < 2; k++) {
+    if (!(mask & 1 << k)) continue;
+    c->sub_period_ns[k] = period;
+    if (period) c->sub_due_ns[k] = next_multiple(now, period);
+  }
+  sampler_adapt();
+  stream_arm();
+  return 0;
+}
 
-  mraa_i2c_write_byte(i2c, 0xf3);
-  delay_ms(50);
-  mraa_i2c_read(i2c, buf, 2);
-  uint16_t temp_raw =
-      (buf[0] << 8) + (buf[1] & 0xfc);  // discard the last 2 status bits
-  return -46.85 + 175.72 * temp_raw / (1 << 16);
+void on_command(void *ctx, char *line, size_t len) {
+  (void)len;
+  struct client *c = ctx;
+  if (c->quit) return;
+  int kind = !strcmp("temp?", line) ? HTU21D_TEMP
+             : !strcmp("hum?", line) ? HTU21D_HUM
+                                     : -1;
+  if (kind < 0) {
+    if (!strcmp("quit", line)) {
+      c->quit = 1;
+    } else if (!strcmp("bin", line) || !strcmp("ascii", line)) {
+      client_flush(c);  // answers already asked for keep their format
+      set_binary(c, line[0] == 'b');
+    } else if (subscribe(c, line) < 0 && !c->binary) {
+      client_printf(c, "Usage: sub temp|hum|all <rate_hz, up to %d>, "
+                       "unsub [temp|hum|all]\r\n%s", MAX_SUB_RATE,
+                    prompt(c));
+    } else if (c->n == 0 || c->n == MAX_WAITING) {
+      client_printf(c, "%s", prompt(c));
+    } else {
+      c->waiting[(c->head + c->n++) % MAX_WAITING] = -1;  // keep the order
+    }
+    return;
+  }
+  if (c->n == 0 && is_fresh(kind)) {
+    atomic_fetch_add(&cache.hits, 1);
+    answer(c, kind);
+  } else if (c->n == MAX_WAITING) {
+    answer(c, kind);  // too many waiting: answer with what is cached
+  } else {
+    atomic_fetch_add(&cache.forced, 1);
+    c->waiting[(c->head + c->n++) % MAX_WAITING] = kind;
+    sampler_want(kind);
+  }
+}
+
+void client_free(struct client *c) {
+  reactor_del(&reactor, &c->h);
+  for (struct client **p = &clients; *p; p = &(*p)->next)
+    if (*p == c) {
+      *p = c->next;
+      break;
+    }
+  for (struct client **p = &dirty; c->dirty && *p; p = &(*p)->dirty_next)
+    if (*p == c) {
+      *p = c->dirty_next;
+      break;
+    }
+  if (c->type == CLIENT_PTY) close(c->slave);
+  close(c->h.fd);
+  rx_ring_free(&c->in);
+  free(c);
+  sampler_adapt();
+  stream_arm();
+}
+
+void client_close(struct client *c) {
+  if (c->type == CLIENT_SERIAL) {
+    fprintf(stderr, "Serial port closed\n");
+    reactor_stop(&reactor);
+  } else {
+    client_free(c);
+  }
+}
+
+/**
+ * Echo the bytes of the receive ring from index from to index to
+ *
+ * Does in raw mode what ECHO and ECHOE did in canonical mode: Enter starts
+ * a new line, Backspace and DEL rub out the last character typed.
+ */
+void client_echo(struct client *c, size_t from, size_t to) {
+  char out[192];
+  size_t n = 0;
+  for (size_t i = from; i != to; i++) {
+    char ch = c->in.buf[i & c->in.mask];
+    int after_cr = c->echo_cr;
+    c->echo_cr = ch == '\r';
+    if (ch == '\b' || ch == 0x7f) {
+      if (c->echo_col > 0) {
+        c->echo_col--;
+        memcpy(out + n, "\b \b", 3);
+        n += 3;
+      }
+    } else if (ch == '\r' || ch == '\n') {
+      c->echo_col = 0;
+      if (ch == '\r' || !after_cr) out[n++] = '\n';  // ONLCR adds the '\r'
+    } else {
+      c->echo_col++;
+      out[n++] = ch;
+    }
+    if (n > sizeof(out) - 3) {
+      client_write(c, out, n);
+      n = 0;
+    }
+  }
+  if (n) client_write(c, out, n);
 }
 
-double read_humidity(mraa_i2c_context i2c) {
-  uint8_t buf[2];
+/**
+ * Read all the client sent, echo it if needed and run its commands
+ *
+ * Return 0 once the fd would block, -1 on end of file or error.
+ */
+int client_read(struct client *c) {
+  for (;;) {
+    size_t from = c->in.head;
+    ssize_t n = rx_ring_fill(&c->in, c->h.fd);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0)
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    if (c->type == CLIENT_SERIAL && !c->binary)
+      client_echo(c, from, c->in.head);
+    rx_ring_parse(&c->in, on_command, c);
+  }
+}
 
-  mraa_i2c_write_byte(i2c, 0xf5);
-  delay_ms(20);
-  mraa_i2c_read(i2c, buf, 2);
-  uint16_t hum_raw =
-      (buf[0] << 8) + (buf[1] & 0xfc);  // discard the last 2 status bits
-  return -6.0 + 125.0 * hum_raw / (1 << 16);
+void on_client(struct reactor_handler *h, uint32_t events) {
+  struct client *c = h->ctx;
+  if (events & EPOLLOUT) client_send(c);
+  int eof = 0;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) eof = client_read(c);
+  if (c->quit && !c->closing) {
+    if (c->type == CLIENT_SERIAL) {  // says bye on the way out
+      reactor_stop(&reactor);
+      return;
+    }
+    client_flush(c);
+    c->sub_period_ns[HTU21D_TEMP] = c->sub_period_ns[HTU21D_HUM] = 0;
+    client_printf(c, "bye\n");
+    if (c->type == CLIENT_PTY) {  // next session
+      c->quit = 0;
+      c->binary = 0;
+      rx_ring_reset(&c->in);
+      greet(c);
+      sampler_adapt();
+      stream_arm();
+      return;
+    }
+    c->closing = 1;  // once "bye" is out
+  }
+  if (eof || c->dead || (c->closing && !c->out_len)) client_close(c);
 }
 
-int main() {
-  int fd = open(SERIAL_DEVICE, O_RDWR | O_NOCTTY);
-  if (fd == -1) {
-    perror("open_port: Unable to open " SERIAL_DEVICE " - ");
+/**
+ * Send what the handlers of the last round queued, one write per client
+ */
+void flush_clients(void) {
+  while (dirty) {
+    struct client *c = dirty;
+    dirty = c->dirty_next;
+    c->dirty = 0;
+    if (!c->want_out) client_send(c);  // else EPOLLOUT will
+    if (c->dead || (c->closing && !c->out_len)) client_close(c);
   }
+}
 
-  FILE *file = fdopen(fd, "r+");
-  if (!file) {
-    perror("fdopen");
+/**
+ * Register fd as a client, return it or NULL on error
+ */
+struct client *client_add(int fd, enum client_type type) {
+  struct client *c = calloc(1, sizeof(*c));
+  if (!c) return NULL;
+  c->h = (struct reactor_handler){fd, on_client, c};
+  c->type = type;
+  c->slave = -1;
+  if (rx_ring_init(&c->in, CLIENT_IN_LOG2)) {
+    free(c);
+    return NULL;
   }
+  c->in.erase = type == CLIENT_SERIAL;  // no line discipline does it
+  frame_writer_init(&c->frames);
+  if (reactor_add(&reactor, &c->h, EPOLLIN)) {
+    rx_ring_free(&c->in);
+    free(c);
+    return NULL;
+  }
+  c->next = clients;
+  clients = c;
+  return c;
+}
 
-  i2c = mraa_i2c_init(I2C_BUS);
-  if (!i2c) {
+/**
+ * Open a raw pseudo terminal and serve its master side
+ *
+ * The slave side is kept open so that a client closing it does not hang up
+ * the master. Return 0 on success.
+ */
+int add_pty(void) {
+  int m = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (m < 0 || grantpt(m) || unlockpt(m)) goto fail;
+  int s = open(ptsname(m), O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (s < 0) goto fail;
+  struct termios t;
+  tcgetattr(s, &t);
+  cfmakeraw(&t);  // our replies must not be echoed back to us
+  tcsetattr(s, TCSANOW, &t);
+  struct client *c = client_add(m, CLIENT_PTY);
+  if (!c) {
+    close(s);
+    goto fail;
+  }
+  c->slave = s;
+  printf("client terminal: %s\n", ptsname(m));
+  greet(c);
+  return 0;
+
+fail:
+  if (m >= 0) close(m);
+  return -1;
+}
+
+void on_listen(struct reactor_handler *h, uint32_t events) {
+  (void)events;
+  int fd;
+  while ((fd = accept4(h->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    if (!client_add(fd, CLIENT_SOCKET)) {
+      close(fd);
+      continue;
+    }
+    accepted++;
+  }
+}
+
+/**
+ * Listening non-blocking Unix domain socket at path, -1 on error
+ */
+int listen_unix(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 128)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void on_signal(struct reactor_handler *h, uint32_t events) {
+  (void)events;
+  int sig;
+  while ((sig = reactor_signal_read(h->fd)))
+    printf("Received signal %d\n", sig);
+  reactor_stop(&reactor);
+}
+
+int main(int argc, char *argv[]) {
+  const char *device = SERIAL_DEVICE, *socket_path = NULL;
+  int ptys = 0;
+  long baud = SERIAL_BAUD;
+  while (argc > 2 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-d")) {
+      device = strcmp(argv[2], "none") ? argv[2] : NULL;
+    } else if (!strcmp(argv[1], "-b")) {
+      baud = atol(argv[2]);
+    } else if (!strcmp(argv[1], "-s")) {
+      socket_path = argv[2];
+    } else if (!strcmp(argv[1], "-p")) {
+      ptys = atoi(argv[2]);
+    } else {
+      break;
+    }
+    argc -= 2;
+    argv += 2;
+  }
+  double period_ms = argc > 1 ? atof(argv[1]) : 1000;
+  max_staleness_ns = (argc > 2 ? atof(argv[2]) : 2 * period_ms) * 1e6;
+  if (!device && !socket_path && ptys <= 0) {
+    fprintf(stderr, "Nothing to serve: give a device, -s or -p\n");
+    exit(EXIT_FAILURE);
+  }
+  if (device && !serial_speed(baud)) {
+    fprintf(stderr, "Unsupported baud rate %ld\n", baud);
+    exit(EXIT_FAILURE);
+  }
+  if (ptys > MAX_PTYS) ptys = MAX_PTYS;
+
+  const int sigs[] = {SIGINT, SIGTERM, SIGHUP};
+  struct reactor_handler sig_h = {.fn = on_signal};
+  sig_h.fd = reactor_signals_open(sigs, 3);
+  signal(SIGPIPE, SIG_IGN);  // a vanished client shows up as EPIPE instead
+
+  if (htu21d_init(&sensor, I2C_BUS)) {
     fprintf(stderr, "Cannot initalize I2C bus %d\n", I2C_BUS);
     exit(EXIT_FAILURE);
   }
-  mraa_i2c_address(i2c, 0x40);
+  sensor_cache_init(&cache, &sensor, period_ms);
+
+  sampler.tick = (struct reactor_handler){reactor_timer_open(), on_tick, NULL};
+  sampler.conv =
+      (struct reactor_handler){reactor_timer_open(), on_conversion, NULL};
+  stream = (struct reactor_handler){reactor_timer_open(), on_stream, NULL};
+  if (sig_h.fd < 0 || sampler.tick.fd < 0 || sampler.conv.fd < 0 ||
+      stream.fd < 0 || reactor_init(&reactor) ||
+      reactor_add(&reactor, &sig_h, EPOLLIN) ||
+      reactor_add(&reactor, &sampler.tick, EPOLLIN) ||
+      reactor_add(&reactor, &sampler.conv, EPOLLIN) ||
+      reactor_add(&reactor, &stream, EPOLLIN)) {
+    perror("Cannot set up the event loop");
+    exit(EXIT_FAILURE);
+  }
 
+  int fd = -1;
   struct termios old_term;
-  setup_terminal(fd, &old_term);
-  char *line = NULL;
-  dprintf(fd, "Enter 'temp?' for temperature, 'hum?' for humidity\r\n");
-  dprintf(fd, "Enter quit to quit\n\n");
-  for (;;) {
-    dprintf(fd, "> ");
-    ssize_t length = getline(&line, &(size_t){0}, file);
-    if (length == -1) {
-      if (!errno) break;
-      // NOTE:
-      // getline can return ENOINT if mraa_i2c_init is called before.
-      // This shouldn't happen. MRAA bug?
-      if (errno == ENOENT) break;
-      perror("getline");
+  if (device) {
+    fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1) {
+      fprintf(stderr, "open_port: Unable to open %s - %s\n", device,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    if (serial_setup(fd, baud, SERIAL_LATENCY, &old_term)) {
+      perror("Cannot set up the serial port");
+      exit(EXIT_FAILURE);
+    }
+    struct client *c = client_add(fd, CLIENT_SERIAL);
+    if (!c) {
+      perror("Cannot watch the serial port");
       exit(EXIT_FAILURE);
     }
-    if (length >= 1 && line[length - 1] == '\n') line[length - 1] = '\0';
-    if (!strcmp("temp?", line)) {
-      dprintf(fd, "Temperature: %.2f C\r\n", read_temperature(i2c));
-    } else if (!strcmp("hum?", line)) {
-      dprintf(fd, "Humidity: %.2f %%\r\n", read_humidity(i2c));
-    } else if (!strcmp("quit", line))
+    greet(c);
+  }
+  for (int i = 0; i < ptys; i++)
+    if (add_pty()) perror("Cannot open a pseudo terminal");
+  struct reactor_handler listen_h = {-1, on_listen, NULL};
+  if (socket_path) {
+    listen_h.fd = listen_unix(socket_path);
+    if (listen_h.fd < 0 || reactor_add(&reactor, &listen_h, EPOLLIN)) {
+      fprintf(stderr, "Cannot listen on %s: %s\n", socket_path,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  fflush(stdout);
+
+  // first cycle right away, then every period
+  sampler_adapt();
+  while (reactor.running) {
+    if (reactor_run_once(&reactor, -1) < 0) {
+      perror("epoll_wait");
       break;
+    }
+    flush_clients();
+  }
+
+  // answer what is still waiting before leaving
+  for (struct client *c = clients; c; c = c->next) {
+    client_flush(c);
+    if (c->type != CLIENT_SOCKET) client_printf(c, "bye\n");
+    client_linger(c, EXIT_FLUSH_MS);
+  }
+  printf("%llu cached answers, %llu fresh reads, %llu sensor errors\n",
+         (unsigned long long)cache.hits, (unsigned long long)cache.forced,
+         (unsigned long long)cache.errors);
+  printf("%llu answers, %llu socket clients, %llu replies dropped\n",
+         (unsigned long long)queries, (unsigned long long)accepted,
+         (unsigned long long)dropped);
+  printf("%llu pushes, %llu skipped by back-pressure\n",
+         (unsigned long long)pushed, (unsigned long long)skipped);
+  printf("%llu bytes in %llu writes (%.1f bytes/write), output queues up to "
+         "%zu bytes\n",
+         (unsigned long long)tx_bytes, (unsigned long long)tx_writes,
+         tx_writes ? (double)tx_bytes / tx_writes : 0, tx_max_queue);
+  printf("%llu cycles (%llu ticks missed), %llu wakeups, %llu events, "
+         "longest dispatch %.3f ms\n",
+         (unsigned long long)sampler.cycles,
+         (unsigned long long)sampler.missed_ticks,
+         (unsigned long long)reactor.wakeups,
+         (unsigned long long)reactor.events, reactor.busy_max_ns / 1e6);
+
+  /* release resource section */
+  if (fd >= 0) tcsetattr(fd, TCSANOW, &old_term);
+  while (clients) client_free(clients);
+  if (socket_path) {
+    close(listen_h.fd);
+    unlink(socket_path);
   }
-  dprintf(fd, "bye\n");
-  free(line);
-  restore_terminal(fd, &old_term);
-  close(fd);
+  reactor_close(&reactor);
+  close(sampler.tick.fd);
+  close(sampler.conv.fd);
+  close(stream.fd);
+  close(sig_h.fd);
+  sensor_cache_destroy(&cache);
+  htu21d_close(&sensor);
 }
@@ -1,48 +1,179 @@
+/**
+ * @file
+ * Print HTU21D measurements
+ *
+ * Temperature and humidity conversions are pipelined: the next conversion is
+ * started as soon as a result has been read, so converting and printing one
+ * result overlaps with the sensor measuring the next one. Results are read
+ * as soon as the sensor finishes (see htu21d.h) instead of after a fixed
+ * sleep. The number of pairs per second is printed on exit.
+ *
+ * With a target rate the pairs are paced on an absolute schedule and the
+ * most precise sampling profile that sustains the rate is programmed.
+ * SIGUSR1 doubles and SIGUSR2 halves the rate while running, switching the
+ * profile when needed:
+ *   kill -USR1 $(pidof serial)
+ *
+ * With an I2C device number the sensor is accessed through /dev/i2c-N
+ * (i2c_bus.h): every access is one ioctl that is retried when a signal
+ * interrupts it, so SIGUSR1 / SIGUSR2 cannot fail a read. Otherwise mraa
+ * bus I2C_BUS is used.
+ *
+ * With -o the readings are also appended to a sensor log (sensor_log.h),
+ * created with LOG_BLOCKS blocks if it does not exist. Paced readings are
+ * stamped with their scheduled time, so a steady rate costs one bit per
+ * timestamp.
+ *
+ * With -b the pairs are written to stdout as binary frames (frame.h) instead
+ * of text, 16 bytes a pair, for a serial port or a pipe into frame-dump; the
+ * other messages go to stderr:
+ *   ./bin/serial -b 50 > /dev/ttyS0
+ *
+ * Usage: serial [-o log_file] [-b] [pairs_per_s, default 0 = as fast as
+ *               possible] [i2c_dev]
+ */
+
+#include <math.h>
 #include <signal.h>
+#include <string.h>
 
 #include "mraa.h"
 #include "util.h"
+#include "htu21d.h"
+#include "sensor_log.h"
+#include "frame.h"
 
 #define I2C_BUS 0
-#define I2C_ADDRESS 0x40
-#define TEMPERATURE_MEASUREMENT 0xf3
-#define HUMIDITY_MEASUREMENT 0xf5
-// discard the last 2 status bits: 1111_1100
-#define DATA_MASK 0xfc
+#define LOG_BLOCKS 4096  // 16 MB
 
-volatile sig_atomic_t stopped = 0;
+volatile sig_atomic_t stopped = 0;  // the signal that stopped us
+volatile sig_atomic_t rate_shift = 0;  // rate = base rate * 2^rate_shift
 
-void int_handler(int sig) {
-  printf("Received signal %d\n", sig);
-  stopped = 1;
-}
+void int_handler(int sig) { stopped = sig; }  // main() reports it
 
-int main() {
-  mraa_i2c_context i2c = mraa_i2c_init(I2C_BUS);
-  MRAA_ASSERT(mraa_i2c_address(i2c, I2C_ADDRESS));
+void rate_handler(int sig) { rate_shift += sig == SIGUSR1 ? 1 : -1; }
+
+int main(int argc, char *argv[]) {
+  struct slog log;
+  const char *log_path = NULL;
+  int binary = 0;
+  while (argc > 1 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-b")) {
+      binary = 1;
+      argc--;
+      argv++;
+    } else if (argc > 2 && !strcmp(argv[1], "-o")) {
+      log_path = argv[2];
+      argc -= 2;
+      argv += 2;
+    } else {
+      break;
+    }
+  }
+  FILE *info = binary ? stderr : stdout;  // keep the frame stream clean
+  struct frame_writer fw;
+  frame_writer_init(&fw);
+  if (log_path && slog_open(&log, log_path, LOG_BLOCKS, 1)) {
+    perror("Cannot open the sensor log");
+    exit(EXIT_FAILURE);
+  }
+  double base_rate = argc > 1 ? atof(argv[1]) : 0;
+
+  struct htu21d dev;
+  struct i2c_bus bus;
+  int use_bus = argc > 2;
+  if (use_bus) {
+    int n = atoi(argv[2]);
+    if (i2c_bus_open(&bus, n) || htu21d_init_bus(&dev, &bus)) {
+      fprintf(stderr, "Cannot initalize HTU21D on /dev/i2c-%d\n", n);
+      fprintf(stderr, "Did you run with sudo?\n");
+      exit(EXIT_FAILURE);
+    }
+  } else if (htu21d_init(&dev, I2C_BUS)) {
+    fprintf(stderr, "Cannot initalize HTU21D on I2C bus %d\n", I2C_BUS);
+    fprintf(stderr, "Did you run with sudo?\n");
+    exit(EXIT_FAILURE);
+  }
 
   signal(SIGINT, int_handler);
+  signal(SIGUSR1, rate_handler);
+  signal(SIGUSR2, rate_handler);
 
-  // FIXME: MRAA can report error if mraa_i2c_write_byte is interrupted
+  // mraa can report an error if mraa_i2c_write_byte is interrupted by one of
+  // these signals; the i2c_bus transport retries instead
 
+  int applied_shift = -1000;  // force the first profile selection
+  double rate = 0;
+  uint64_t deadline = monotonic_ns();
+  int64_t wall0 = slog_now_ms();  // wall clock at deadline0, for the log
+  uint64_t deadline0 = deadline;
+  uint64_t pairs = 0, t0 = monotonic_ns();
+  if (htu21d_start(&dev, HTU21D_TEMP)) {
+    fprintf(stderr, "Cannot start a measurement. Did you run with sudo?\n");
+    exit(EXIT_FAILURE);
+  }
   while (!stopped) {
-    uint8_t buf[2];
-
-    MRAA_ASSERT(mraa_i2c_write_byte(i2c, TEMPERATURE_MEASUREMENT));
-    delay_ms(50);
-    mraa_i2c_read(i2c, buf, 2);
-    uint16_t temp_raw = (buf[0] << 8) + (buf[1] & DATA_MASK);
-    double temp = -46.85 + 175.72 * temp_raw / (1 << 16);
-
-    MRAA_ASSERT(mraa_i2c_write_byte(i2c, HUMIDITY_MEASUREMENT));
-    delay_ms(20);
-    mraa_i2c_read(i2c, buf, 2);
-    uint16_t hum_raw =
-        (buf[0] << 8) + (buf[1] & DATA_MASK);  // discard the last 2 status bits
-    double hum = -6.0 + 125.0 * hum_raw / (1 << 16);
-
-    printf("TEMP: %.2f C\tHUM: %.2f %%\n", temp, hum);
-    delay_ms(100);
+    uint64_t scheduled = deadline;  // when this temperature was started
+    uint16_t temp_raw = 0, hum_raw = 0;
+    int temp_ok = !htu21d_collect(&dev, &temp_raw);
+    htu21d_start(&dev, HTU21D_HUM);  // converts while temperature is computed
+    double temp = htu21d_temperature(temp_raw);
+
+    int hum_ok = !htu21d_collect(&dev, &hum_raw);
+    if (base_rate > 0 && rate_shift != applied_shift) {
+      // nothing is converting right now, the user register can be changed
+      applied_shift = rate_shift;
+      rate = ldexp(base_rate, applied_shift);  // no overflow at any shift
+      if (htu21d_set_rate(&dev, rate))
+        fprintf(stderr, "Cannot set the sensor resolution\n");
+      int p = htu21d_get_profile(&dev);  // -1: not one of the profiles
+      fprintf(info, "%.2f pairs/s: %s profile\n", rate,
+              p < 0 ? "unknown" : htu21d_profile_names[p]);
+    }
+    if (rate > 0) {
+      deadline += 1e9 / rate;
+      uint64_t now = monotonic_ns();
+      if (now < deadline) delay_ns(deadline - now);
+      else deadline = now;  // behind: do not burst to catch up
+    }
+    htu21d_start(&dev, HTU21D_TEMP);  // converts while we print
+    double hum = htu21d_humidity(hum_raw);
+
+    if (temp_ok && hum_ok) {
+      pairs++;
+      int64_t t = rate > 0 ? wall0 + (int64_t)(scheduled - deadline0) / 1000000
+                           : slog_now_ms();
+      if (binary) {
+        uint8_t out[FRAME_MAX_ENCODED];
+        frame_begin(&fw, t);
+        frame_add(&fw, FRAME_CH_TEMPERATURE, temp);
+        frame_add(&fw, FRAME_CH_HUMIDITY, hum);
+        fwrite(out, 1, frame_finish(&fw, out), stdout);
+        fflush(stdout);
+      } else {
+        printf("TEMP: %.2f C\tHUM: %.2f %%\n", temp, hum);
+      }
+      if (log_path) {
+        slog_append(&log, SLOG_TEMPERATURE, t, temp);
+        slog_append(&log, SLOG_HUMIDITY, t, hum);
+      }
+    } else {
+      fprintf(info, "read failed (%llu timeouts, %llu CRC errors)\n",
+              (unsigned long long)dev.timeouts,
+              (unsigned long long)dev.crc_errors);
+    }
   }
-  mraa_i2c_stop(i2c);
-}
\ No newline at end of file
+
+  fprintf(info, "Received signal %d\n", (int)stopped);
+  double s = (monotonic_ns() - t0) / 1e9;
+  fprintf(info,
+          "%llu pairs in %.2f s: %.1f pairs/s, %.2f read attempts per result\n",
+          (unsigned long long)pairs, s, pairs / s,
+          dev.reads ? (double)dev.polls / dev.reads : 0);
+  if (use_bus) {
+    i2c_bus_print_stats(info, &bus);
+    i2c_bus_close(&bus);
+  }
+  if (log_path) slog_close(&log);
+  htu21d_close(&dev);
+}
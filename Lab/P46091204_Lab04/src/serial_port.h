@@ -0,0 +1,116 @@
+/**
+ * @file
+ * Raw-mode serial port setup: baud rates up to 4 Mbaud, VMIN/VTIME profiles
+ *
+ * Canonical mode makes the line discipline buffer, echo and edit each line
+ * and hand it over only at its end; raw mode passes bytes through as they
+ * arrive and leaves lines to the program (rx_ring.h). Output keeps ONLCR,
+ * so text written with "\n" still shows right on a terminal.
+ *
+ * In raw mode VMIN and VTIME decide when a blocking read() returns:
+ *   SERIAL_LATENCY     VMIN 1, VTIME 0: at the first byte; one wakeup per
+ *                      burst the UART delivers
+ *   SERIAL_THROUGHPUT  VMIN SERIAL_BATCH, VTIME 1: once SERIAL_BATCH bytes
+ *                      are in, or 0.1 s after the last byte of a shorter
+ *                      burst; fewer, larger reads for streams, at up to
+ *                      0.1 s of delay for a lone short line
+ * For poll()/epoll the tty reports readable at the first byte whenever
+ * VTIME is set, so an event loop gets SERIAL_LATENCY behaviour either way.
+ * serial-bench measures both through a pty.
+ */
+
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define SERIAL_BATCH 64  // VMIN of SERIAL_THROUGHPUT, at most 255
+
+enum serial_mode { SERIAL_LATENCY, SERIAL_THROUGHPUT };
+
+/**
+ * termios speed constant of baud, 0 if the tty layer has none
+ */
+speed_t serial_speed(long baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 500000: return B500000;
+    case 576000: return B576000;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 2500000: return B2500000;
+    case 3000000: return B3000000;
+    case 3500000: return B3500000;
+    case 4000000: return B4000000;
+    default: return 0;
+  }
+}
+
+/**
+ * Parse "latency" or "throughput", return -1 for anything else
+ */
+int serial_mode_parse(const char *s) {
+  if (!strcmp(s, "latency")) return SERIAL_LATENCY;
+  if (!strcmp(s, "throughput")) return SERIAL_THROUGHPUT;
+  return -1;
+}
+
+void serial_mode_set(struct termios *t, enum serial_mode mode) {
+  t->c_cc[VMIN] = mode == SERIAL_THROUGHPUT ? SERIAL_BATCH : 1;
+  t->c_cc[VTIME] = mode == SERIAL_THROUGHPUT ? 1 : 0;
+}
+
+/**
+ * Put the tty fd in raw mode at baud, saving its settings into old
+ *
+ * baud 0 keeps the current speed (a pty). Return 0 on success, -1 with
+ * errno set (EINVAL for a baud rate without a speed constant).
+ */
+int serial_setup(int fd, long baud, enum serial_mode mode,
+                 struct termios *old) {
+  speed_t speed = baud ? serial_speed(baud) : 0;
+  if (baud && !speed) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct termios t;
+  if (tcgetattr(fd, &t)) return -1;
+  if (old) *old = t;
+  cfmakeraw(&t);
+  t.c_oflag |= OPOST | ONLCR;
+  t.c_cflag |= CLOCAL | CREAD;
+  serial_mode_set(&t, mode);
+  if (speed) cfsetspeed(&t, speed);
+  return tcsetattr(fd, TCSANOW, &t);
+}
+
+/**
+ * Open a serial port with serial_setup(), return its fd or -1
+ */
+int serial_open(const char *path, long baud, enum serial_mode mode,
+                struct termios *old) {
+  int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  if (serial_setup(fd, baud, mode, old)) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * @file
+ * Transmit queue for a blocking serial fd: batched, coalesced and paced
+ *
+ * Output is formatted (tx_queue_printf()) or copied (tx_queue_put()) into
+ * one reusable buffer, or referenced in place when it is a constant string
+ * (tx_queue_put_const()), and nothing is written until tx_queue_flush():
+ * then all the fragments go out with one writev() (per TX_QUEUE_IOV
+ * fragments) instead of one write() per dprintf(). Text formatted back to
+ * back lies back to back in the buffer and takes a single iovec.
+ *
+ * Given a baud rate, the queue keeps track of when the line will have sent
+ * what was written (10 bits per byte, 8N1) and never writes more than
+ * window bytes ahead of it; the rest waits in a sleep until the UART has
+ * sent enough. The default window, TX_QUEUE_WINDOW, keeps the tty driver's
+ * buffer short; a window of the UART FIFO size (16 on a 16550) hands the
+ * driver no more than the FIFO holds. Without a baud rate (a pty, a
+ * socket) nothing is paced.
+ *
+ * tx_queue_report() prints the bytes per syscall and the deepest queue.
+ */
+
+#ifndef TX_QUEUE_H
+#define TX_QUEUE_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define TX_QUEUE_SIZE 4096
+#define TX_QUEUE_IOV 32
+#define TX_QUEUE_WINDOW 256
+
+struct tx_queue {
+  int fd;
+  char buf[TX_QUEUE_SIZE];
+  size_t used;  // bytes of buf taken by queued fragments
+  struct iovec iov[TX_QUEUE_IOV];
+  int n;
+  size_t pending;        // bytes queued
+  uint64_t ns_per_byte;  // on the line, 0: not paced
+  size_t window;
+  uint64_t idle_ns;  // when the line will have sent all that was written
+  uint64_t bytes, syscalls, waits, wait_ns;
+  size_t max_depth;
+  int max_fragments;
+};
+
+/**
+ * Queue for fd, paced to baud (0: not paced)
+ */
+void tx_queue_init(struct tx_queue *q, int fd, long baud) {
+  memset(q, 0, sizeof(*q));
+  q->fd = fd;
+  q->window = TX_QUEUE_WINDOW;
+  q->ns_per_byte = baud > 0 ? 10000000000ull / baud : 0;
+}
+
+/**
+ * Sleep until the line has room for want bytes, return how many may go
+ */
+size_t tx_queue_pace(struct tx_queue *q, size_t want) {
+  if (!q->ns_per_byte) return want;
+  if (want > q->window) want = q->window;
+  uint64_t now = monotonic_ns();
+  uint64_t ahead = q->idle_ns > now ? q->idle_ns - now : 0;
+  uint64_t allowed = (q->window - want) * q->ns_per_byte;
+  if (ahead > allowed) {
+    q->waits++;
+    q->wait_ns += ahead - allowed;
+    delay_ns(ahead - allowed);
+  }
+  return want;
+}
+
+/**
+ * Write everything queued, return 0 on success, -1 on error
+ *
+ * The queue is empty afterwards either way.
+ */
+int tx_queue_flush(struct tx_queue *q) {
+  struct iovec *iov = q->iov;
+  int n = q->n, ret = 0;
+  size_t left = q->pending;
+  while (n > 0) {
+    // the fragments that make up the next want bytes, the last one cut
+    size_t want = tx_queue_pace(q, left), sum = 0;
+    int k = 0;
+    while (k < n && sum + iov[k].iov_len <= want) sum += iov[k++].iov_len;
+    size_t cut_len = 0;
+    if (k < n && sum < want) {
+      cut_len = iov[k].iov_len;
+      iov[k++].iov_len = want - sum;
+    }
+    ssize_t w = writev(q->fd, iov, k);
+    if (cut_len) iov[k - 1].iov_len = cut_len;
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      ret = -1;
+      break;
+    }
+    q->syscalls++;
+    q->bytes += w;
+    left -= w;
+    if (q->ns_per_byte) {
+      uint64_t now = monotonic_ns();
+      if (q->idle_ns < now) q->idle_ns = now;
+      q->idle_ns += w * q->ns_per_byte;
+    }
+    for (; n > 0 && (size_t)w >= iov->iov_len; iov++, n--)
+      w -= iov->iov_len;
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  q->n = 0;
+  q->used = 0;
+  q->pending = 0;
+  return ret;
+}
+
+/**
+ * Queue n bytes at s, which must stay unchanged until the next flush
+ */
+int tx_queue_add(struct tx_queue *q, const void *s, size_t n) {
+  if (n == 0) return 0;
+  struct iovec *last = q->n ? &q->iov[q->n - 1] : NULL;
+  if (last && (const char *)last->iov_base + last->iov_len == s) {
+    last->iov_len += n;  // right after the previous fragment
+  } else {
+    if (q->n == TX_QUEUE_IOV && tx_queue_flush(q)) return -1;
+    q->iov[q->n++] = (struct iovec){(void *)s, n};
+  }
+  q->pending += n;
+  if (q->pending > q->max_depth) q->max_depth = q->pending;
+  if (q->n > q->max_fragments) q->max_fragments = q->n;
+  return 0;
+}
+
+/**
+ * Queue a string that does not change (a literal): no copy
+ */
+int tx_queue_put_const(struct tx_queue *q, const char *s) {
+  return tx_queue_add(q, s, strlen(s));
+}
+
+/**
+ * Queue a copy of n bytes, return 0 on success, -1 on a write error
+ */
+int tx_queue_put(struct tx_queue *q, const void *s, size_t n) {
+  // flush first rather than in tx_queue_add(), which would free the copy
+  if ((n > TX_QUEUE_SIZE - q->used || q->n == TX_QUEUE_IOV) &&
+      tx_queue_flush(q))
+    return -1;
+  if (n > TX_QUEUE_SIZE) {  // too big to copy: send it from where it is
+    return tx_queue_add(q, s, n) || tx_queue_flush(q) ? -1 : 0;
+  }
+  memcpy(q->buf + q->used, s, n);
+  q->used += n;
+  return tx_queue_add(q, q->buf + q->used - n, n);
+}
+
+/**
+ * Format into the queue, return 0 on success, -1 on error
+ */
+int tx_queue_printf(struct tx_queue *q, const char *fmt, ...) {
+  if (q->n == TX_QUEUE_IOV && tx_queue_flush(q)) return -1;  // as above
+  va_list ap, again;
+  va_start(ap, fmt);
+  va_copy(again, ap);
+  size_t room = TX_QUEUE_SIZE - q->used;
+  int n = vsnprintf(q->buf + q->used, room, fmt, ap);
+  int ret = 0;
+  if (n < 0) {
+    ret = -1;
+  } else if ((size_t)n < room) {
+    q->used += n;
+    ret = tx_queue_add(q, q->buf + q->used - n, n);
+  } else {  // does not fit after what is queued: format it again
+    char *s = malloc(n + 1);
+    if (!s) {
+      ret = -1;
+    } else {
+      vsnprintf(s, n + 1, fmt, again);
+      ret = tx_queue_put(q, s, n);
+      free(s);
+    }
+  }
+  va_end(again);
+  va_end(ap);
+  return ret;
+}
+
+/**
+ * One line: bytes per syscall, deepest queue, time spent waiting for the
+ * line
+ */
+void tx_queue_report(const struct tx_queue *q, FILE *f) {
+  fprintf(f,
+          "tx: %llu bytes in %llu writes (%.1f bytes/write), queue up to "
+          "%zu bytes in %d fragments, waited %llu times for %.1f ms\n",
+          (unsigned long long)q->bytes, (unsigned long long)q->syscalls,
+          q->syscalls ? (double)q->bytes / q->syscalls : 0, q->max_depth,
+          q->max_fragments, (unsigned long long)q->waits, q->wait_ns / 1e6);
+}
+
+#endif